@@ -1,123 +1,250 @@
 #include "CentralCache.h"
 #include "PageCache.h"
-#include <cassert>
-#include <thread>
+#include "NumaTopology.h"
 
 namespace memoryPool {
 
-// 每次从PageCache获取的span有多少页
-static constexpr size_t SPAN_PAGES = 8;
-
-void* CentralCache::fetchRange(size_t index, size_t batchNum) {
+void* CentralCache::fetchRange(size_t index, size_t& batchNum, void*& end) {
     if(index >= FREE_LIST_SIZE || batchNum == 0) return nullptr;
 
-    while(locks_[index].test_and_set(std::memory_order_acquire)) {}
-    
+    // 从当前NUMA节点的bin获取, 对象都来自本节点的页
+    size_t node = NumaTopology::getInstance().currentNode();
+    Bin& bin = bins_[node][index];
+    std::unique_lock<SpinLock> lock(bin.lock);
+    bin.fetchCount.store(bin.fetchCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    // 请求恰好一批时优先整批取走传输缓存中的对象
+    if(batchNum == SizeClass::batchNum(index) && bin.transferUsed > 0) {
+        TransferBatch& batch = bin.transferBatches[--bin.transferUsed];
+        bin.transferFetchCount.store(bin.transferFetchCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        end = batch.tail;
+        return batch.head;
+    }
+
     void* result = nullptr;
-    try {
-        result = centralFreeList_[index].load(std::memory_order_relaxed);
-        // 空闲链表空了
-        if(!result) {
-            size_t size = (index + 1) * ALIGNMENT;
-            result = fetchFromPageCache(size);
-
-            if(!result) {
-                locks_[index].clear(std::memory_order_release);
-                return nullptr;
-            }
+    void* tail = nullptr;
+    size_t count = 0;
+    while(count < batchNum) {
+        Span* span = bin.nonemptySpans;
+        // 没有还有空闲对象的span了, 向页缓存申请新的span
+        if(!span) {
+            span = fetchFromPageCache(index, node);
+            if(!span) break;
+            bin.spanCount++;
+            insertNonemptySpan(bin, span);
+        }
 
-            // 如果申请的内存比较小，小于页缓存返回的最小值SPAN_PAGES, 进行切分
-            char* start = static_cast<char*>(result);
-            size_t totalBlocks = (SPAN_PAGES * PageCache::PAGE_SIZE) / size;
-            size_t allocBlocks = std::min(batchNum, totalBlocks);
-
-            // 构建返回给ThreadCache的内存块链表
-            if(allocBlocks > 1) {
-                for(size_t i = 1; i < allocBlocks; ++i) {
-                    void* current = start + (i - 1) * size;
-                    void* next = start + i * size;
-                    *reinterpret_cast<void**>(current) = next;
-                }
-                *reinterpret_cast<void**>(start + (allocBlocks - 1) * size) = nullptr;
+        // 从span的空闲对象链表上取出对象, 拼接到返回给ThreadCache的链表
+        while(span->freeList && count < batchNum) {
+            void* obj = span->freeList;
+            span->freeList = *reinterpret_cast<void**>(obj);
+            if(tail) {
+                *reinterpret_cast<void**>(tail) = obj;
             }
-
-            // 构建保留在CentralCache的链表
-            if(totalBlocks > allocBlocks) {
-                void* remainStart = start + allocBlocks * size;
-                for(size_t i = allocBlocks + 1; i < totalBlocks; ++i) {
-                    void* current = start + (i - 1) * size;
-                    void* next = start + i * size;
-                    *reinterpret_cast<void**>(current) = next;
-                }
-                *reinterpret_cast<void**>(start + (totalBlocks - 1) * size) = nullptr;
-
-                centralFreeList_[index].store(remainStart, std::memory_order_release);
+            else {
+                result = obj;
             }
-            
+            tail = obj;
+            span->useCount++;
+            count++;
         }
-        else {
-            // 空闲链表中还有
-            void* current = result;
-            void* prev = nullptr;
-            size_t count = 0;
-            
-            while(current && count < batchNum) {
-                prev = current;
-                current = *reinterpret_cast<void**>(current);
-                count ++;
-            }
-
-            if(prev) {
-                *reinterpret_cast<void**>(prev) = nullptr;
-            }
 
-            centralFreeList_[index].store(current, std::memory_order_release);
+        // span的对象已全部分出
+        if(!span->freeList) {
+            removeNonemptySpan(bin, span);
         }
     }
-    catch (...) 
-    {
-        locks_[index].clear(std::memory_order_release);
-        throw;
+
+    if(tail) {
+        *reinterpret_cast<void**>(tail) = nullptr;
     }
 
     // 释放锁
-    locks_[index].clear(std::memory_order_release);
+    lock.unlock();
+    batchNum = count;
+    end = tail;
     return result;
 }
 
-void CentralCache::returnRange(void* start, size_t size, size_t index) {
+void CentralCache::returnRange(void* start, void* end, size_t count, size_t index) {
     if(!start || index >= FREE_LIST_SIZE) return;
-    while(locks_[index].test_and_set(std::memory_order_acquire)) {};
-    try {
-        void* end = start;
-        size_t count = 1;
-        while(*reinterpret_cast<void**>(end) != nullptr && count < size) {
-            end = *reinterpret_cast<void**>(end);
-            count++;
+
+    *reinterpret_cast<void**>(end) = nullptr;
+
+    // 只有一个节点分配过span时整条还给节点0的bin
+    if(maxNode_.load(std::memory_order_relaxed) == 0) {
+        returnToBin(bins_[0][index], start, end, count, index);
+        return;
+    }
+
+    // 否则在锁外按span所在节点拆分, 每个节点的对象还给各自的bin
+    PageCache& pageCache = PageCache::getInstance();
+    void* heads[MAX_NUMA_NODES] = {};
+    void* tails[MAX_NUMA_NODES] = {};
+    size_t counts[MAX_NUMA_NODES] = {};
+    void* current = start;
+    for(size_t i = 0; i < count && current; ++i) {
+        void* next = *reinterpret_cast<void**>(current);
+        size_t node = pageCache.getSpan(current)->node;
+        *reinterpret_cast<void**>(current) = heads[node];
+        if(!heads[node]) {
+            tails[node] = current;
+        }
+        heads[node] = current;
+        counts[node]++;
+        current = next;
+    }
+    for(size_t node = 0; node < MAX_NUMA_NODES; ++node) {
+        if(counts[node]) {
+            returnToBin(bins_[node][index], heads[node], tails[node], counts[node], index);
         }
+    }
+}
+
+void CentralCache::returnToBin(Bin& bin, void* start, void* end, size_t count, size_t index) {
+    PageCache& pageCache = PageCache::getInstance();
+    std::lock_guard<SpinLock> lock(bin.lock);
+    bin.returnCount.store(bin.returnCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 
-        void* current = centralFreeList_[index].load(std::memory_order_relaxed);
-        *reinterpret_cast<void**>(end) = current;
-        centralFreeList_[index].store(start, std::memory_order_release);
+    // 恰好一批且传输缓存未满时整批保存, 无需逐个放回span
+    if(count == SizeClass::batchNum(index) && bin.transferUsed < detail::transferCapacity(index)) {
+        bin.transferBatches[bin.transferUsed++] = TransferBatch{start, end, count};
+        bin.transferReturnCount.store(bin.transferReturnCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
     }
-    catch(...) {
-        locks_[index].clear(std::memory_order_release);
-        throw;
+
+    void* current = start;
+    for(size_t i = 0; i < count && current; ++i) {
+        void* next = *reinterpret_cast<void**>(current);
+
+        // 通过页映射找到对象所属的span, 放回该span的空闲对象链表
+        Span* span = pageCache.getSpan(current);
+        if(!span->freeList) {
+            insertNonemptySpan(bin, span);
+        }
+        *reinterpret_cast<void**>(current) = span->freeList;
+        span->freeList = current;
+
+        // span的对象全部归还, 整个span交还页缓存, 可被合并或用于其他大小类
+        if(--span->useCount == 0) {
+            removeNonemptySpan(bin, span);
+            bin.spanCount--;
+            pageCache.deallocateSpan(span->pageAddr);
+        }
+        current = next;
     }
+}
 
-    locks_[index].clear(std::memory_order_release);
+CentralCacheStats CentralCache::getStats() const {
+    CentralCacheStats stats{0, 0, 0, 0, 0, 0, 0};
+    for(size_t i = 0; i < FREE_LIST_SIZE * MAX_NUMA_NODES; ++i) {
+        const Bin& bin = bins_[i / FREE_LIST_SIZE][i % FREE_LIST_SIZE];
+        LockStats lockStats = bin.lock.getStats();
+        stats.lockAcquisitions += lockStats.acquisitions;
+        stats.lockContended += lockStats.contended;
+        stats.lockWaitNanos += lockStats.waitNanos;
+        stats.fetchCount += bin.fetchCount.load(std::memory_order_relaxed);
+        stats.returnCount += bin.returnCount.load(std::memory_order_relaxed);
+        stats.transferFetchCount += bin.transferFetchCount.load(std::memory_order_relaxed);
+        stats.transferReturnCount += bin.transferReturnCount.load(std::memory_order_relaxed);
+    }
+    return stats;
 }
 
-void* CentralCache::fetchFromPageCache(size_t size) {
-    // 1. 计算实际需要的页数
-    size_t numPages = (size + PageCache::PAGE_SIZE - 1) / PageCache::PAGE_SIZE;
-    // 2. 根据大小决定分配策略
-    if(size <= SPAN_PAGES * PageCache::PAGE_SIZE) {
-        return PageCache::getInstance().allocateSpan(SPAN_PAGES);
+LockStats CentralCache::getLockStats(size_t index) const {
+    LockStats stats{0, 0, 0};
+    for(size_t node = 0; node < MAX_NUMA_NODES; ++node) {
+        LockStats nodeStats = bins_[node][index].lock.getStats();
+        stats.acquisitions += nodeStats.acquisitions;
+        stats.contended += nodeStats.contended;
+        stats.waitNanos += nodeStats.waitNanos;
+    }
+    return stats;
+}
+
+CentralClassStats CentralCache::getClassStats(size_t index) {
+    CentralClassStats stats{0, 0, 0, 0};
+    size_t size = SizeClass::classSize(index);
+    for(size_t node = 0; node < MAX_NUMA_NODES; ++node) {
+        Bin& bin = bins_[node][index];
+        std::lock_guard<SpinLock> lock(bin.lock);
+        stats.fetchCount += bin.fetchCount.load(std::memory_order_relaxed);
+        stats.returnCount += bin.returnCount.load(std::memory_order_relaxed);
+        stats.spans += bin.spanCount;
+        // 已分出的span不在链表中, 没有空闲对象
+        for(Span* span = bin.nonemptySpans; span; span = span->next) {
+            stats.freeObjects += span->numPages * PAGE_SIZE / size - span->useCount;
+        }
+        for(size_t i = 0; i < bin.transferUsed; ++i) {
+            stats.freeObjects += bin.transferBatches[i].count;
+        }
+    }
+    return stats;
+}
+
+void CentralCache::prepareFork() {
+    for(size_t node = 0; node < MAX_NUMA_NODES; ++node) {
+        for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+            bins_[node][index].lock.lock();
+        }
+    }
+}
+
+void CentralCache::afterFork() {
+    for(size_t node = MAX_NUMA_NODES; node-- > 0;) {
+        for(size_t index = FREE_LIST_SIZE; index-- > 0;) {
+            bins_[node][index].lock.unlock();
+        }
+    }
+}
+
+Span* CentralCache::fetchFromPageCache(size_t index, size_t node) {
+    // span页数由大小类表决定, 保证切分后的尾部浪费有上限
+    PageCache& pageCache = PageCache::getInstance();
+    void* memory = pageCache.allocateSpan(SizeClass::classPages(index), index, node);
+    if(!memory) return nullptr;
+
+    // 记录出现过的最大节点号, 之后的归还需要按节点拆分
+    if(node > maxNode_.load(std::memory_order_relaxed)) {
+        maxNode_.store(node, std::memory_order_relaxed);
+    }
+
+    // 把span切分成对象链表
+    Span* span = pageCache.getSpan(memory);
+    size_t size = SizeClass::classSize(index);
+    size_t totalBlocks = (span->numPages * PAGE_SIZE) / size;
+    char* start = static_cast<char*>(memory);
+    for(size_t i = 1; i < totalBlocks; ++i) {
+        *reinterpret_cast<void**>(start + (i - 1) * size) = start + i * size;
+    }
+    *reinterpret_cast<void**>(start + (totalBlocks - 1) * size) = nullptr;
+
+    span->freeList = start;
+    span->useCount = 0;
+    return span;
+}
+
+void CentralCache::insertNonemptySpan(Bin& bin, Span* span) {
+    span->prev = nullptr;
+    span->next = bin.nonemptySpans;
+    if(span->next) {
+        span->next->prev = span;
+    }
+    bin.nonemptySpans = span;
+}
+
+void CentralCache::removeNonemptySpan(Bin& bin, Span* span) {
+    if(span->prev) {
+        span->prev->next = span->next;
     }
     else {
-        return PageCache::getInstance().allocateSpan(numPages);
+        bin.nonemptySpans = span->next;
+    }
+    if(span->next) {
+        span->next->prev = span->prev;
     }
+    span->next = nullptr;
+    span->prev = nullptr;
 }
 
-}  
\ No newline at end of file
+}
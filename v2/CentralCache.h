@@ -1,9 +1,43 @@
 #pragma once
 #include "Common.h"
+#include "SpinLock.h"
+#include "NumaTopology.h"
 #include <mutex>
 
 namespace memoryPool {
 
+struct Span;
+
+// 中心缓存统计
+struct CentralCacheStats {
+    size_t fetchCount;          // fetchRange调用次数
+    size_t returnCount;         // returnRange调用次数
+    size_t transferFetchCount;  // 直接从传输缓存取走整批的次数
+    size_t transferReturnCount; // 整批放入传输缓存的次数
+    size_t lockAcquisitions;    // 各大小类锁的获取次数
+    size_t lockContended;       // 其中需要等待的次数
+    size_t lockWaitNanos;       // 等待锁的总纳秒数
+};
+
+// 中心缓存中单个大小类在所有节点上的统计
+struct CentralClassStats {
+    size_t fetchCount;      // 前端取批次数
+    size_t returnCount;     // 前端归还次数
+    size_t spans;           // 该大小类持有的span数
+    size_t freeObjects;     // span和传输缓存中的空闲对象数
+};
+
+namespace detail {
+    // 每个大小类的传输缓存最多保存的批数, 以及保存的字节数上限
+    constexpr size_t MAX_TRANSFER_BATCHES = 64;
+    constexpr size_t MAX_TRANSFER_BYTES = 256 * 1024;
+
+    constexpr size_t transferCapacity(size_t index) {
+        size_t batchBytes = SIZE_CLASS_TABLE.classes[index].size * SIZE_CLASS_TABLE.classes[index].batch;
+        return std::max(size_t(2), std::min(MAX_TRANSFER_BATCHES, MAX_TRANSFER_BYTES / batchBytes));
+    }
+}
+
 class CentralCache {
 public:
     static CentralCache& getInstance() {
@@ -11,29 +45,70 @@ public:
         return instance;
     }
 
-    void* fetchRange(size_t index, size_t batchNum);
-    void returnRange(void* start, size_t size, size_t bytes);
+    // 批量获取对象, batchNum 返回实际获取到的个数, end 返回链表尾
+    void* fetchRange(size_t index, size_t& batchNum, void*& end);
+    // 归还start到end的count个对象, 恰好一批时在锁内O(1)放入传输缓存
+    void returnRange(void* start, void* end, size_t count, size_t index);
+
+    CentralCacheStats getStats() const;
+    // 单个大小类在所有节点上的锁统计之和
+    LockStats getLockStats(size_t index) const;
+    // 单个大小类的统计, 逐个节点加锁遍历非空span
+    CentralClassStats getClassStats(size_t index);
+
+    // fork前按节点和大小类的顺序取得全部bin的锁, fork后在父子进程中释放
+    void prepareFork();
+    void afterFork();
 
 private:
-    CentralCache() {
-        for(auto& ptr : centralFreeList_) {
-            ptr.store(nullptr, std::memory_order_relaxed);
-        }
-
-        // 初始化所有锁
-        for(auto& lock : locks_) {
-            lock.clear();
-        }
-    }
+    CentralCache() = default;
+
+private:
+    // 串好的一整批对象
+    struct TransferBatch {
+        void* head;
+        void* tail;
+        size_t count;
+    };
+
+    // 单个大小类的全部状态, 按缓存行对齐, 不同大小类之间不会伪共享
+    // 锁、链表头和计数放在开头, 常用字段集中在前两个缓存行
+    struct alignas(CACHE_LINE_SIZE) Bin {
+        // 先自旋后睡眠的锁, 保护本结构的其余字段
+        SpinLock lock;
+        // 还有空闲对象的span链表
+        Span* nonemptySpans = nullptr;
+        // 传输缓存中的批数
+        size_t transferUsed = 0;
+        // 从页缓存取得、尚未交还的span数
+        size_t spanCount = 0;
+        // 调用次数, 在锁内更新
+        std::atomic<size_t> fetchCount{0};
+        std::atomic<size_t> returnCount{0};
+        std::atomic<size_t> transferFetchCount{0};
+        std::atomic<size_t> transferReturnCount{0};
+        // 传输缓存: 整批对象在ThreadCache和CentralCache间搬运时不必逐个遍历
+        TransferBatch transferBatches[detail::MAX_TRANSFER_BATCHES];
+    };
 
-    // 从页缓存获取内存
-    void* fetchFromPageCache(size_t size);
+    // 从页缓存获取指定节点上的span并切分成对象链表
+    Span* fetchFromPageCache(size_t index, size_t node);
+
+    // 把同一节点的对象还给该节点的bin
+    void returnToBin(Bin& bin, void* start, void* end, size_t count, size_t index);
+
+    // 非空span链表的插入和摘除, 复用span的next/prev指针
+    void insertNonemptySpan(Bin& bin, Span* span);
+    void removeNonemptySpan(Bin& bin, Span* span);
 
 private:
-    // 空闲链表数组
-    std::array<std::atomic<void*>, FREE_LIST_SIZE> centralFreeList_;
-    // 用于同步的自旋锁
-    std::array<std::atomic_flag, FREE_LIST_SIZE> locks_;
+    // 每个NUMA节点一组bin, 节点内的span只放在本节点的bin中
+    std::array<std::array<Bin, FREE_LIST_SIZE>, MAX_NUMA_NODES> bins_;
+    // 分配过span的最大节点号, 为0时归还无需按节点拆分
+    std::atomic<size_t> maxNode_{0};
 };
 
-};
\ No newline at end of file
+// 单例不登记析构函数, 静态析构之后释放内存时仍可使用
+static_assert(std::is_trivially_destructible<CentralCache>::value, "singleton is never destroyed");
+
+};
@@ -1,13 +1,21 @@
 #pragma once
 #include <cstddef>
+#include <cstdint>
 #include <atomic>
 #include <array>
+#include <algorithm>
 
 namespace memoryPool {
     // 对齐数和大小定义
     constexpr size_t ALIGNMENT = 8;
     constexpr size_t MAX_BYTES = 256 * 1024;
-    constexpr size_t FREE_LIST_SIZE = MAX_BYTES / ALIGNMENT;
+
+    // 缓存行大小, 被不同线程频繁写入的数据按此对齐
+    constexpr size_t CACHE_LINE_SIZE = 64;
+
+    // 页大小定义
+    constexpr size_t PAGE_SHIFT = 12;
+    constexpr size_t PAGE_SIZE = size_t(1) << PAGE_SHIFT;
 
     // 内存块头部信息
     struct BlockHeader {
@@ -16,20 +24,176 @@ namespace memoryPool {
         BlockHeader* next;
     };
 
+    // 单个大小类的属性
+    struct SizeClassInfo {
+        size_t size;    // 对象大小
+        size_t pages;   // CentralCache每次向PageCache申请的span页数
+        size_t batch;   // ThreadCache与CentralCache之间一次搬运的对象数
+    };
+
+    namespace detail {
+        // 大小类的最大对齐粒度, 决定了大尺寸区间类的稀疏程度
+        constexpr size_t MAX_CLASS_ALIGNMENT = 8 * 1024;
+        // span切分后尾部浪费不超过 1 / (1 << MAX_WASTE_SHIFT), 即12.5%
+        constexpr size_t MAX_WASTE_SHIFT = 3;
+        // 一次批量搬运的字节数上限及对象数上限
+        constexpr size_t MAX_BATCH_BYTES = 32 * 1024;
+        constexpr size_t MAX_BATCH_NUM = 64;
+        // 生成表时的容量上限, 实际类数见 FREE_LIST_SIZE
+        constexpr size_t MAX_SIZE_CLASSES = 128;
+
+        struct SizeClassTable {
+            SizeClassInfo classes[MAX_SIZE_CLASSES];
+            size_t count;
+        };
+
+        constexpr size_t lgFloor(size_t n) {
+            size_t log = 0;
+            while(n >>= 1) {
+                ++log;
+            }
+            return log;
+        }
+
+        // 相邻大小类的间距: 小尺寸按8/16字节, 之后每个2的幂区间切成8份
+        constexpr size_t alignmentForSize(size_t size) {
+            size_t alignment = ALIGNMENT;
+            if(size >= 128) {
+                alignment = (size_t(1) << lgFloor(size)) / 8;
+            }
+            else if(size >= 16) {
+                alignment = 16;
+            }
+            return std::min(alignment, MAX_CLASS_ALIGNMENT);
+        }
+
+        constexpr size_t batchForSize(size_t size) {
+            return std::max(size_t(1), std::min(MAX_BATCH_NUM, MAX_BATCH_BYTES / size));
+        }
+
+        // 选出能容纳至少 batch/4 个对象且尾部浪费不超标的最小页数
+        constexpr size_t pagesForSize(size_t size, size_t batch) {
+            size_t bytes = 0;
+            do {
+                bytes += PAGE_SIZE;
+                while((bytes % size) > (bytes >> MAX_WASTE_SHIFT)) {
+                    bytes += PAGE_SIZE;
+                }
+            } while(bytes / size < (batch + 3) / 4);
+            return bytes / PAGE_SIZE;
+        }
+
+        constexpr SizeClassTable makeSizeClassTable() {
+            SizeClassTable table{};
+            size_t alignment = ALIGNMENT;
+            for(size_t size = ALIGNMENT; size <= MAX_BYTES; size += alignment) {
+                alignment = alignmentForSize(size);
+                size_t batch = batchForSize(size);
+                size_t pages = pagesForSize(size, batch);
+
+                // 与前一个类页数相同且每个span切出的对象数也相同时, 合并成一个更大的类, 不会增加浪费
+                if(table.count > 0) {
+                    SizeClassInfo& prev = table.classes[table.count - 1];
+                    if(prev.pages == pages && (pages * PAGE_SIZE) / size == (prev.pages * PAGE_SIZE) / prev.size) {
+                        prev.size = size;
+                        prev.batch = batch;
+                        continue;
+                    }
+                }
+                table.classes[table.count++] = SizeClassInfo{size, pages, batch};
+            }
+            return table;
+        }
+
+        inline constexpr SizeClassTable SIZE_CLASS_TABLE = makeSizeClassTable();
+
+        // 请求大小到查找数组下标: 1024以内按8字节粒度, 以上按128字节粒度
+        constexpr size_t classArrayIndex(size_t bytes) {
+            return bytes <= 1024 ? (bytes + 7) >> 3 : (bytes + 127 + (120 << 7)) >> 7;
+        }
+
+        constexpr size_t CLASS_ARRAY_SIZE = classArrayIndex(MAX_BYTES) + 1;
+
+        constexpr std::array<uint8_t, CLASS_ARRAY_SIZE> makeClassArray() {
+            std::array<uint8_t, CLASS_ARRAY_SIZE> array{};
+            size_t next = 0;
+            for(size_t index = 0; index < SIZE_CLASS_TABLE.count; ++index) {
+                size_t last = classArrayIndex(SIZE_CLASS_TABLE.classes[index].size);
+                for(; next <= last; ++next) {
+                    array[next] = static_cast<uint8_t>(index);
+                }
+            }
+            return array;
+        }
+
+        inline constexpr std::array<uint8_t, CLASS_ARRAY_SIZE> CLASS_ARRAY = makeClassArray();
+
+        // 对象从span起始处按大小依次切分, span按页对齐, 所以大小是2^shift倍数的类中每个对象都对齐到2^shift
+        // ALIGNED_CLASS[shift - MIN_ALIGN_SHIFT][i]: 从第i个类起第一个大小是2^shift倍数的类, 没有时为类的个数
+        constexpr size_t MIN_ALIGN_SHIFT = 4;
+        constexpr size_t NUM_ALIGN_SHIFTS = PAGE_SHIFT - MIN_ALIGN_SHIFT + 1;
+        static_assert(SIZE_CLASS_TABLE.count < 256, "aligned class index must fit in uint8_t");
+
+        using AlignedClassTable = std::array<std::array<uint8_t, MAX_SIZE_CLASSES>, NUM_ALIGN_SHIFTS>;
+
+        constexpr AlignedClassTable makeAlignedClassTable() {
+            AlignedClassTable table{};
+            for(size_t shift = 0; shift < NUM_ALIGN_SHIFTS; ++shift) {
+                size_t alignment = size_t(1) << (shift + MIN_ALIGN_SHIFT);
+                size_t next = SIZE_CLASS_TABLE.count;
+                for(size_t index = SIZE_CLASS_TABLE.count; index-- > 0; ) {
+                    if(SIZE_CLASS_TABLE.classes[index].size % alignment == 0) {
+                        next = index;
+                    }
+                    table[shift][index] = static_cast<uint8_t>(next);
+                }
+            }
+            return table;
+        }
+
+        inline constexpr AlignedClassTable ALIGNED_CLASS = makeAlignedClassTable();
+    }
+
+    // 大小类个数, 也是ThreadCache和CentralCache中自由链表数组的长度
+    constexpr size_t FREE_LIST_SIZE = detail::SIZE_CLASS_TABLE.count;
+    static_assert(FREE_LIST_SIZE <= detail::MAX_SIZE_CLASSES, "size class table overflow");
+    static_assert(FREE_LIST_SIZE <= 256, "class index must fit in uint8_t");
+    static_assert(detail::SIZE_CLASS_TABLE.classes[FREE_LIST_SIZE - 1].size == MAX_BYTES, "last class must be MAX_BYTES");
+
     // 大小类管理
     class SizeClass {
     public:
-        // 内存对齐
-        static size_t roundUp(size_t bytes) {
-            return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+        // 向上取整到所属大小类的对象大小
+        static constexpr size_t roundUp(size_t bytes) {
+            return classSize(getIndex(bytes));
         }
 
         // 计算自由链表数组索引
-        static size_t getIndex(size_t bytes) {
-            // 确保bytes至少为ALIGNMENT
-            bytes = std::max(bytes, ALIGNMENT);
-            // 向上取整后 -1
-            return (bytes + ALIGNMENT - 1) / ALIGNMENT - 1;
+        static constexpr size_t getIndex(size_t bytes) {
+            return detail::CLASS_ARRAY[detail::classArrayIndex(bytes)];
+        }
+
+        // 能容纳bytes且每个对象都对齐到alignment的最小大小类, alignment为不超过PAGE_SIZE的2的幂
+        // 没有这样的类时返回FREE_LIST_SIZE
+        static constexpr size_t getAlignedIndex(size_t bytes, size_t alignment) {
+            size_t index = getIndex(bytes);
+            if(alignment <= ALIGNMENT) return index;
+            return detail::ALIGNED_CLASS[detail::lgFloor(alignment) - detail::MIN_ALIGN_SHIFT][index];
+        }
+
+        // 大小类的对象大小
+        static constexpr size_t classSize(size_t index) {
+            return detail::SIZE_CLASS_TABLE.classes[index].size;
+        }
+
+        // 大小类每个span的页数
+        static constexpr size_t classPages(size_t index) {
+            return detail::SIZE_CLASS_TABLE.classes[index].pages;
+        }
+
+        // 大小类一次批量搬运的对象数
+        static constexpr size_t batchNum(size_t index) {
+            return detail::SIZE_CLASS_TABLE.classes[index].batch;
         }
     };
-}
\ No newline at end of file
+}
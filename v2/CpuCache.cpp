@@ -0,0 +1,386 @@
+#include "CpuCache.h"
+#include "CentralCache.h"
+#include "PageCache.h"
+#include "LargeCache.h"
+#include "HeapProfiler.h"
+#include "NumaTopology.h"
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(__x86_64__) && __has_include(<sys/rseq.h>)
+#include <sys/rseq.h>
+#define MEMORYPOOL_HAS_RSEQ 1
+#else
+#define MEMORYPOOL_HAS_RSEQ 0
+#endif
+
+namespace memoryPool {
+
+namespace {
+
+#if MEMORYPOOL_HAS_RSEQ
+
+// 当前线程由glibc注册的rseq区域
+inline struct rseq* rseqArea() {
+    return reinterpret_cast<struct rseq*>(static_cast<char*>(__builtin_thread_pointer()) + __rseq_offset);
+}
+
+// 当前线程所在的CPU编号
+inline size_t rseqCpu() {
+    return __atomic_load_n(&rseqArea()->cpu_id, __ATOMIC_RELAXED);
+}
+
+// 临界区描述符放在__rseq_cs段, 中止处理放在__rseq_failure段, 前面是内核要求的签名
+// 临界区从读取cpu_id开始, 到写回当前下标(提交)为止, 期间被抢占或迁移时内核跳到中止处理
+#define RSEQ_CRITICAL_SECTION_BEGIN                             \
+    ".pushsection __rseq_cs, \"aw\"\n\t"                        \
+    ".balign 32\n\t"                                            \
+    "3:\n\t"                                                    \
+    ".long 0x0, 0x0\n\t"                                        \
+    ".quad 1f, (2f - 1f), 4f\n\t"                               \
+    ".popsection\n\t"                                           \
+    "1:\n\t"                                                    \
+    "leaq 3b(%%rip), %%rax\n\t"                                 \
+    "movq %%rax, 8(%[rseq])\n\t"                                \
+    "movl 4(%[rseq]), %%eax\n\t"                                \
+    "shlq %[shift], %%rax\n\t"                                  \
+    "addq %[slabs], %%rax\n\t"                                  \
+    "movl (%%rax, %[index], 4), %%ecx\n\t"
+
+#define RSEQ_ABORT_HANDLER(onAbort)                             \
+    ".pushsection __rseq_failure, \"ax\"\n\t"                   \
+    ".byte 0x0f, 0xb9, 0x3d\n\t"                                \
+    ".long 0x53053053\n\t"                                      \
+    "4:\n\t"                                                    \
+    onAbort                                                     \
+    "jmp 6f\n\t"                                                \
+    ".popsection\n\t"
+
+#endif
+
+}
+
+bool CpuCache::isSupported() {
+#if MEMORYPOOL_HAS_RSEQ
+    // glibc关闭rseq注册(如glibc.pthread.rseq=0)时__rseq_size为0, cpu_id为负
+    // 只用到最初ABI的20字节(cpu_id和rseq_cs)
+    return __rseq_size >= 20 && static_cast<int32_t>(rseqArea()->cpu_id) >= 0;
+#else
+    return false;
+#endif
+}
+
+bool CpuCache::enable() {
+    if(!isSupported()) return false;
+
+    std::lock_guard<std::mutex> lock(initMutex_);
+    if(!slabs_) {
+        // 临界区直接用rseq给出的CPU编号定位slab, 不做越界检查, 必须为每个可能出现的编号都准备slab
+        // CPU编号可以不连续, 热插拔的CPU也可能稍后上线, 因此按possible列表中的最大编号而不是CPU个数划分
+        // 读不到该列表时无法确定编号上限, 不启用
+        size_t numCpus = NumaTopology::possibleCpus();
+        if(numCpus == 0) return false;
+
+        size_t slabBytes = size_t(1) << detail::CPU_SLAB_LAYOUT.shift;
+        void* memory = mmap(nullptr, numCpus * slabBytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(memory == MAP_FAILED) return false;
+        // mmap返回的内存已清零, 计数从0开始
+        void* counters = mmap(nullptr, numCpus * sizeof(CpuCounters), PROT_READ | PROT_WRITE,
+                              MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(counters == MAP_FAILED) {
+            munmap(memory, numCpus * slabBytes);
+            return false;
+        }
+
+        // 每个CPU每个大小类从空开始
+        char* slabs = static_cast<char*>(memory);
+        for(size_t cpu = 0; cpu < numCpus; ++cpu) {
+            uint32_t* current = reinterpret_cast<uint32_t*>(slabs + cpu * slabBytes);
+            for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+                current[index] = detail::CPU_SLAB_LAYOUT.begin[index];
+            }
+        }
+        slabs_ = slabs;
+        counters_ = static_cast<CpuCounters*>(counters);
+        numCpus_ = numCpus;
+    }
+    enabled_.store(true, std::memory_order_release);
+    return true;
+}
+
+void CpuCache::disable() {
+    std::lock_guard<std::mutex> lock(initMutex_);
+    enabled_.store(false, std::memory_order_relaxed);
+    if(slabs_) {
+        drain();
+    }
+}
+
+void CpuCache::drain() {
+#if MEMORYPOOL_HAS_RSEQ
+    // slab只能在所属CPU上用rseq修改, 依次把本线程绑定到每个CPU, 在该CPU上弹出全部对象
+    // 关闭前已进入本缓存的其他线程同样只在rseq临界区内修改slab, 与这里的弹出不会冲突
+    cpu_set_t oldMask;
+    if(sched_getaffinity(0, sizeof(oldMask), &oldMask) != 0) return;
+
+    for(size_t cpu = 0; cpu < numCpus_ && cpu < CPU_SETSIZE; ++cpu) {
+        if(!CPU_ISSET(cpu, &oldMask)) continue;
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        CPU_SET(cpu, &mask);
+        if(sched_setaffinity(0, sizeof(mask), &mask) != 0 || rseqCpu() != cpu) continue;
+
+        const volatile uint32_t* current = reinterpret_cast<const uint32_t*>(slabs_ + (cpu << detail::CPU_SLAB_LAYOUT.shift));
+        for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+            // 被抢占时pop返回空, 已绑定在这个CPU上, 重试即可
+            size_t batch = SizeClass::batchNum(index);
+            while(current[index] != detail::CPU_SLAB_LAYOUT.begin[index]) {
+                void* head = nullptr;
+                void* tail = nullptr;
+                size_t count = 0;
+                while(count < batch && current[index] != detail::CPU_SLAB_LAYOUT.begin[index]) {
+                    void* obj = pop(index);
+                    if(!obj) continue;
+                    *reinterpret_cast<void**>(obj) = head;
+                    head = obj;
+                    if(!tail) {
+                        tail = obj;
+                    }
+                    count++;
+                }
+                if(count) {
+                    CentralCache::getInstance().returnRange(head, tail, count, index);
+                }
+            }
+        }
+    }
+    sched_setaffinity(0, sizeof(oldMask), &oldMask);
+#endif
+}
+
+void* CpuCache::allocate(size_t size) {
+    if(size == 0) {
+        size = ALIGNMENT;
+    }
+
+    if(HeapProfiler::shouldSample(size)) {
+        return allocateSampled(size);
+    }
+
+    if(size > MAX_BYTES) {
+        return LargeCache::getInstance().allocate(size);
+    }
+
+    size_t index = SizeClass::getIndex(size);
+    localCounters().allocs[index].fetch_add(1, std::memory_order_relaxed);
+    if(void* ptr = pop(index)) {
+        return ptr;
+    }
+    return refill(index);
+}
+
+void* CpuCache::allocateSampled(size_t size) {
+    HeapProfiler& profiler = HeapProfiler::getInstance();
+    bool sample = profiler.pickNextSample(size);
+    void* ptr = allocate(size);
+    if(sample && ptr) {
+        profiler.recordAllocation(ptr, size);
+    }
+    return ptr;
+}
+
+void CpuCache::deallocateProfiled(void* ptr, size_t size) {
+    HeapProfiler::recordFree(ptr);
+    if(size > MAX_BYTES) {
+        deallocateLarge(ptr);
+        return;
+    }
+    deallocateToSlab(ptr, SizeClass::getIndex(size));
+}
+
+void CpuCache::deallocate(void* ptr, size_t size) {
+    // 有存活的采样对象时先交给堆分析器, 否则只多读取一个计数
+    if(HeapProfiler::hasSampledObjects()) {
+        deallocateProfiled(ptr, size);
+        return;
+    }
+    if(size > MAX_BYTES) {
+        deallocateLarge(ptr);
+        return;
+    }
+    deallocateToSlab(ptr, SizeClass::getIndex(size));
+}
+
+void CpuCache::deallocate(void* ptr) {
+    if(!ptr) return;
+    if(HeapProfiler::hasSampledObjects()) {
+        HeapProfiler::recordFree(ptr);
+    }
+
+    Span* span = PageCache::getInstance().getSpan(ptr);
+    if(!span) return;
+
+    if(span->sizeClass == NO_SIZE_CLASS) {
+        deallocateLarge(ptr);
+        return;
+    }
+    deallocateToSlab(ptr, span->sizeClass);
+}
+
+void CpuCache::deallocateToSlab(void* ptr, size_t index) {
+    localCounters().frees[index].fetch_add(1, std::memory_order_relaxed);
+    if(!push(ptr, index)) {
+        overflow(ptr, index);
+    }
+}
+
+void CpuCache::deallocateLarge(void* ptr) {
+    LargeCache::getInstance().deallocate(ptr);
+}
+
+CpuCache::CpuCounters& CpuCache::localCounters() {
+#if MEMORYPOOL_HAS_RSEQ
+    return counters_[rseqCpu()];
+#else
+    return counters_[0];
+#endif
+}
+
+void* CpuCache::pop(size_t index) {
+#if MEMORYPOOL_HAS_RSEQ
+    void* ptr;
+    asm volatile(
+        RSEQ_CRITICAL_SECTION_BEGIN
+        "cmpl %k[begin], %%ecx\n\t"
+        "je 5f\n\t"
+        "movq -8(%%rax, %%rcx, 8), %[ptr]\n\t"
+        "decl %%ecx\n\t"
+        "movl %%ecx, (%%rax, %[index], 4)\n\t"
+        "2:\n\t"
+        "jmp 6f\n\t"
+        "5:\n\t"
+        "xorl %k[ptr], %k[ptr]\n\t"
+        "jmp 6f\n\t"
+        RSEQ_ABORT_HANDLER("xorl %k[ptr], %k[ptr]\n\t")
+        "6:\n\t"
+        : [ptr] "=&r"(ptr)
+        : [rseq] "r"(rseqArea()), [slabs] "r"(slabs_), [index] "r"(index),
+          [begin] "r"(detail::CPU_SLAB_LAYOUT.begin[index]), [shift] "i"(detail::CPU_SLAB_LAYOUT.shift)
+        : "rax", "rcx", "memory", "cc");
+    return ptr;
+#else
+    (void)index;
+    return nullptr;
+#endif
+}
+
+bool CpuCache::push(void* ptr, size_t index) {
+#if MEMORYPOOL_HAS_RSEQ
+    int ok;
+    asm volatile(
+        RSEQ_CRITICAL_SECTION_BEGIN
+        "cmpl %k[end], %%ecx\n\t"
+        "je 5f\n\t"
+        "movq %[ptr], (%%rax, %%rcx, 8)\n\t"
+        "incl %%ecx\n\t"
+        "movl %%ecx, (%%rax, %[index], 4)\n\t"
+        "2:\n\t"
+        "movl $1, %[ok]\n\t"
+        "jmp 6f\n\t"
+        "5:\n\t"
+        "movl $0, %[ok]\n\t"
+        "jmp 6f\n\t"
+        RSEQ_ABORT_HANDLER("movl $0, %[ok]\n\t")
+        "6:\n\t"
+        : [ok] "=&r"(ok)
+        : [rseq] "r"(rseqArea()), [slabs] "r"(slabs_), [index] "r"(index), [ptr] "r"(ptr),
+          [end] "r"(detail::CPU_SLAB_LAYOUT.end[index]), [shift] "i"(detail::CPU_SLAB_LAYOUT.shift)
+        : "rax", "rcx", "memory", "cc");
+    return ok;
+#else
+    (void)ptr;
+    (void)index;
+    return false;
+#endif
+}
+
+void* CpuCache::refill(size_t index) {
+    size_t batchNum = SizeClass::batchNum(index);
+    void* end = nullptr;
+    void* start = CentralCache::getInstance().fetchRange(index, batchNum, end);
+    if(!start) return nullptr;
+
+    // 第一个对象返回给调用方, 其余压入当前CPU的slab
+    // 期间可能被迁移到其他CPU, 放不下的对象直接还给中心缓存
+    void* result = start;
+    void* rest = *reinterpret_cast<void**>(start);
+    void* returnHead = nullptr;
+    void* returnTail = nullptr;
+    size_t returnNum = 0;
+    for(size_t i = 1; i < batchNum; ++i) {
+        void* next = *reinterpret_cast<void**>(rest);
+        if(!push(rest, index)) {
+            *reinterpret_cast<void**>(rest) = returnHead;
+            returnHead = rest;
+            if(!returnTail) {
+                returnTail = rest;
+            }
+            returnNum++;
+        }
+        rest = next;
+    }
+    if(returnNum) {
+        CentralCache::getInstance().returnRange(returnHead, returnTail, returnNum, index);
+    }
+    return result;
+}
+
+void CpuCache::overflow(void* ptr, size_t index) {
+    // 弹出的对象插在链表头部, ptr始终是链表尾
+    void* head = ptr;
+    *reinterpret_cast<void**>(head) = nullptr;
+    size_t count = 1;
+
+    size_t batch = SizeClass::batchNum(index);
+    while(count < batch) {
+        void* obj = pop(index);
+        if(!obj) break;
+        *reinterpret_cast<void**>(obj) = head;
+        head = obj;
+        count++;
+    }
+    CentralCache::getInstance().returnRange(head, ptr, count, index);
+}
+
+size_t CpuCache::getCachedBytes() const {
+    if(!slabs_) return 0;
+
+    size_t slabBytes = size_t(1) << detail::CPU_SLAB_LAYOUT.shift;
+    size_t total = 0;
+    for(size_t cpu = 0; cpu < numCpus_; ++cpu) {
+        const volatile uint32_t* current = reinterpret_cast<const uint32_t*>(slabs_ + cpu * slabBytes);
+        for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+            total += (current[index] - detail::CPU_SLAB_LAYOUT.begin[index]) * SizeClass::classSize(index);
+        }
+    }
+    return total;
+}
+
+void CpuCache::getClassCounts(size_t* allocs, size_t* frees) const {
+    for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        allocs[index] = 0;
+        frees[index] = 0;
+    }
+    if(!counters_) return;
+
+    for(size_t cpu = 0; cpu < numCpus_; ++cpu) {
+        for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+            allocs[index] += counters_[cpu].allocs[index].load(std::memory_order_relaxed);
+            frees[index] += counters_[cpu].frees[index].load(std::memory_order_relaxed);
+        }
+    }
+}
+
+}
@@ -0,0 +1,108 @@
+#pragma once
+#include "Common.h"
+#include <mutex>
+
+namespace memoryPool {
+
+namespace detail {
+    // 每个CPU一块slab: 开头是各大小类的当前下标, 之后是各大小类的对象槽位
+    // 每个大小类缓存两批对象, 区间 [begin, end) 在所有CPU上相同
+    constexpr size_t CPU_HEADER_BYTES = 512;
+    static_assert(FREE_LIST_SIZE * sizeof(uint32_t) <= CPU_HEADER_BYTES, "cpu slab header overflow");
+
+    struct CpuSlabLayout {
+        uint32_t begin[MAX_SIZE_CLASSES];
+        uint32_t end[MAX_SIZE_CLASSES];
+        size_t shift;   // 每个CPU的slab大小为 1 << shift
+    };
+
+    constexpr CpuSlabLayout makeCpuSlabLayout() {
+        CpuSlabLayout layout{};
+        size_t slot = CPU_HEADER_BYTES / sizeof(void*);
+        for(size_t index = 0; index < SIZE_CLASS_TABLE.count; ++index) {
+            layout.begin[index] = static_cast<uint32_t>(slot);
+            slot += 2 * SIZE_CLASS_TABLE.classes[index].batch;
+            layout.end[index] = static_cast<uint32_t>(slot);
+        }
+        layout.shift = lgFloor(slot * sizeof(void*) - 1) + 1;
+        return layout;
+    }
+
+    inline constexpr CpuSlabLayout CPU_SLAB_LAYOUT = makeCpuSlabLayout();
+}
+
+// 按CPU划分的前端缓存, 用restartable sequences(rseq)保证同一CPU上的操作不被打断
+// 线程很多但大多空闲时, 缓存占用随CPU数而不是线程数增长
+// 只支持x86_64 Linux且glibc已为线程注册rseq, 不支持时由MemoryPool继续使用ThreadCache
+class CpuCache {
+public:
+    static CpuCache& getInstance() {
+        static CpuCache instance;
+        return instance;
+    }
+
+    // 当前进程能否使用rseq
+    static bool isSupported();
+
+    // 启用后MemoryPool改走本缓存, 不支持时返回false
+    bool enable();
+    // 关闭后MemoryPool改回ThreadCache, 并把各CPU slab中的对象还给中心缓存
+    // 只能清空本线程允许运行的CPU; 关闭时仍在本缓存中的其他线程之后释放的对象留在slab中, 再次启用时继续使用
+    void disable();
+    bool isEnabled() const { return enabled_.load(std::memory_order_acquire); }
+
+    void* allocate(size_t size);
+    void deallocate(void* ptr, size_t size);
+    void deallocate(void* ptr);
+
+    // 所有CPU缓存中的空闲字节数, 不加锁统计, 仅供观测
+    size_t getCachedBytes() const;
+    size_t getNumCpus() const { return numCpus_; }
+    // 经本缓存的各大小类累计分配和释放次数, 各写入FREE_LIST_SIZE个
+    void getClassCounts(size_t* allocs, size_t* frees) const;
+
+    // fork前取得锁, fork后在父子进程中释放; 关闭时持锁把对象还给中心缓存, 须在中心缓存的锁之前取得
+    void prepareFork() { initMutex_.lock(); }
+    void afterFork() { initMutex_.unlock(); }
+
+private:
+    CpuCache() = default;
+
+    // 每个CPU一组分配释放计数, 由运行在该CPU上的线程累加, 不同CPU的计数不共享缓存行
+    struct alignas(CACHE_LINE_SIZE) CpuCounters {
+        std::atomic<size_t> allocs[FREE_LIST_SIZE];
+        std::atomic<size_t> frees[FREE_LIST_SIZE];
+    };
+    // 当前CPU的计数, 读取CPU号后被迁移只会计入其他CPU, 总数不变
+    CpuCounters& localCounters();
+
+    // 在当前CPU的slab上弹出/压入一个对象, 为空/已满或被抢占迁移时失败
+    void* pop(size_t index);
+    bool push(void* ptr, size_t index);
+
+    // 当前CPU该类为空, 从中心缓存取一批
+    void* refill(size_t index);
+    // 当前CPU该类已满, 连同至多一批缓存对象还给中心缓存
+    void overflow(void* ptr, size_t index);
+    void deallocateToSlab(void* ptr, size_t index);
+    // 把各CPU slab中的对象全部还给中心缓存, 调用方需持有initMutex_
+    void drain();
+
+    void deallocateLarge(void* ptr);
+    // 堆分析器决定采样时的分配路径, 不内联, 分配快速路径不必为这次调用保存寄存器
+    __attribute__((noinline)) void* allocateSampled(size_t size);
+    // 有存活的采样对象时的带大小释放路径, 同样不内联
+    __attribute__((noinline)) void deallocateProfiled(void* ptr, size_t size);
+
+private:
+    char* slabs_ = nullptr;
+    CpuCounters* counters_ = nullptr;
+    size_t numCpus_ = 0;
+    std::atomic<bool> enabled_{false};
+    std::mutex initMutex_;
+};
+
+// 单例不登记析构函数, 静态析构之后释放内存时仍可使用
+static_assert(std::is_trivially_destructible<CpuCache>::value, "singleton is never destroyed");
+
+}
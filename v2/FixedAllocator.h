@@ -0,0 +1,102 @@
+#pragma once
+#include "Common.h"
+#include "SpinLock.h"
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <sys/mman.h>
+
+namespace memoryPool {
+
+// 定长元数据分配器: 从mmap申请的大块内存中切出对象, 释放的对象进入空闲链表复用
+// 内存从不归还系统, 过期指针指向的对象始终可读, 无锁读者据此检查对象状态时不会访问非法内存
+// 不经过malloc, 也不依赖内存池本身
+template <typename T>
+class FixedAllocator {
+public:
+    T* allocate() {
+        std::lock_guard<SpinLock> lock(lock_);
+        void* ptr = freeList_;
+        if(ptr) {
+            freeList_ = *reinterpret_cast<void**>(ptr);
+        }
+        else {
+            if(remaining_ < OBJECT_SIZE) {
+                void* chunk = mmap(nullptr, CHUNK_BYTES, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if(chunk == MAP_FAILED) return nullptr;
+                chunk_ = static_cast<char*>(chunk);
+                remaining_ = CHUNK_BYTES;
+            }
+            ptr = chunk_;
+            chunk_ += OBJECT_SIZE;
+            remaining_ -= OBJECT_SIZE;
+        }
+        inUse_++;
+        return new(ptr) T();
+    }
+
+    void deallocate(T* obj) {
+        std::lock_guard<SpinLock> lock(lock_);
+        *reinterpret_cast<void**>(obj) = freeList_;
+        freeList_ = obj;
+        inUse_--;
+    }
+
+    size_t inUse() const { return inUse_; }
+
+    // fork前后由页缓存调用, 子进程不会继承其他线程持有的锁
+    void lock() { lock_.lock(); }
+    void unlock() { lock_.unlock(); }
+
+private:
+    static constexpr size_t OBJECT_SIZE = (sizeof(T) + alignof(T) - 1) / alignof(T) * alignof(T);
+    static constexpr size_t CHUNK_BYTES = 64 * 1024;
+    static_assert(OBJECT_SIZE >= sizeof(void*), "object too small for free list link");
+    static_assert(std::is_trivially_destructible<T>::value, "objects are never destroyed");
+
+    SpinLock lock_;
+    void* freeList_ = nullptr;
+    char* chunk_ = nullptr;
+    size_t remaining_ = 0;
+    size_t inUse_ = 0;
+};
+
+// 标准容器使用的分配器: 节点从按节点类型区分的FixedAllocator中分配
+// 页堆内部的容器因此不经过malloc, 内存池替换malloc后也不会递归进入自身
+// 只支持逐个分配节点, 适用于std::map等基于节点的容器
+template <typename T>
+class MetadataAllocator {
+public:
+    using value_type = T;
+
+    MetadataAllocator() = default;
+    template <typename U>
+    MetadataAllocator(const MetadataAllocator<U>&) {}
+
+    T* allocate(size_t n) {
+        Slot* slot = n == 1 ? pool().allocate() : nullptr;
+        if(!slot) throw std::bad_alloc();
+        return reinterpret_cast<T*>(slot);
+    }
+
+    void deallocate(T* ptr, size_t) {
+        pool().deallocate(reinterpret_cast<Slot*>(ptr));
+    }
+
+    template <typename U>
+    bool operator==(const MetadataAllocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const MetadataAllocator<U>&) const { return false; }
+
+private:
+    struct alignas(T) Slot {
+        unsigned char bytes[sizeof(T)];
+    };
+
+    static FixedAllocator<Slot>& pool() {
+        static FixedAllocator<Slot> instance;
+        return instance;
+    }
+};
+
+}
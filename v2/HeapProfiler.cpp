@@ -0,0 +1,271 @@
+#include "HeapProfiler.h"
+#include "PageCache.h"
+#include <cmath>
+#include <mutex>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace memoryPool {
+
+namespace {
+
+size_t hashPointer(const void* ptr) {
+    uintptr_t value = reinterpret_cast<uintptr_t>(ptr);
+    return (value >> 3) * 0x9E3779B97F4A7C15ull;
+}
+
+}
+
+void HeapProfiler::setSamplingInterval(size_t bytes) {
+    bytes = std::min(bytes, static_cast<size_t>(PTRDIFF_MAX / 4));
+    if(bytes) {
+        // glibc第一次调用backtrace时会加载libgcc并分配内存, 先在这里完成, 不发生在采样途中
+        void* frame;
+        backtrace(&frame, 1);
+        profileInterval_.store(bytes, std::memory_order_relaxed);
+    }
+    samplingInterval_.store(bytes, std::memory_order_relaxed);
+
+    armed_ = bytes != 0;
+    bytesUntilSample_ = armed_ ? nextSampleDistance(bytes) : DISABLED_RECHECK_BYTES;
+}
+
+bool HeapProfiler::pickNextSample(size_t size) {
+    // 只有开启采样时抽取的距离减到负数才采样; 线程第一次分配和关闭期间的定期检查只抽取新距离
+    size_t interval = getSamplingInterval();
+    bool sample = armed_ && interval != 0 && !inProfiler_;
+    armed_ = interval != 0;
+    bytesUntilSample_ = (armed_ ? nextSampleDistance(interval) : DISABLED_RECHECK_BYTES) + static_cast<ptrdiff_t>(size);
+    return sample;
+}
+
+ptrdiff_t HeapProfiler::nextSampleDistance(size_t interval) {
+    // xorshift64*, 种子取自本线程的TLS地址
+    if(randomState_ == 0) {
+        randomState_ = hashPointer(&randomState_) | 1;
+    }
+    randomState_ ^= randomState_ >> 12;
+    randomState_ ^= randomState_ << 25;
+    randomState_ ^= randomState_ >> 27;
+    uint64_t random = randomState_ * 0x2545F4914F6CDD1Dull;
+
+    // 取(0, 1]上的均匀分布u, -ln(u) * interval服从均值为interval的指数分布, 按字节离散后即几何分布
+    double u = static_cast<double>((random >> 11) + 1) * (1.0 / 9007199254740992.0);
+    double distance = -std::log(u) * static_cast<double>(interval);
+    return static_cast<ptrdiff_t>(std::min(distance, static_cast<double>(PTRDIFF_MAX / 4))) + 1;
+}
+
+void HeapProfiler::recordAllocation(void* ptr, size_t size) {
+    ReentryGuard guard;
+    if(guard.reentered()) return;
+
+    // 去掉本函数自身的栈帧
+    void* frames[MAX_DEPTH + 1];
+    int depth = backtrace(frames, MAX_DEPTH + 1) - 1;
+    if(depth <= 0) return;
+    void** stack = frames + 1;
+    size_t hash = 0;
+    for(int i = 0; i < depth; ++i) {
+        hash = (hash ^ reinterpret_cast<uintptr_t>(stack[i])) * 0x100000001B3ull;
+    }
+
+    Span* span = PageCache::getInstance().getSpan(ptr);
+    if(!span) return;
+
+    std::lock_guard<SpinLock> lock(lock_);
+    // 同一地址仍有记录说明之前的释放绕过了分析器, 按已释放处理
+    if(SampledObject* stale = removeObject(ptr)) {
+        retireObject(stale, span);
+    }
+
+    StackBucket* bucket = findBucket(stack, depth, hash);
+    SampledObject* object = bucket ? objectAllocator_.allocate() : nullptr;
+    if(!object) return;
+
+    object->ptr = ptr;
+    object->size = size;
+    object->bucket = bucket;
+    insertObject(object);
+
+    bucket->allocs++;
+    bucket->allocBytes += size;
+    sampledAllocations_++;
+    sampledBytes_ += size;
+    liveBytes_ += size;
+    span->sampledObjects.fetch_add(1, std::memory_order_relaxed);
+    liveObjects_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void HeapProfiler::recordFree(void* ptr) {
+    // 所在span没有采样对象时不必查表, 绝大多数释放到此为止
+    Span* span = PageCache::getInstance().getSpan(ptr);
+    if(!span || span->sampledObjects.load(std::memory_order_relaxed) == 0) return;
+
+    ReentryGuard guard;
+    if(guard.reentered()) return;
+
+    HeapProfiler& profiler = getInstance();
+    std::lock_guard<SpinLock> lock(profiler.lock_);
+    SampledObject* object = profiler.removeObject(ptr);
+    if(!object) return;
+    profiler.retireObject(object, span);
+}
+
+HeapProfiler::SampledObject* HeapProfiler::detachObject(void* ptr) {
+    Span* span = PageCache::getInstance().getSpan(ptr);
+    if(!span || span->sampledObjects.load(std::memory_order_relaxed) == 0) return nullptr;
+
+    ReentryGuard guard;
+    if(guard.reentered()) return nullptr;
+
+    // 摘下后对象仍计入存活对象数, 调整期间其他释放继续走查表路径
+    HeapProfiler& profiler = getInstance();
+    std::lock_guard<SpinLock> lock(profiler.lock_);
+    SampledObject* object = profiler.removeObject(ptr);
+    if(object) {
+        span->sampledObjects.fetch_sub(1, std::memory_order_relaxed);
+    }
+    return object;
+}
+
+void HeapProfiler::attachObject(SampledObject* object, void* ptr, size_t size) {
+    if(!object) return;
+    Span* span = PageCache::getInstance().getSpan(ptr);
+
+    ReentryGuard guard;
+    HeapProfiler& profiler = getInstance();
+    std::lock_guard<SpinLock> lock(profiler.lock_);
+    // 同recordAllocation, 新地址上残留的记录按已释放处理
+    if(SampledObject* stale = profiler.removeObject(ptr)) {
+        profiler.retireObject(stale, span);
+    }
+
+    // 增长的部分计入分配, 缩小的部分计入释放, 调用栈的存活字节数即为调整后的大小
+    StackBucket* bucket = object->bucket;
+    if(size >= object->size) {
+        bucket->allocBytes += size - object->size;
+        profiler.sampledBytes_ += size - object->size;
+    }
+    else {
+        bucket->freeBytes += object->size - size;
+    }
+    profiler.liveBytes_ += size - object->size;
+    object->ptr = ptr;
+    object->size = size;
+    profiler.insertObject(object);
+    span->sampledObjects.fetch_add(1, std::memory_order_relaxed);
+}
+
+HeapProfiler::StackBucket* HeapProfiler::findBucket(void* const* stack, int depth, size_t hash) {
+    StackBucket*& head = buckets_[hash % NUM_BUCKET_HEADS];
+    for(StackBucket* bucket = head; bucket; bucket = bucket->next) {
+        if(bucket->hash == hash && bucket->depth == depth && std::equal(stack, stack + depth, bucket->stack)) {
+            return bucket;
+        }
+    }
+
+    StackBucket* bucket = bucketAllocator_.allocate();
+    if(!bucket) return nullptr;
+    std::copy(stack, stack + depth, bucket->stack);
+    bucket->depth = depth;
+    bucket->hash = hash;
+    bucket->next = head;
+    head = bucket;
+    numBuckets_++;
+    return bucket;
+}
+
+void HeapProfiler::insertObject(SampledObject* object) {
+    SampledObject*& head = objects_[hashPointer(object->ptr) % NUM_OBJECT_HEADS];
+    object->next = head;
+    head = object;
+}
+
+void HeapProfiler::retireObject(SampledObject* object, Span* span) {
+    object->bucket->frees++;
+    object->bucket->freeBytes += object->size;
+    liveBytes_ -= object->size;
+    span->sampledObjects.fetch_sub(1, std::memory_order_relaxed);
+    liveObjects_.fetch_sub(1, std::memory_order_relaxed);
+    objectAllocator_.deallocate(object);
+}
+
+HeapProfiler::SampledObject* HeapProfiler::removeObject(void* ptr) {
+    SampledObject** link = &objects_[hashPointer(ptr) % NUM_OBJECT_HEADS];
+    for(SampledObject* object = *link; object; link = &object->next, object = *link) {
+        if(object->ptr == ptr) {
+            *link = object->next;
+            return object;
+        }
+    }
+    return nullptr;
+}
+
+void HeapProfiler::writeProfile(FILE* out) {
+    // 写文件可能分配缓冲区, 本线程在此期间的分配和释放不进入分析器
+    ReentryGuard guard;
+    if(guard.reentered()) return;
+
+    {
+        std::lock_guard<SpinLock> lock(lock_);
+        size_t liveObjects = 0;
+        size_t allocs = 0;
+        size_t allocBytes = 0;
+        for(StackBucket* head : buckets_) {
+            for(StackBucket* bucket = head; bucket; bucket = bucket->next) {
+                liveObjects += bucket->allocs - bucket->frees;
+                allocs += bucket->allocs;
+                allocBytes += bucket->allocBytes;
+            }
+        }
+
+        // gperftools的堆profile格式: 存活对象数: 存活字节数 [累计对象数: 累计字节数] @ 调用栈
+        fprintf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+                liveObjects, liveBytes_, allocs, allocBytes, profileInterval_.load(std::memory_order_relaxed));
+        for(StackBucket* head : buckets_) {
+            for(StackBucket* bucket = head; bucket; bucket = bucket->next) {
+                fprintf(out, "%zu: %zu [%zu: %zu] @", bucket->allocs - bucket->frees,
+                        bucket->allocBytes - bucket->freeBytes, bucket->allocs, bucket->allocBytes);
+                for(int i = 0; i < bucket->depth; ++i) {
+                    fprintf(out, " 0x%zx", reinterpret_cast<uintptr_t>(bucket->stack[i]));
+                }
+                fputc('\n', out);
+            }
+        }
+    }
+
+    // pprof根据内存映射把地址对应到可执行文件和动态库
+    fputs("\nMAPPED_LIBRARIES:\n", out);
+    int fd = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+    if(fd >= 0) {
+        char buf[4096];
+        ssize_t n;
+        while((n = read(fd, buf, sizeof(buf))) > 0) {
+            fwrite(buf, 1, n, out);
+        }
+        close(fd);
+    }
+    fflush(out);
+}
+
+bool HeapProfiler::writeProfile(const char* path) {
+    FILE* out = fopen(path, "w");
+    if(!out) return false;
+    writeProfile(out);
+    return fclose(out) == 0;
+}
+
+HeapProfileStats HeapProfiler::getStats() {
+    std::lock_guard<SpinLock> lock(lock_);
+    HeapProfileStats stats;
+    stats.samplingInterval = getSamplingInterval();
+    stats.liveObjects = liveObjects_.load(std::memory_order_relaxed);
+    stats.liveBytes = liveBytes_;
+    stats.sampledAllocations = sampledAllocations_;
+    stats.sampledBytes = sampledBytes_;
+    stats.stacks = numBuckets_;
+    return stats;
+}
+
+}
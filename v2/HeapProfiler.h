@@ -0,0 +1,165 @@
+#pragma once
+#include "Common.h"
+#include "SpinLock.h"
+#include "FixedAllocator.h"
+#include <cstdio>
+
+namespace memoryPool {
+
+struct Span;
+
+// 采样堆分析的汇总
+struct HeapProfileStats {
+    size_t samplingInterval;    // 平均采样间隔(字节), 0表示已关闭
+    size_t liveObjects;         // 仍被跟踪的采样对象数
+    size_t liveBytes;           // 这些对象请求的字节数
+    size_t sampledAllocations;  // 累计采样次数
+    size_t sampledBytes;        // 累计采样的请求字节数
+    size_t stacks;              // 记录的不同调用栈数
+};
+
+// 采样堆分析器: 平均每分配samplingInterval字节采样一次, 间隔服从几何分布(与tcmalloc相同)
+// 被采样的分配记录调用栈并一直跟踪到释放, 输出gperftools格式的堆profile, 可直接交给pprof分析
+// 快速路径只在分配时把本线程的计数器减去请求大小, 减到负数才进入慢路径
+// 关闭时计数器每隔DISABLED_RECHECK_BYTES进入一次慢路径, 以便其他线程开启后各线程能及时开始采样
+// 元数据都直接向系统申请, 替换malloc后也可使用
+class HeapProfiler {
+public:
+    static HeapProfiler& getInstance() {
+        static HeapProfiler instance;
+        return instance;
+    }
+
+    // 设置平均采样间隔, 0关闭; 关闭后已采样且未释放的对象仍跟踪到释放为止
+    // 调用线程立即按新间隔采样, 其他线程最多再分配DISABLED_RECHECK_BYTES后生效
+    void setSamplingInterval(size_t bytes);
+    size_t getSamplingInterval() const { return samplingInterval_.load(std::memory_order_relaxed); }
+
+    // 分配快速路径: 返回true时调用方改走采样的慢路径
+    static bool shouldSample(size_t size) {
+        bytesUntilSample_ -= static_cast<ptrdiff_t>(size);
+        return __builtin_expect(bytesUntilSample_ < 0, 0);
+    }
+
+    // 批量分配: 整批都不会触发采样时扣除计数并返回true, 否则调用方应逐个分配
+    static bool reserveUnsampled(size_t bytes) {
+        if(bytesUntilSample_ < static_cast<ptrdiff_t>(bytes)) return false;
+        bytesUntilSample_ -= static_cast<ptrdiff_t>(bytes);
+        return true;
+    }
+
+    // 计数器减到负数后重新抽取下一次采样的距离, 返回这次分配是否采样
+    // 新距离已预先加上size, 调用方随后走一遍快速路径不会再次触发
+    bool pickNextSample(size_t size);
+
+    // 记录一次采样分配, 在分配成功之后调用
+    void recordAllocation(void* ptr, size_t size);
+
+    // 释放快速路径: 没有存活的采样对象时只需读取一个计数, 不必调用recordFree
+    static bool hasSampledObjects() {
+        return __builtin_expect(liveObjects_.load(std::memory_order_relaxed) != 0, 0);
+    }
+    // 释放ptr之前调用, ptr是被跟踪的采样对象时停止跟踪
+    static void recordFree(void* ptr);
+
+    // 写出堆profile: 每个调用栈的存活对象数和字节数, 以及累计分配的对象数和字节数
+    // pprof默认展示存活部分(-inuse_space), -alloc_space展示累计部分, 并按采样间隔还原实际大小
+    void writeProfile(FILE* out);
+    // 写入文件, 无法打开时返回false
+    bool writeProfile(const char* path);
+
+    HeapProfileStats getStats();
+
+    // fork前取得锁, fork后在父子进程中释放; 写出profile时持锁分配内存, 须在内存池的锁之前取得
+    void prepareFork() { lock_.lock(); }
+    void afterFork() { lock_.unlock(); }
+
+    // 调用栈的最大深度
+    static constexpr int MAX_DEPTH = 32;
+    // 关闭时检查是否已开启的间隔
+    static constexpr ptrdiff_t DISABLED_RECHECK_BYTES = 1024 * 1024;
+
+private:
+    HeapProfiler() = default;
+
+    // 同一调用栈的累计统计
+    struct StackBucket {
+        void* stack[MAX_DEPTH];
+        int depth;
+        size_t hash;
+        size_t allocs;
+        size_t allocBytes;
+        size_t frees;
+        size_t freeBytes;
+        StackBucket* next;
+    };
+
+    // 被跟踪的采样对象
+    struct SampledObject {
+        void* ptr;
+        size_t size;
+        StackBucket* bucket;
+        SampledObject* next;
+    };
+
+public:
+    // 大对象调整大小时保留采样记录: 调整前摘下ptr的记录, 不是采样对象时返回nullptr
+    // 调整成功后挂到新地址并按新大小计, 失败时按原大小(size成员)挂回原地址; 调用栈仍是最初分配时的调用栈
+    using SampleHandle = SampledObject*;
+    static SampleHandle detachObject(void* ptr);
+    static void attachObject(SampleHandle object, void* ptr, size_t size);
+
+private:
+    // 持锁时本线程再次进入分析器(如写文件时分配缓冲区)直接跳过, 避免自锁
+    class ReentryGuard {
+    public:
+        ReentryGuard() : entered_(inProfiler_) { inProfiler_ = true; }
+        ~ReentryGuard() { inProfiler_ = entered_; }
+        bool reentered() const { return entered_; }
+
+    private:
+        bool entered_;
+    };
+
+    // 查找或新建调用栈对应的桶, 调用方需持有锁
+    StackBucket* findBucket(void* const* stack, int depth, size_t hash);
+    // 从对象表中摘除ptr, 不存在时返回nullptr, 调用方需持有锁
+    SampledObject* removeObject(void* ptr);
+    // 把对象挂入对象表, 调用方需持有锁
+    void insertObject(SampledObject* object);
+    // 已摘下的对象按释放计入所属调用栈, 并停止跟踪, 调用方需持有锁
+    void retireObject(SampledObject* object, Span* span);
+    // 按几何分布抽取下一次采样前的字节数
+    static ptrdiff_t nextSampleDistance(size_t interval);
+
+    static constexpr size_t NUM_BUCKET_HEADS = 4096;
+    static constexpr size_t NUM_OBJECT_HEADS = 16384;
+
+private:
+    SpinLock lock_;
+    std::atomic<size_t> samplingInterval_{0};
+    // 最近一次开启时的间隔, 关闭后输出的profile仍按它还原
+    std::atomic<size_t> profileInterval_{0};
+    StackBucket* buckets_[NUM_BUCKET_HEADS] = {};
+    SampledObject* objects_[NUM_OBJECT_HEADS] = {};
+    FixedAllocator<StackBucket> bucketAllocator_;
+    FixedAllocator<SampledObject> objectAllocator_;
+    size_t numBuckets_ = 0;
+    size_t liveBytes_ = 0;
+    size_t sampledAllocations_ = 0;
+    size_t sampledBytes_ = 0;
+
+    // 存活的采样对象数, 释放快速路径据此跳过
+    static inline std::atomic<size_t> liveObjects_{0};
+    // 本线程距下次采样还剩的字节数, 初始为0使第一次分配进入慢路径
+    static inline thread_local ptrdiff_t bytesUntilSample_ = 0;
+    // 当前的距离是否在开启采样时抽取, 否则减到负数只是检查是否已开启
+    static inline thread_local bool armed_ = false;
+    static inline thread_local uint64_t randomState_ = 0;
+    static inline thread_local bool inProfiler_ = false;
+};
+
+// 单例不登记析构函数, 静态析构之后释放内存时仍可使用
+static_assert(std::is_trivially_destructible<HeapProfiler>::value, "singleton is never destroyed");
+
+}
@@ -0,0 +1,218 @@
+#include "LargeCache.h"
+#include "PageCache.h"
+#include "NumaTopology.h"
+#include "HeapProfiler.h"
+#include <cstring>
+#include <mutex>
+
+namespace memoryPool {
+
+void* LargeCache::allocate(size_t size) {
+    size_t numPages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    size_t node = NumaTopology::getInstance().currentNode();
+    {
+        std::lock_guard<SpinLock> lock(lock_);
+        if(void* ptr = takeEntry(numPages, node)) {
+            cacheHits_++;
+            return recordAllocation(ptr);
+        }
+        cacheMisses_++;
+    }
+    return recordAllocation(PageCache::getInstance().allocateSpan(numPages, NO_SIZE_CLASS, node));
+}
+
+void* LargeCache::allocateAligned(size_t size, size_t alignment) {
+    // span起始地址总是按页对齐
+    if(alignment <= PAGE_SIZE) return allocate(size);
+
+    size_t numPages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    size_t node = NumaTopology::getInstance().currentNode();
+    {
+        std::lock_guard<SpinLock> lock(lock_);
+        if(void* ptr = takeEntry(numPages, node, alignment)) {
+            cacheHits_++;
+            return recordAllocation(ptr);
+        }
+        cacheMisses_++;
+    }
+    return recordAllocation(PageCache::getInstance().allocateAlignedSpan(numPages, alignment / PAGE_SIZE, node));
+}
+
+void* LargeCache::allocateZeroed(size_t size) {
+    size_t numPages = (size + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    size_t node = NumaTopology::getInstance().currentNode();
+    void* ptr = nullptr;
+    {
+        std::lock_guard<SpinLock> lock(lock_);
+        ptr = takeEntry(numPages, node);
+        ptr ? cacheHits_++ : cacheMisses_++;
+    }
+
+    // 缓存中的span用过, 必须清零; 页缓存的span由其记录的状态决定
+    bool zeroed = false;
+    if(!ptr) {
+        ptr = PageCache::getInstance().allocateSpan(numPages, NO_SIZE_CLASS, node, &zeroed);
+        if(!ptr) return nullptr;
+    }
+    if(!zeroed) {
+        memset(ptr, 0, size);
+    }
+    return recordAllocation(ptr);
+}
+
+void LargeCache::deallocate(void* ptr) {
+    PageCache& pageCache = PageCache::getInstance();
+    Span* span = pageCache.getSpan(ptr);
+    if(!span) return;
+
+    size_t bytes = span->numPages * PAGE_SIZE;
+    deallocations_.fetch_add(1, std::memory_order_relaxed);
+    inUseBytes_.fetch_sub(bytes, std::memory_order_relaxed);
+
+    size_t maxBytes = getMaxCachedBytes();
+    if(bytes > maxBytes >> 2) {
+        pageCache.deallocateSpan(ptr);
+        return;
+    }
+
+    // 放入缓存, 腾出的位置上的旧span在锁外交还页缓存
+    void* evicted[MAX_ENTRIES];
+    size_t numEvicted = 0;
+    {
+        std::lock_guard<SpinLock> lock(lock_);
+        numEvicted = evict(bytes, 1, evicted);
+        entries_[numEntries_++] = Entry{ptr, span->numPages, span->node};
+        cachedBytes_ += bytes;
+    }
+    for(size_t i = 0; i < numEvicted; ++i) {
+        pageCache.deallocateSpan(evicted[i]);
+    }
+}
+
+void* LargeCache::reallocate(void* ptr, size_t newSize) {
+    PageCache& pageCache = PageCache::getInstance();
+    Span* span = pageCache.getSpan(ptr);
+    if(!span) return nullptr;
+    size_t oldBytes = span->numPages * PAGE_SIZE;
+    // 被采样的对象调整后继续跟踪, 记录随对象搬到新地址; 失败时原对象不变, 记录挂回原处
+    HeapProfiler::SampleHandle sampled = nullptr;
+    if(HeapProfiler::hasSampledObjects()) {
+        sampled = HeapProfiler::detachObject(ptr);
+    }
+
+    // 页缓存先尝试原地调整, 大span再尝试mremap
+    size_t newPages = (newSize + PAGE_SIZE - 1) >> PAGE_SHIFT;
+    bool moved = false;
+    if(void* result = pageCache.resizeSpan(ptr, newPages, moved)) {
+        (moved ? remapped_ : resizedInPlace_).fetch_add(1, std::memory_order_relaxed);
+        // 无符号数回绕后相加, 缩小时同样正确
+        size_t newBytes = pageCache.getSpan(result)->numPages * PAGE_SIZE;
+        inUseBytes_.fetch_add(newBytes - oldBytes, std::memory_order_relaxed);
+        HeapProfiler::attachObject(sampled, result, newSize);
+        return result;
+    }
+
+    void* newPtr = allocate(newSize);
+    if(!newPtr) {
+        if(sampled) {
+            HeapProfiler::attachObject(sampled, ptr, sampled->size);
+        }
+        return nullptr;
+    }
+    memcpy(newPtr, ptr, std::min(oldBytes, newSize));
+    HeapProfiler::attachObject(sampled, newPtr, newSize);
+    deallocate(ptr);
+    copied_.fetch_add(1, std::memory_order_relaxed);
+    return newPtr;
+}
+
+void LargeCache::setMaxCachedBytes(size_t bytes) {
+    maxCachedBytes_.store(bytes, std::memory_order_relaxed);
+    // 超出新上限的部分立即交还
+    void* evicted[MAX_ENTRIES];
+    size_t numEvicted = 0;
+    {
+        std::lock_guard<SpinLock> lock(lock_);
+        numEvicted = evict(0, 0, evicted);
+    }
+    PageCache& pageCache = PageCache::getInstance();
+    for(size_t i = 0; i < numEvicted; ++i) {
+        pageCache.deallocateSpan(evicted[i]);
+    }
+}
+
+void LargeCache::flush() {
+    Entry entries[MAX_ENTRIES];
+    size_t numEntries = 0;
+    {
+        std::lock_guard<SpinLock> lock(lock_);
+        std::copy(entries_, entries_ + numEntries_, entries);
+        numEntries = numEntries_;
+        numEntries_ = 0;
+        cachedBytes_ = 0;
+    }
+    for(size_t i = 0; i < numEntries; ++i) {
+        PageCache::getInstance().deallocateSpan(entries[i].ptr);
+    }
+}
+
+LargeCacheStats LargeCache::getStats() {
+    std::lock_guard<SpinLock> lock(lock_);
+    LargeCacheStats stats;
+    stats.allocations = allocations_.load(std::memory_order_relaxed);
+    stats.deallocations = deallocations_.load(std::memory_order_relaxed);
+    stats.inUseBytes = inUseBytes_.load(std::memory_order_relaxed);
+    stats.cacheHits = cacheHits_;
+    stats.cacheMisses = cacheMisses_;
+    stats.cachedSpans = numEntries_;
+    stats.cachedBytes = cachedBytes_;
+    stats.resizedInPlace = resizedInPlace_.load(std::memory_order_relaxed);
+    stats.remapped = remapped_.load(std::memory_order_relaxed);
+    stats.copied = copied_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+void* LargeCache::recordAllocation(void* ptr) {
+    if(ptr) {
+        allocations_.fetch_add(1, std::memory_order_relaxed);
+        inUseBytes_.fetch_add(PageCache::getInstance().getSpan(ptr)->numPages * PAGE_SIZE, std::memory_order_relaxed);
+    }
+    return ptr;
+}
+
+void* LargeCache::takeEntry(size_t numPages, size_t node, size_t alignment) {
+    // 多个NUMA节点时只复用本节点的span
+    bool anyNode = NumaTopology::getInstance().numNodes() == 1;
+    size_t best = numEntries_;
+    for(size_t i = 0; i < numEntries_; ++i) {
+        const Entry& entry = entries_[i];
+        if(entry.numPages < numPages || entry.numPages - numPages > numPages >> MAX_SLACK_SHIFT) continue;
+        if(!anyNode && entry.node != node) continue;
+        if(reinterpret_cast<uintptr_t>(entry.ptr) & (alignment - 1)) continue;
+        if(best == numEntries_ || entry.numPages < entries_[best].numPages) {
+            best = i;
+        }
+    }
+    if(best == numEntries_) return nullptr;
+
+    void* ptr = entries_[best].ptr;
+    cachedBytes_ -= entries_[best].numPages * PAGE_SIZE;
+    std::copy(entries_ + best + 1, entries_ + numEntries_, entries_ + best);
+    numEntries_--;
+    return ptr;
+}
+
+size_t LargeCache::evict(size_t bytes, size_t slots, void** evicted) {
+    size_t maxBytes = getMaxCachedBytes();
+    size_t count = 0;
+    while(count < numEntries_ && (numEntries_ - count + slots > MAX_ENTRIES || cachedBytes_ + bytes > maxBytes)) {
+        evicted[count] = entries_[count].ptr;
+        cachedBytes_ -= entries_[count].numPages * PAGE_SIZE;
+        count++;
+    }
+    std::copy(entries_ + count, entries_ + numEntries_, entries_);
+    numEntries_ -= count;
+    return count;
+}
+
+}
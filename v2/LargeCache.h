@@ -0,0 +1,99 @@
+#pragma once
+#include "Common.h"
+#include "SpinLock.h"
+
+namespace memoryPool {
+
+// 大对象缓存统计
+struct LargeCacheStats {
+    size_t allocations;     // 累计分配次数
+    size_t deallocations;   // 累计释放次数
+    size_t inUseBytes;      // 用户持有的大对象字节数, 按页取整
+    size_t cacheHits;       // 分配命中缓存的次数
+    size_t cacheMisses;     // 分配未命中、向页缓存申请的次数
+    size_t cachedSpans;     // 当前缓存的span数
+    size_t cachedBytes;     // 当前缓存的字节数
+    size_t resizedInPlace;  // 原地缩小或向后扩展的次数
+    size_t remapped;        // 通过mremap搬移页而不复制数据的次数
+    size_t copied;          // 只能重新分配并复制的次数
+};
+
+// 超过MAX_BYTES的大对象: 按页取整后从页缓存分配整个span
+// 最近释放的大span先放入一个小缓存, 同样大小的缓冲区反复申请释放时直接复用, 不经过页堆的合并与回收
+// 缓存按释放顺序淘汰, 淘汰的span交还页缓存
+class LargeCache {
+public:
+    static LargeCache& getInstance() {
+        static LargeCache instance;
+        return instance;
+    }
+
+    void* allocate(size_t size);
+    // 分配内容全为0的大对象, 页缓存中已知全为0的span不再清零
+    void* allocateZeroed(size_t size);
+    // 分配起始地址对齐到alignment(2的幂)的大对象
+    void* allocateAligned(size_t size, size_t alignment);
+    // ptr必须是allocate返回的地址
+    void deallocate(void* ptr);
+
+    // 调整大对象的大小, 能原地缩小或扩展时返回原指针, 否则优先用mremap搬移页, 最后才复制
+    // 失败时返回nullptr, 原对象不变
+    void* reallocate(void* ptr, size_t newSize);
+
+    // 缓存的总字节数上限, 单个span超过上限的1/4时不缓存, 0表示不缓存
+    void setMaxCachedBytes(size_t bytes);
+    size_t getMaxCachedBytes() const { return maxCachedBytes_.load(std::memory_order_relaxed); }
+
+    // 把缓存的span全部交还页缓存
+    void flush();
+
+    LargeCacheStats getStats();
+
+    // fork前取得锁, fork后在父子进程中释放
+    void prepareFork() { lock_.lock(); }
+    void afterFork() { lock_.unlock(); }
+
+    // 缓存的最大span数
+    static constexpr size_t MAX_ENTRIES = 16;
+    // 复用缓存的span时允许多出的页数比例, 1/4
+    static constexpr size_t MAX_SLACK_SHIFT = 2;
+
+private:
+    LargeCache() = default;
+
+    struct Entry {
+        void* ptr;
+        size_t numPages;
+        size_t node;
+    };
+
+    // 从缓存中取出页数足够且多余不超过1/4、地址满足对齐的最小span, 调用方需持有锁
+    void* takeEntry(size_t numPages, size_t node, size_t alignment = PAGE_SIZE);
+    // 记录一次成功的分配, 按ptr所在span的大小计入持有字节数
+    void* recordAllocation(void* ptr);
+
+    // 从最旧的开始淘汰, 直到能再放入slots个共bytes字节的span, 被淘汰的span写入evicted, 调用方需持有锁
+    size_t evict(size_t bytes, size_t slots, void** evicted);
+
+private:
+    SpinLock lock_;
+    // 按释放顺序排列, entries_[0]最旧
+    Entry entries_[MAX_ENTRIES];
+    size_t numEntries_ = 0;
+    size_t cachedBytes_ = 0;
+    std::atomic<size_t> maxCachedBytes_{64 * 1024 * 1024};
+
+    std::atomic<size_t> allocations_{0};
+    std::atomic<size_t> deallocations_{0};
+    std::atomic<size_t> inUseBytes_{0};
+    size_t cacheHits_ = 0;
+    size_t cacheMisses_ = 0;
+    std::atomic<size_t> resizedInPlace_{0};
+    std::atomic<size_t> remapped_{0};
+    std::atomic<size_t> copied_{0};
+};
+
+// 单例不登记析构函数, 静态析构之后释放内存时仍可使用
+static_assert(std::is_trivially_destructible<LargeCache>::value, "singleton is never destroyed");
+
+}
@@ -0,0 +1,229 @@
+#include "MemoryPool.h"
+#include "PageCache.h"
+#include <cerrno>
+#include <cstdlib>
+#include <malloc.h>
+#include <new>
+
+// 编译为libmemorypool.so, 通过LD_PRELOAD替换进程的malloc系列函数和全局new/delete
+// 库以-fvisibility=hidden编译, 只导出下面这些函数, 内存池内部的符号不会与程序自身链接的内存池混用
+// 内存池只在第一次分配时按需初始化, 元数据都直接向系统申请, 不依赖全局构造函数, 进程启动早期即可使用
+
+#define MEMORY_POOL_EXPORT __attribute__((visibility("default")))
+
+using namespace memoryPool;
+
+namespace {
+
+// ptr起始的可用字节数, 不是内存池分配的指针返回0
+size_t usableSize(void* ptr) {
+    Span* span = PageCache::getInstance().getSpan(ptr);
+    if(!span) return 0;
+    if(span->sizeClass == NO_SIZE_CLASS) {
+        return span->numPages * PAGE_SIZE - (static_cast<char*>(ptr) - static_cast<char*>(span->pageAddr));
+    }
+    return SizeClass::classSize(span->sizeClass);
+}
+
+// 分配失败时按C++语义反复调用new_handler, 没有设置时抛出bad_alloc
+template <typename Alloc>
+void* newImpl(Alloc alloc) {
+    for(;;) {
+        if(void* ptr = alloc()) return ptr;
+        std::new_handler handler = std::get_new_handler();
+        if(!handler) throw std::bad_alloc();
+        handler();
+    }
+}
+
+template <typename Alloc>
+void* newNothrowImpl(Alloc alloc) noexcept {
+    try {
+        return newImpl(alloc);
+    }
+    catch(...) {
+        return nullptr;
+    }
+}
+
+void* alignedAllocImpl(size_t alignment, size_t size) {
+    void* ptr = MemoryPool::allocateAligned(size, alignment);
+    if(!ptr) {
+        errno = alignment && !(alignment & (alignment - 1)) ? ENOMEM : EINVAL;
+    }
+    return ptr;
+}
+
+}
+
+extern "C" {
+
+MEMORY_POOL_EXPORT void* malloc(size_t size) noexcept {
+    void* ptr = MemoryPool::allocate(size);
+    if(!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+MEMORY_POOL_EXPORT void free(void* ptr) noexcept {
+    // 不属于内存池的指针(如动态链接器在替换生效前分配的内存)由页映射识别后忽略
+    MemoryPool::deallocate(ptr);
+}
+
+MEMORY_POOL_EXPORT void* calloc(size_t num, size_t size) noexcept {
+    void* ptr = MemoryPool::callocate(num, size);
+    if(!ptr) errno = ENOMEM;
+    return ptr;
+}
+
+MEMORY_POOL_EXPORT void* realloc(void* ptr, size_t size) noexcept {
+    if(!ptr) return malloc(size);
+    if(size == 0) {
+        free(ptr);
+        return nullptr;
+    }
+
+    Span* span = PageCache::getInstance().getSpan(ptr);
+    if(!span) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+
+    void* result = nullptr;
+    if(span->sizeClass != NO_SIZE_CLASS) {
+        // 小对象的旧大小取大小类大小, 同一大小类内的调整直接返回原指针
+        result = MemoryPool::reallocate(ptr, SizeClass::classSize(span->sizeClass), size);
+    }
+    else if(size > MAX_BYTES) {
+        // 整页span(包括memalign等为大对齐分配的、不超过MAX_BYTES的span)由大对象缓存原地调整或搬移
+        result = LargeCache::getInstance().reallocate(ptr, size);
+    }
+    else {
+        // 整页span缩到小对象: 复制后不带大小释放, 不能按可用大小当作小对象释放
+        size_t oldSize = usableSize(ptr);
+        result = MemoryPool::allocate(size);
+        if(result) {
+            memcpy(result, ptr, std::min(oldSize, size));
+            MemoryPool::deallocate(ptr);
+        }
+    }
+    if(!result) errno = ENOMEM;
+    return result;
+}
+
+MEMORY_POOL_EXPORT int posix_memalign(void** result, size_t alignment, size_t size) noexcept {
+    if(alignment == 0 || alignment % sizeof(void*) != 0 || (alignment & (alignment - 1))) return EINVAL;
+    void* ptr = MemoryPool::allocateAligned(size, alignment);
+    if(!ptr) return ENOMEM;
+    *result = ptr;
+    return 0;
+}
+
+MEMORY_POOL_EXPORT void* aligned_alloc(size_t alignment, size_t size) noexcept {
+    return alignedAllocImpl(alignment, size);
+}
+
+MEMORY_POOL_EXPORT void* memalign(size_t alignment, size_t size) noexcept {
+    return alignedAllocImpl(alignment, size);
+}
+
+MEMORY_POOL_EXPORT void* valloc(size_t size) noexcept {
+    return alignedAllocImpl(PAGE_SIZE, size);
+}
+
+MEMORY_POOL_EXPORT void* pvalloc(size_t size) noexcept {
+    return alignedAllocImpl(PAGE_SIZE, (size + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1));
+}
+
+MEMORY_POOL_EXPORT size_t malloc_usable_size(void* ptr) noexcept {
+    return ptr ? usableSize(ptr) : 0;
+}
+
+// 与glibc相同, 统计输出到标准错误
+MEMORY_POOL_EXPORT void malloc_stats() noexcept {
+    MemoryPool::printStats(stderr);
+}
+
+}
+
+// 全局new/delete: 带大小的delete直接按大小类释放, 不查页映射
+
+MEMORY_POOL_EXPORT void* operator new(size_t size) {
+    return newImpl([size] { return MemoryPool::allocate(size); });
+}
+
+MEMORY_POOL_EXPORT void* operator new[](size_t size) {
+    return newImpl([size] { return MemoryPool::allocate(size); });
+}
+
+MEMORY_POOL_EXPORT void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return newNothrowImpl([size] { return MemoryPool::allocate(size); });
+}
+
+MEMORY_POOL_EXPORT void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return newNothrowImpl([size] { return MemoryPool::allocate(size); });
+}
+
+MEMORY_POOL_EXPORT void* operator new(size_t size, std::align_val_t alignment) {
+    return newImpl([=] { return MemoryPool::allocateAligned(size, static_cast<size_t>(alignment)); });
+}
+
+MEMORY_POOL_EXPORT void* operator new[](size_t size, std::align_val_t alignment) {
+    return newImpl([=] { return MemoryPool::allocateAligned(size, static_cast<size_t>(alignment)); });
+}
+
+MEMORY_POOL_EXPORT void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return newNothrowImpl([=] { return MemoryPool::allocateAligned(size, static_cast<size_t>(alignment)); });
+}
+
+MEMORY_POOL_EXPORT void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+    return newNothrowImpl([=] { return MemoryPool::allocateAligned(size, static_cast<size_t>(alignment)); });
+}
+
+MEMORY_POOL_EXPORT void operator delete(void* ptr) noexcept {
+    MemoryPool::deallocate(ptr);
+}
+
+MEMORY_POOL_EXPORT void operator delete[](void* ptr) noexcept {
+    MemoryPool::deallocate(ptr);
+}
+
+MEMORY_POOL_EXPORT void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+    MemoryPool::deallocate(ptr);
+}
+
+MEMORY_POOL_EXPORT void operator delete[](void* ptr, const std::nothrow_t&) noexcept {
+    MemoryPool::deallocate(ptr);
+}
+
+MEMORY_POOL_EXPORT void operator delete(void* ptr, size_t size) noexcept {
+    if(ptr) MemoryPool::deallocate(ptr, size);
+}
+
+MEMORY_POOL_EXPORT void operator delete[](void* ptr, size_t size) noexcept {
+    if(ptr) MemoryPool::deallocate(ptr, size);
+}
+
+// 对齐分配的对象都是整个大小类对象或整个span, 不带大小时同样可由页映射找回
+MEMORY_POOL_EXPORT void operator delete(void* ptr, std::align_val_t) noexcept {
+    MemoryPool::deallocate(ptr);
+}
+
+MEMORY_POOL_EXPORT void operator delete[](void* ptr, std::align_val_t) noexcept {
+    MemoryPool::deallocate(ptr);
+}
+
+MEMORY_POOL_EXPORT void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    MemoryPool::deallocate(ptr);
+}
+
+MEMORY_POOL_EXPORT void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept {
+    MemoryPool::deallocate(ptr);
+}
+
+MEMORY_POOL_EXPORT void operator delete(void* ptr, size_t size, std::align_val_t alignment) noexcept {
+    if(ptr) MemoryPool::deallocateAligned(ptr, size, static_cast<size_t>(alignment));
+}
+
+MEMORY_POOL_EXPORT void operator delete[](void* ptr, size_t size, std::align_val_t alignment) noexcept {
+    if(ptr) MemoryPool::deallocateAligned(ptr, size, static_cast<size_t>(alignment));
+}
@@ -0,0 +1,150 @@
+#include "MemoryPool.h"
+#include <pthread.h>
+
+namespace memoryPool
+{
+
+namespace
+{
+
+double toMB(size_t bytes)
+{
+    return bytes / (1024.0 * 1024.0);
+}
+
+// fork只复制调用线程, 其他线程持有的锁在子进程中永远不会释放, 子进程随后的分配会死锁
+// fork前按固定顺序取得全部锁, 嵌套加锁时外层的锁排在前面:
+// 关闭CpuCache和写出堆profile时持锁访问中心缓存, 中心缓存持bin锁归还span, arena锁内读取回收配置
+void prepareFork()
+{
+    CpuCache::getInstance().prepareFork();
+    ThreadCache::prepareFork();
+    HeapProfiler::getInstance().prepareFork();
+    LargeCache::getInstance().prepareFork();
+    CentralCache::getInstance().prepareFork();
+    PageCache::getInstance().prepareFork();
+}
+
+void afterFork(bool child)
+{
+    PageCache::getInstance().afterFork(child);
+    CentralCache::getInstance().afterFork();
+    LargeCache::getInstance().afterFork();
+    HeapProfiler::getInstance().afterFork();
+    ThreadCache::afterFork(child);
+    CpuCache::getInstance().afterFork();
+}
+
+// 库加载时登记, 静态链接和LD_PRELOAD替换malloc时都生效
+__attribute__((constructor)) void registerForkHandlers()
+{
+    pthread_atfork(prepareFork, [] { afterFork(false); }, [] { afterFork(true); });
+}
+
+}
+
+MemoryPoolStats MemoryPool::getStats()
+{
+    MemoryPoolStats stats{};
+
+    // 两种前端的次数相加, 切换前端前后分配的对象可能由另一个前端释放
+    size_t allocs[FREE_LIST_SIZE];
+    size_t frees[FREE_LIST_SIZE];
+    size_t cpuAllocs[FREE_LIST_SIZE];
+    size_t cpuFrees[FREE_LIST_SIZE];
+    ThreadCache::getClassCounts(allocs, frees);
+    CpuCache::getInstance().getClassCounts(cpuAllocs, cpuFrees);
+
+    CentralCache& centralCache = CentralCache::getInstance();
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index)
+    {
+        SizeClassStats& cls = stats.classes[index];
+        CentralClassStats central = centralCache.getClassStats(index);
+        cls.size = SizeClass::classSize(index);
+        cls.allocations = allocs[index] + cpuAllocs[index];
+        cls.deallocations = frees[index] + cpuFrees[index];
+        // 快照期间的并发操作可能只看到释放而没看到对应的分配
+        if (cls.allocations > cls.deallocations)
+        {
+            cls.inUseBytes = (cls.allocations - cls.deallocations) * cls.size;
+        }
+        cls.centralFreeBytes = central.freeObjects * cls.size;
+        cls.spans = central.spans;
+        cls.spanBytes = central.spans * SizeClass::classPages(index) * PAGE_SIZE;
+        cls.refills = central.fetchCount;
+        cls.releases = central.returnCount;
+
+        stats.smallInUseBytes += cls.inUseBytes;
+        stats.centralCacheBytes += cls.centralFreeBytes;
+    }
+
+    stats.central = centralCache.getStats();
+    stats.large = LargeCache::getInstance().getStats();
+    stats.pageHeap = PageCache::getInstance().getStats();
+
+    stats.largeInUseBytes = stats.large.inUseBytes;
+    stats.inUseBytes = stats.smallInUseBytes + stats.largeInUseBytes;
+    stats.threadCacheBytes = ThreadCache::getTotalCachedBytes();
+    stats.cpuCacheBytes = CpuCache::getInstance().getCachedBytes();
+    stats.largeCacheBytes = stats.large.cachedBytes;
+    stats.pageHeapFreeBytes = stats.pageHeap.retainedBytes;
+    stats.pageHeapReleasedBytes = stats.pageHeap.releasedBytes;
+    stats.mappedBytes = stats.pageHeap.mappedBytes;
+    stats.residentBytes = stats.mappedBytes - stats.pageHeapReleasedBytes;
+    if (stats.residentBytes > stats.inUseBytes)
+    {
+        stats.fragmentation = 1.0 - static_cast<double>(stats.inUseBytes) / stats.residentBytes;
+    }
+    stats.threadCaches = ThreadCache::getNumCaches();
+    return stats;
+}
+
+void MemoryPool::printStats(FILE* out)
+{
+    printStats(getStats(), out);
+}
+
+void MemoryPool::printStats(const MemoryPoolStats& stats, FILE* out)
+{
+    fprintf(out, "------------------------------------------------\n");
+    fprintf(out, "MemoryPool: %10.1f MB in use (small %.1f MB, large %.1f MB)\n",
+            toMB(stats.inUseBytes), toMB(stats.smallInUseBytes), toMB(stats.largeInUseBytes));
+    fprintf(out, "MemoryPool: %10.1f MB in %zu thread caches\n", toMB(stats.threadCacheBytes), stats.threadCaches);
+    fprintf(out, "MemoryPool: %10.1f MB in cpu caches\n", toMB(stats.cpuCacheBytes));
+    fprintf(out, "MemoryPool: %10.1f MB in central cache\n", toMB(stats.centralCacheBytes));
+    fprintf(out, "MemoryPool: %10.1f MB in large cache (%zu spans)\n",
+            toMB(stats.largeCacheBytes), stats.large.cachedSpans);
+    fprintf(out, "MemoryPool: %10.1f MB free in page heap\n", toMB(stats.pageHeapFreeBytes));
+    fprintf(out, "MemoryPool: %10.1f MB released to the system\n", toMB(stats.pageHeapReleasedBytes));
+    fprintf(out, "MemoryPool: %10.1f MB mapped, %.1f MB resident, fragmentation %.1f%%\n",
+            toMB(stats.mappedBytes), toMB(stats.residentBytes), stats.fragmentation * 100);
+    fprintf(out, "MemoryPool: %10.1f MB backed by intact huge pages, %zu huge pages broken\n",
+            toMB(stats.pageHeap.hugePageBytes), stats.pageHeap.brokenHugePages);
+    fprintf(out, "------------------------------------------------\n");
+    fprintf(out, "Central cache: %zu fetches (%zu from transfer cache), %zu returns (%zu to transfer cache)\n",
+            stats.central.fetchCount, stats.central.transferFetchCount,
+            stats.central.returnCount, stats.central.transferReturnCount);
+    fprintf(out, "Central cache: %zu lock acquisitions, %zu contended\n",
+            stats.central.lockAcquisitions, stats.central.lockContended);
+    fprintf(out, "Large objects: %zu allocations, %zu deallocations, %zu cache hits, %zu misses\n",
+            stats.large.allocations, stats.large.deallocations, stats.large.cacheHits, stats.large.cacheMisses);
+    fprintf(out, "Large objects: %zu resized in place, %zu remapped, %zu copied\n",
+            stats.large.resizedInPlace, stats.large.remapped, stats.large.copied);
+    fprintf(out, "Page heap:     %zu scavenge rounds, %.1f MB released in total, %zu spans stolen\n",
+            stats.pageHeap.scavengeRounds, toMB(stats.pageHeap.totalReleasedBytes), stats.pageHeap.stolenSpans);
+    fprintf(out, "------------------------------------------------\n");
+    fprintf(out, "class     size      allocs       frees   in use KB  central KB   spans  refills  releases\n");
+    for (size_t index = 0; index < FREE_LIST_SIZE; ++index)
+    {
+        const SizeClassStats& cls = stats.classes[index];
+        if (cls.allocations == 0 && cls.spans == 0)
+        {
+            continue;
+        }
+        fprintf(out, "%5zu %8zu %11zu %11zu %11.1f %11.1f %7zu %8zu %9zu\n",
+                index, cls.size, cls.allocations, cls.deallocations,
+                cls.inUseBytes / 1024.0, cls.centralFreeBytes / 1024.0, cls.spans, cls.refills, cls.releases);
+    }
+}
+
+}
@@ -1,21 +1,431 @@
 #pragma once
 #include "ThreadCache.h"
+#include "CpuCache.h"
+#include "CentralCache.h"
+#include "LargeCache.h"
+#include "PageCache.h"
+#include "HeapProfiler.h"
+#include <cstdio>
+#include <cstring>
+#include <new>
+#include <utility>
 
 namespace memoryPool
 {
 
+// 前端缓存: 每线程一个缓存, 或每CPU一个缓存(需内核支持rseq)
+enum class FrontEnd
+{
+    PerThread,
+    PerCpu
+};
+
+// 单个大小类的统计
+struct SizeClassStats
+{
+    size_t size;                // 对象大小
+    size_t allocations;         // 累计分配次数
+    size_t deallocations;       // 累计释放次数
+    size_t inUseBytes;          // 用户持有的字节数
+    size_t centralFreeBytes;    // 中心缓存的span和传输缓存中空闲的字节数
+    size_t spans;               // 该大小类持有的span数
+    size_t spanBytes;           // 这些span的总字节数
+    size_t refills;             // 前端从中心缓存取批的次数
+    size_t releases;            // 前端向中心缓存归还的次数
+};
+
+// 内存池各层的快照
+// 分配释放次数由各线程(或各CPU)分别累加, 快照时汇总, 不影响快速路径; 并发分配时各项之间可能略有出入
+struct MemoryPoolStats
+{
+    SizeClassStats classes[FREE_LIST_SIZE];
+
+    // 用户持有的字节数: 小对象按大小类大小, 大对象按页取整
+    size_t inUseBytes;
+    size_t smallInUseBytes;
+    size_t largeInUseBytes;
+
+    // 各层缓存中空闲的字节数
+    size_t threadCacheBytes;
+    size_t cpuCacheBytes;
+    size_t centralCacheBytes;
+    size_t largeCacheBytes;
+    size_t pageHeapFreeBytes;       // 页堆中空闲且仍驻留
+    size_t pageHeapReleasedBytes;   // 页堆中空闲且已归还系统
+
+    // 向系统申请的字节数, 及扣除已归还部分后的驻留字节数
+    size_t mappedBytes;
+    size_t residentBytes;
+    // 驻留内存中没有被用户持有的比例, 包括各层缓存、页堆空闲页和span尾部的浪费
+    double fragmentation;
+
+    size_t threadCaches;            // 存活的线程缓存数
+    CentralCacheStats central;
+    LargeCacheStats large;
+    PageHeapStats pageHeap;
+};
+
 class MemoryPool
 {
 public:
     static void* allocate(size_t size)
     {
+        if (CpuCache::getInstance().isEnabled())
+        {
+            return CpuCache::getInstance().allocate(size);
+        }
         return ThreadCache::getInstance()->allocate(size);
     }
 
     static void deallocate(void* ptr, size_t size)
     {
+        if (CpuCache::getInstance().isEnabled())
+        {
+            CpuCache::getInstance().deallocate(ptr, size);
+            return;
+        }
         ThreadCache::getInstance()->deallocate(ptr, size);
     }
+
+    // 不需要传入大小的释放, 可用于free()风格的调用点
+    // 空指针不会创建本线程的缓存: glibc在线程退出清理的最后阶段仍会调用free(NULL)
+    static void deallocate(void* ptr)
+    {
+        if (!ptr)
+        {
+            return;
+        }
+        if (CpuCache::getInstance().isEnabled())
+        {
+            CpuCache::getInstance().deallocate(ptr);
+            return;
+        }
+        ThreadCache::getInstance()->deallocate(ptr);
+    }
+
+    // 分配n个size字节的对象写入out, 返回成功分配的个数, 内存不足时小于n
+    // 大小类只计算一次, 对象整段从线程缓存取出, 不够时直接向中心缓存整批获取; 每CPU前端逐个分配
+    static size_t allocateBatch(size_t size, size_t n, void** out)
+    {
+        if (CpuCache::getInstance().isEnabled())
+        {
+            size_t count = 0;
+            while (count < n && (out[count] = CpuCache::getInstance().allocate(size)))
+            {
+                count++;
+            }
+            return count;
+        }
+        return ThreadCache::getInstance()->allocateBatch(size, n, out);
+    }
+
+    // 释放n个size字节的对象, 可以是allocateBatch分配的, 也可以是逐个分配的, ptrs中不能有空指针
+    static void deallocateBatch(size_t size, size_t n, void** ptrs)
+    {
+        if (CpuCache::getInstance().isEnabled())
+        {
+            for (size_t i = 0; i < n; ++i)
+            {
+                CpuCache::getInstance().deallocate(ptrs[i], size);
+            }
+            return;
+        }
+        ThreadCache::getInstance()->deallocateBatch(size, n, ptrs);
+    }
+
+    // 大小在编译期已知时的分配: 大小类在编译期算出, 不再检查0大小和MAX_BYTES
+    // 线程缓存的弹出内联到调用处, 只有链表为空时取批是函数调用; 每CPU前端和大对象仍走运行期路径
+    // Alignment大于ALIGNMENT时按对齐分配选用大小类, 与allocateAligned(N, Alignment)一致
+    template <size_t N, size_t Alignment = ALIGNMENT>
+    static void* allocate()
+    {
+        constexpr size_t index = staticIndex<N, Alignment>();
+        if constexpr (index == FREE_LIST_SIZE)
+        {
+            return allocateAligned(N, Alignment);
+        }
+        else
+        {
+            // 对齐分配时按所选大小类的大小请求, 运行期路径据此找回同一个大小类
+            constexpr size_t size = Alignment > ALIGNMENT ? SizeClass::classSize(index) : (N == 0 ? ALIGNMENT : N);
+            if (CpuCache::getInstance().isEnabled())
+            {
+                return CpuCache::getInstance().allocate(size);
+            }
+            return ThreadCache::getInstance()->allocateSmall(size, index);
+        }
+    }
+
+    // 释放allocate<N, Alignment>()分配的内存, 线程缓存的压入内联到调用处
+    template <size_t N, size_t Alignment = ALIGNMENT>
+    static void deallocate(void* ptr)
+    {
+        constexpr size_t index = staticIndex<N, Alignment>();
+        if constexpr (index == FREE_LIST_SIZE)
+        {
+            deallocateAligned(ptr, N, Alignment);
+        }
+        else
+        {
+            if (CpuCache::getInstance().isEnabled())
+            {
+                CpuCache::getInstance().deallocate(ptr, SizeClass::classSize(index));
+                return;
+            }
+            ThreadCache::getInstance()->deallocateSmall(ptr, index);
+        }
+    }
+
+    // 在内存池中构造T, 大小类在编译期算出; 内存不足时抛出bad_alloc, 构造函数抛出异常时释放内存
+    template <typename T, typename... Args>
+    static T* newObject(Args&&... args)
+    {
+        void* ptr = allocate<sizeof(T), alignof(T)>();
+        if (!ptr)
+        {
+            throw std::bad_alloc();
+        }
+        try
+        {
+            return new (ptr) T(std::forward<Args>(args)...);
+        }
+        catch (...)
+        {
+            deallocate<sizeof(T), alignof(T)>(ptr);
+            throw;
+        }
+    }
+
+    // 析构并释放newObject创建的对象, 空指针不做任何事; 必须以创建时的类型释放
+    template <typename T>
+    static void deleteObject(T* ptr)
+    {
+        if (!ptr)
+        {
+            return;
+        }
+        ptr->~T();
+        deallocate<sizeof(T), alignof(T)>(ptr);
+    }
+
+    // 调整对象大小, oldSize为分配时的大小, 内容按较小的大小保留
+    // 新旧大小属于同一大小类时直接返回原指针; 大对象尽量原地调整或用mremap搬移
+    // ptr为空时等同于allocate, newSize为0时释放并返回nullptr; 失败返回nullptr, 原对象不变
+    static void* reallocate(void* ptr, size_t oldSize, size_t newSize)
+    {
+        if (!ptr)
+        {
+            return allocate(newSize);
+        }
+        if (newSize == 0)
+        {
+            deallocate(ptr, oldSize);
+            return nullptr;
+        }
+
+        if (oldSize <= MAX_BYTES && newSize <= MAX_BYTES)
+        {
+            if (SizeClass::getIndex(std::max(oldSize, ALIGNMENT)) == SizeClass::getIndex(newSize))
+            {
+                return ptr;
+            }
+        }
+        else if (oldSize > MAX_BYTES && newSize > MAX_BYTES)
+        {
+            return LargeCache::getInstance().reallocate(ptr, newSize);
+        }
+
+        void* newPtr = allocate(newSize);
+        if (!newPtr)
+        {
+            return nullptr;
+        }
+        memcpy(newPtr, ptr, std::min(oldSize, newSize));
+        deallocate(ptr, oldSize);
+        return newPtr;
+    }
+
+    // 分配num个size字节且内容全为0的内存, 总大小溢出时返回nullptr
+    // 大对象所在的span已知全为0(刚从系统申请或归还过)时不再清零
+    static void* callocate(size_t num, size_t size)
+    {
+        if (size && num > SIZE_MAX / size)
+        {
+            return nullptr;
+        }
+        size_t bytes = num * size;
+        if (bytes > MAX_BYTES)
+        {
+            return allocateLargeSampled(bytes, [bytes] { return LargeCache::getInstance().allocateZeroed(bytes); });
+        }
+
+        void* ptr = allocate(bytes);
+        if (ptr)
+        {
+            memset(ptr, 0, bytes);
+        }
+        return ptr;
+    }
+
+    // 分配起始地址对齐到alignment(2的幂)的内存, alignment不是2的幂时返回nullptr
+    // 不超过一页的对齐优先选用对象大小本身是对齐倍数的大小类, 更大的对齐从span中切出对齐的部分
+    static void* allocateAligned(size_t size, size_t alignment)
+    {
+        if (alignment == 0 || (alignment & (alignment - 1)))
+        {
+            return nullptr;
+        }
+        if (alignment <= ALIGNMENT)
+        {
+            return allocate(size);
+        }
+
+        size_t index = alignedIndex(size, alignment);
+        if (index < FREE_LIST_SIZE)
+        {
+            return allocate(SizeClass::classSize(index));
+        }
+        return allocateLargeSampled(size, [=] { return LargeCache::getInstance().allocateAligned(size, alignment); });
+    }
+
+    // 释放allocateAligned分配的内存, size和alignment须与分配时相同
+    static void deallocateAligned(void* ptr, size_t size, size_t alignment)
+    {
+        if (alignment <= ALIGNMENT)
+        {
+            deallocate(ptr, size);
+            return;
+        }
+
+        size_t index = alignedIndex(size, alignment);
+        if (index < FREE_LIST_SIZE)
+        {
+            deallocate(ptr, SizeClass::classSize(index));
+            return;
+        }
+        if (HeapProfiler::hasSampledObjects())
+        {
+            HeapProfiler::recordFree(ptr);
+        }
+        LargeCache::getInstance().deallocate(ptr);
+    }
+
+    // 切换前端缓存, 选择PerCpu但不支持rseq时保持PerThread并返回false
+    // 切换前缓存在旧前端中的对象仍可用任一前端释放
+    static bool setFrontEnd(FrontEnd frontEnd)
+    {
+        if (frontEnd == FrontEnd::PerCpu)
+        {
+            return CpuCache::getInstance().enable();
+        }
+        CpuCache::getInstance().disable();
+        return true;
+    }
+
+    static FrontEnd getFrontEnd()
+    {
+        return CpuCache::getInstance().isEnabled() ? FrontEnd::PerCpu : FrontEnd::PerThread;
+    }
+
+    // 汇总各层的统计, 需要逐个加锁遍历, 不宜频繁调用
+    static MemoryPoolStats getStats();
+    // 以可读的格式输出统计, 只列出用过的大小类
+    static void printStats(FILE* out = stdout);
+    static void printStats(const MemoryPoolStats& stats, FILE* out = stdout);
+
+private:
+    // 不经过前端缓存直接向大对象缓存分配的路径(大块清零分配、大对齐分配), 与allocate一样参与堆分析采样
+    template <typename Alloc>
+    static void* allocateLargeSampled(size_t size, Alloc alloc)
+    {
+        if (!HeapProfiler::shouldSample(size))
+        {
+            return alloc();
+        }
+        // 新的采样距离已预先加上size, 与ThreadCache一样再走一遍快速路径扣除
+        HeapProfiler& profiler = HeapProfiler::getInstance();
+        bool sample = profiler.pickNextSample(size);
+        void* ptr = allocateLargeSampled(size, alloc);
+        if (sample && ptr)
+        {
+            profiler.recordAllocation(ptr, size);
+        }
+        return ptr;
+    }
+
+    // 编译期确定的大小类, 需要走大对象或大对齐路径时为FREE_LIST_SIZE
+    template <size_t Size, size_t Alignment>
+    static constexpr size_t staticIndex()
+    {
+        static_assert(Alignment > 0 && (Alignment & (Alignment - 1)) == 0, "alignment must be a power of two");
+        return alignedIndex(Size == 0 ? ALIGNMENT : Size, Alignment);
+    }
+
+    // 对齐分配使用的大小类, 需要走大对象路径时返回FREE_LIST_SIZE
+    static constexpr size_t alignedIndex(size_t size, size_t alignment)
+    {
+        if (size > MAX_BYTES || alignment > PAGE_SIZE)
+        {
+            return FREE_LIST_SIZE;
+        }
+        return SizeClass::getAlignedIndex(size, alignment);
+    }
+};
+
+// 继承后该类型的new/delete改用内存池, 包括C++17按alignas对齐的版本
+// 释放时由编译器传入对象大小, 走带大小的快速路径
+class PoolObject
+{
+public:
+    static void* operator new(size_t size)
+    {
+        return checked(MemoryPool::allocate(size));
+    }
+
+    static void* operator new[](size_t size)
+    {
+        return checked(MemoryPool::allocate(size));
+    }
+
+    static void* operator new(size_t size, std::align_val_t alignment)
+    {
+        return checked(MemoryPool::allocateAligned(size, static_cast<size_t>(alignment)));
+    }
+
+    static void* operator new[](size_t size, std::align_val_t alignment)
+    {
+        return checked(MemoryPool::allocateAligned(size, static_cast<size_t>(alignment)));
+    }
+
+    static void operator delete(void* ptr, size_t size)
+    {
+        MemoryPool::deallocate(ptr, size);
+    }
+
+    static void operator delete[](void* ptr, size_t size)
+    {
+        MemoryPool::deallocate(ptr, size);
+    }
+
+    static void operator delete(void* ptr, size_t size, std::align_val_t alignment)
+    {
+        MemoryPool::deallocateAligned(ptr, size, static_cast<size_t>(alignment));
+    }
+
+    static void operator delete[](void* ptr, size_t size, std::align_val_t alignment)
+    {
+        MemoryPool::deallocateAligned(ptr, size, static_cast<size_t>(alignment));
+    }
+
+private:
+    static void* checked(void* ptr)
+    {
+        if (!ptr)
+        {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
 };
 
-} // namespace memoryPool
\ No newline at end of file
+} // namespace memoryPool
@@ -0,0 +1,135 @@
+#include "NumaTopology.h"
+#include <fcntl.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+namespace memoryPool {
+
+namespace {
+
+// 读取/sys中的编号列表文件, 内容形如 "0-3,8-11", 对列出的每个编号调用visit, 无法读取时返回false
+template <typename Visit>
+bool readIdList(const char* path, Visit visit) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) return false;
+    char buf[512];
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if(n < 0) return false;
+    buf[n] = '\0';
+
+    // 解析逗号分隔的区间列表
+    size_t first = 0;
+    size_t value = 0;
+    bool inRange = false;
+    bool hasDigit = false;
+    for(char* p = buf; ; ++p) {
+        if(*p >= '0' && *p <= '9') {
+            value = value * 10 + (*p - '0');
+            hasDigit = true;
+        }
+        else if(*p == '-') {
+            first = value;
+            value = 0;
+            inRange = true;
+        }
+        else {
+            if(hasDigit) {
+                for(size_t id = inRange ? first : value; id <= value; ++id) {
+                    visit(id);
+                }
+            }
+            value = 0;
+            inRange = false;
+            hasDigit = false;
+            if(*p != ',') break;
+        }
+    }
+    return true;
+}
+
+}
+
+NumaTopology::NumaTopology() {
+    systemNodes_ = detect();
+    configure(NumaConfig{});
+}
+
+size_t NumaTopology::detect() {
+    // 节点编号可以不连续(如内存热移除之后), 按online列表逐个读取, 不能在第一个缺失的编号处停止
+    // 节点下标直接使用系统编号, mbind的节点掩码因此无需转换, 中间缺失的编号没有CPU, 也就不会被选中
+    size_t nodes = 0;
+    auto visitNode = [&](size_t node) {
+        if(node >= MAX_NUMA_NODES) return;
+
+        // 路径形如 /sys/devices/system/node/node0/cpulist
+        char path[64] = "/sys/devices/system/node/node";
+        size_t len = 29;
+        if(node >= 10) {
+            path[len++] = static_cast<char>('0' + node / 10);
+        }
+        path[len++] = static_cast<char>('0' + node % 10);
+        const char suffix[] = "/cpulist";
+        for(size_t i = 0; i < sizeof(suffix); ++i) {
+            path[len + i] = suffix[i];
+        }
+
+        bool found = readIdList(path, [&](size_t cpu) {
+            if(cpu < MAX_CPUS) {
+                systemCpuToNode_[cpu] = static_cast<uint8_t>(node);
+            }
+        });
+        if(found) {
+            nodes = std::max(nodes, node + 1);
+        }
+    };
+    if(!readIdList("/sys/devices/system/node/online", visitNode)) {
+        readIdList("/sys/devices/system/node/possible", visitNode);
+    }
+    return nodes ? nodes : 1;
+}
+
+size_t NumaTopology::possibleCpus() {
+    size_t count = 0;
+    bool found = readIdList("/sys/devices/system/cpu/possible", [&](size_t cpu) {
+        count = std::max(count, cpu + 1);
+    });
+    return found ? count : 0;
+}
+
+void NumaTopology::configure(const NumaConfig& config) {
+    config_ = config;
+    size_t numNodes = config.fakeNodes > 0 ? std::min(config.fakeNodes, MAX_NUMA_NODES) : systemNodes_;
+    for(size_t cpu = 0; cpu < MAX_CPUS; ++cpu) {
+        cpuToNode_[cpu] = config.fakeNodes > 0 ? static_cast<uint8_t>(cpu % numNodes) : systemCpuToNode_[cpu];
+    }
+    numNodes_.store(numNodes, std::memory_order_relaxed);
+}
+
+size_t NumaTopology::currentNode() const {
+    size_t nodes = numNodes();
+    if(threadNode_ >= 0) {
+        return static_cast<size_t>(threadNode_) % nodes;
+    }
+    if(nodes == 1) return 0;
+
+    int cpu = sched_getcpu();
+    return cpu >= 0 && static_cast<size_t>(cpu) < MAX_CPUS ? cpuToNode_[cpu] % nodes : 0;
+}
+
+void NumaTopology::setThreadNode(int node) {
+    threadNode_ = node;
+}
+
+bool NumaTopology::bindToNode(void* ptr, size_t bytes, size_t node) const {
+    // 单节点或伪造的节点在系统中不存在时不绑定
+    if(!config_.bindMemory || systemNodes_ <= 1 || node >= systemNodes_) return false;
+
+    // 优先在该节点分配, 节点内存不足时仍可使用其他节点
+    unsigned long mask = 1UL << node;
+    return syscall(SYS_mbind, ptr, bytes, MPOL_PREFERRED, &mask, MAX_NUMA_NODES + 1, 0) == 0;
+}
+
+}
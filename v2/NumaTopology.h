@@ -0,0 +1,64 @@
+#pragma once
+#include "Common.h"
+
+namespace memoryPool {
+
+// 支持的最大NUMA节点数和CPU数
+constexpr size_t MAX_NUMA_NODES = 8;
+constexpr size_t MAX_CPUS = 1024;
+
+// NUMA配置
+struct NumaConfig {
+    // 0表示使用系统拓扑; 大于0时伪造该数量的节点, CPU按编号取模分配, 用于在单节点机器上测试
+    size_t fakeNodes = 0;
+    // 是否用mbind把新申请的页绑定到所属节点, 伪造的节点在系统中不存在时不绑定
+    bool bindMemory = true;
+};
+
+// NUMA拓扑: 从/sys读取节点和CPU的对应关系, 不可用时退化为单节点
+// 只使用open/read和系统调用, 不经过malloc
+class NumaTopology {
+public:
+    static NumaTopology& getInstance() {
+        static NumaTopology instance;
+        return instance;
+    }
+
+    // 应在分配之前调用, 修改后已分配的内存仍归原节点
+    void configure(const NumaConfig& config);
+    NumaConfig getConfig() const { return config_; }
+
+    size_t numNodes() const { return numNodes_.load(std::memory_order_relaxed); }
+
+    // 当前线程所在的节点, 单节点时不查询CPU
+    size_t currentNode() const;
+
+    // 把当前线程固定视为某个节点, -1恢复按所在CPU判断, 用于测试
+    static void setThreadNode(int node);
+
+    // 系统中可能出现的最大CPU编号加1, 包括未上线和可热插拔的CPU, 编号可以不连续; 无法读取时返回0
+    static size_t possibleCpus();
+
+    // 把[ptr, ptr + bytes)绑定到节点, 必须在第一次访问前调用, 不需要或失败时返回false
+    bool bindToNode(void* ptr, size_t bytes, size_t node) const;
+
+private:
+    NumaTopology();
+
+    // 读取系统拓扑, 返回最大节点编号加1, 节点编号不连续时其中部分节点没有CPU
+    size_t detect();
+
+private:
+    NumaConfig config_;
+    std::atomic<size_t> numNodes_{1};
+    size_t systemNodes_ = 1;
+    uint8_t systemCpuToNode_[MAX_CPUS] = {};
+    uint8_t cpuToNode_[MAX_CPUS] = {};
+
+    static inline thread_local int threadNode_ = -1;
+};
+
+// 单例不登记析构函数, 静态析构之后释放内存时仍可使用
+static_assert(std::is_trivially_destructible<NumaTopology>::value, "singleton is never destroyed");
+
+}
@@ -1,122 +1,717 @@
 #include "PageCache.h"
 #include <sys/mman.h>
-#include <cstring>
 
 namespace memoryPool {
 
+namespace {
 
-void* PageCache::allocateSpan(size_t numPages) {
-    std::lock_guard<std::mutex> lock(mutex_);
+// 只在持有arena锁时修改的计数, 其他线程可以不加锁读取
+inline void addRelaxed(std::atomic<size_t>& counter, size_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
 
-    // 查找合适的空闲span
-    // lower_bound函数返回第一个大于等于numPages的元素迭代器
-    auto it = freeSpans_.lower_bound(numPages);
-    if(it != freeSpans_.end()) {
-        Span* span = it->second;
-        // 删除span
-        if(span->next) {
-            it->second = span->next;
+inline void subRelaxed(std::atomic<size_t>& counter, size_t delta) {
+    counter.store(counter.load(std::memory_order_relaxed) - delta, std::memory_order_relaxed);
+}
+
+}
+
+PageCache::PageCache() {
+    size_t numCpus = std::thread::hardware_concurrency();
+    numArenas_.store(std::clamp(numCpus, size_t(1), MAX_ARENAS), std::memory_order_relaxed);
+}
+
+size_t PageCache::arenasPerNode() const {
+    size_t numNodes = NumaTopology::getInstance().numNodes();
+    return std::max(size_t(1), getNumArenas() / numNodes);
+}
+
+size_t PageCache::arenaFor(size_t sizeClass, size_t node) {
+    size_t perNode = arenasPerNode();
+    if(sizeClass != NO_SIZE_CLASS) {
+        return node * perNode + sizeClass % perNode;
+    }
+    // 大对象按线程分配arena, 线程第一次分配时领取一个编号
+    static thread_local size_t threadArena = nextThreadArena_.fetch_add(1, std::memory_order_relaxed);
+    return node * perNode + threadArena % perNode;
+}
+
+void* PageCache::allocateSpan(size_t numPages, size_t sizeClass, size_t node, bool* zeroed) {
+    NumaTopology& numa = NumaTopology::getInstance();
+    if(node == CURRENT_NODE) {
+        node = numa.currentNode();
+    }
+    node %= numa.numNodes();
+    size_t arenaIndex = arenaFor(sizeClass, node);
+    Arena& arena = arenas_[arenaIndex];
+
+    std::unique_lock<std::mutex> lock(arena.mutex);
+    Span* span = takeFreeSpan(arena, arenaIndex, numPages);
+    if(!span) {
+        lock.unlock();
+
+        // 本arena没有合适的空闲span, 先从其他arena挪用, 都没有再向系统申请
+        bool stolen = false;
+        span = stealSpan(arenaIndex, node, numPages);
+        if(span) {
+            stolen = true;
         }
         else {
-            freeSpans_.erase(it);
+            // 按大页的整数倍申请, 多出的部分作为空闲span留在本arena
+            size_t regionPages = (numPages + PAGES_PER_HUGE_PAGE - 1) / PAGES_PER_HUGE_PAGE * PAGES_PER_HUGE_PAGE;
+            void* memory = systemAlloc(regionPages, node);
+            if(!memory) return nullptr;
+
+            // 为新内存的页号范围准备好基数树节点, 之后分割/合并时的登记都不会失败
+            span = spanMap_.ensure(pageIdOf(memory), regionPages) && registerHugePages(memory, regionPages)
+                ? spanAllocator_.allocate() : nullptr;
+            if(!span) {
+                munmap(memory, regionPages * PAGE_SIZE);
+                return nullptr;
+            }
+            span->pageAddr = memory;
+            span->numPages = regionPages;
+            span->isReleased = false;
+            span->isZeroed = true;
         }
 
-        // 如果span大于需要的numPages则进行分割
-        if(span->numPages > numPages) {
-            // 分割出去的span部分
-            Span* newSpan = new Span;
-            newSpan->pageAddr = static_cast<char*>(span->pageAddr) + numPages * PAGE_SIZE;
+        lock.lock();
+        if(stolen) {
+            arena.stolenSpans++;
+        }
+        else {
+            arena.mappedBytes += span->numPages * PAGE_SIZE;
+            if(span->numPages > numPages) {
+                span->freeEpoch = arena.scavengeEpoch;
+                if(Span* rest = splitSpan(arenaIndex, span, numPages)) {
+                    insertFreeSpan(arena, rest);
+                }
+            }
+        }
+    }
 
-            newSpan->numPages = span->numPages - numPages;
+    // 复用已归还的页, 这些页重新被访问后所在大页不再完整
+    if(span->isReleased) {
+        updateHugePages(span->pageAddr, span->numPages, false);
+    }
 
-            // 放回空闲span*列表头部
-            auto& listHead = freeSpans_[newSpan->numPages];
-            newSpan->next = listHead;
-            listHead = newSpan;
+    span->next = nullptr;
+    span->prev = nullptr;
+    span->sizeClass = sizeClass;
+    span->isFree = false;
+    span->isReleased = false;
+    span->node = static_cast<uint32_t>(node);
+    span->arena.store(static_cast<uint32_t>(arenaIndex), std::memory_order_release);
 
-            span->numPages = numPages;
-        }
+    // 使用中的span登记全部页, 任意内部指针都能查到所属span
+    spanMap_.setRange(pageIdOf(span->pageAddr), span->numPages, span);
+    if(zeroed) {
+        *zeroed = span->isZeroed;
+    }
+    span->isZeroed = false;
+    return span->pageAddr;
+}
 
-        // 记录span信息用于回收
-        spanMap_[span->pageAddr] = span;
-        return span->pageAddr;
+Span* PageCache::takeFreeSpan(Arena& arena, size_t arenaIndex, size_t numPages) {
+    // 查找合适的空闲span, 优先使用仍驻留的span, 其次复用已归还给系统的span
+    // lower_bound函数返回第一个大于等于numPages的元素迭代器
+    SpanMap* freeList = &arena.freeSpans;
+    auto it = arena.freeSpans.lower_bound(numPages);
+    if(it == arena.freeSpans.end()) {
+        freeList = &arena.releasedSpans;
+        it = arena.releasedSpans.lower_bound(numPages);
     }
+    if(it == freeList->end()) return nullptr;
 
-    // 没有合适的span, 向系统申请
-    void* memory = systemAlloc(numPages);
-    if(!memory) return nullptr;
+    Span* span = it->second;
+    removeFreeSpan(arena, span);
 
-    // 创建新的span
-    Span* span = new Span;
-    span->pageAddr = memory;
-    span->numPages = numPages;
-    span->next = nullptr;
+    // 如果span大于需要的numPages则进行分割, 分割出去的部分留在本arena
+    if(span->numPages > numPages) {
+        Span* rest = splitSpan(arenaIndex, span, numPages);
+        if(!rest) {
+            insertFreeSpan(arena, span);
+            return nullptr;
+        }
+        insertFreeSpan(arena, rest);
+    }
+    return span;
+}
+
+Span* PageCache::splitSpan(size_t arenaIndex, Span* span, size_t numPages) {
+    Span* newSpan = spanAllocator_.allocate();
+    if(!newSpan) return nullptr;
 
-    // 记录span信息用于回收
-    spanMap_[memory] = span;
-    return memory;
+    // 后半部分继承是否已归还的状态和空闲轮次
+    newSpan->pageAddr = static_cast<char*>(span->pageAddr) + numPages * PAGE_SIZE;
+    newSpan->numPages = span->numPages - numPages;
+    newSpan->isReleased = span->isReleased;
+    newSpan->isZeroed = span->isZeroed;
+    newSpan->freeEpoch = span->freeEpoch;
+    newSpan->arena.store(static_cast<uint32_t>(arenaIndex), std::memory_order_release);
+
+    span->numPages = numPages;
+    return newSpan;
 }
 
-void PageCache::deallocateSpan(void* ptr, size_t numPages) {
-    std::lock_guard<std::mutex> lock(mutex_);
+Span* PageCache::stealSpan(size_t self, size_t node, size_t numPages) {
+    // 多个NUMA节点时只在本节点的arena间挪用, 其他节点的页不如新申请的本地页
+    size_t first = 0;
+    size_t count = MAX_ARENAS;
+    if(NumaTopology::getInstance().numNodes() > 1) {
+        count = arenasPerNode();
+        first = node * count;
+    }
 
+    // 从下一个arena开始轮流查看, 跳过空闲页不够的arena
+    size_t bytes = numPages * PAGE_SIZE;
+    for(size_t i = 1; i < count; ++i) {
+        size_t victimIndex = first + (self - first + i) % count;
+        Arena& victim = arenas_[victimIndex];
+        if(victim.freeBytes.load(std::memory_order_relaxed) < bytes
+            && victim.releasedBytes.load(std::memory_order_relaxed) < bytes) {
+            continue;
+        }
+
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if(Span* span = takeFreeSpan(victim, victimIndex, numPages)) {
+            return span;
+        }
+    }
+    return nullptr;
+}
+
+void PageCache::deallocateSpan(void* ptr) {
     // 查找对应的span，没找到代表不是PageCache分配的内存，直接返回
-    auto it = spanMap_.find(ptr);
-    if(it == spanMap_.end()) return;
+    Span* span = getSpan(ptr);
+    if(!span) return;
+    uint32_t arenaIndex = span->arena.load(std::memory_order_acquire);
+    if(arenaIndex >= MAX_ARENAS) return;
 
-    Span* span = it->second;
+    Arena& arena = arenas_[arenaIndex];
+    std::lock_guard<std::mutex> lock(arena.mutex);
+    if(span->pageAddr != ptr || span->isFree || span->arena.load(std::memory_order_relaxed) != arenaIndex) return;
 
-    // 尝试合并相邻的span
-    void* nextAddr = static_cast<char*>(ptr) + numPages * PAGE_SIZE;
-    auto nextIt = spanMap_.find(nextAddr);
-    
-    if(nextIt != spanMap_.end()) {
-        Span* nextSpan = nextIt->second;
-
-        // 1. 首先检查nextSpan是否在空闲链表中
-        bool found = false;
-        auto& nextList = freeSpans_[nextSpan->numPages];
-
-        // 检查空闲链表中有无nextSpan
-        if(nextList == nextSpan) {
-            nextList = nextSpan->next;
-            found = true;
-        }
-        else if(nextList) {
-            Span* prev = nextList;
-            while(prev->next) {
-                if(prev->next == nextSpan) {
-                    // 要把这个span合并掉了，所以从空闲链表中删除
-                    prev->next = nextSpan->next;
-                    found = true;
-                    break;
-                }
-                prev = prev->next;
+    span->isReleased = false;
+    span->isZeroed = false;
+    span->freeEpoch = arena.scavengeEpoch;
+    mergeFreeSpan(arena, arenaIndex, span);
+
+    // 按释放次数触发回收
+    size_t interval = releaseInterval_.load(std::memory_order_relaxed);
+    if(interval && ++arena.freesSinceScavenge >= interval) {
+        arena.freesSinceScavenge = 0;
+        ScavengerConfig config = getScavengerConfig();
+        scavenge(arena, arenaIndex, config, config.releaseBytesPerRound, true);
+    }
+}
+
+void* PageCache::allocateAlignedSpan(size_t numPages, size_t alignPages, size_t node) {
+    // 多申请alignPages - 1页, 其中必有一段按alignPages页对齐的numPages页
+    size_t totalPages = numPages + alignPages - 1;
+    void* ptr = allocateSpan(totalPages, NO_SIZE_CLASS, node);
+    if(!ptr || alignPages <= 1) return ptr;
+
+    Span* span = getSpan(ptr);
+    uint32_t arenaIndex = span->arena.load(std::memory_order_relaxed);
+    if(arenaIndex >= MAX_ARENAS) return nullptr;
+    Arena& arena = arenas_[arenaIndex];
+    std::unique_lock<std::mutex> lock(arena.mutex);
+
+    // 切下头部: 对齐部分成为新的使用中span, 先登记它的全部页, 再把头部交还
+    size_t headPages = (alignPages - pageIdOf(ptr) % alignPages) % alignPages;
+    if(headPages) {
+        Span* aligned = splitSpan(arenaIndex, span, headPages);
+        if(!aligned) {
+            lock.unlock();
+            deallocateSpan(ptr);
+            return nullptr;
+        }
+        aligned->next = nullptr;
+        aligned->prev = nullptr;
+        aligned->sizeClass = NO_SIZE_CLASS;
+        aligned->isFree = false;
+        aligned->node = span->node;
+        spanMap_.setRange(pageIdOf(aligned->pageAddr), aligned->numPages, aligned);
+        freeTrimmedSpan(arena, arenaIndex, span);
+        span = aligned;
+    }
+
+    // 切下尾部, 元数据不足时保留多出的页
+    if(span->numPages > numPages) {
+        if(Span* tail = splitSpan(arenaIndex, span, numPages)) {
+            freeTrimmedSpan(arena, arenaIndex, tail);
+        }
+    }
+    return span->pageAddr;
+}
+
+void PageCache::freeTrimmedSpan(Arena& arena, size_t arenaIndex, Span* span) {
+    span->isReleased = false;
+    span->isZeroed = false;
+    span->freeEpoch = arena.scavengeEpoch;
+    mergeFreeSpan(arena, arenaIndex, span);
+}
+
+void* PageCache::resizeSpan(void* ptr, size_t newPages, bool& moved) {
+    moved = false;
+    Span* span = getSpan(ptr);
+    if(!span || newPages == 0) return nullptr;
+    uint32_t arenaIndex = span->arena.load(std::memory_order_acquire);
+    if(arenaIndex >= MAX_ARENAS) return nullptr;
+
+    {
+        Arena& arena = arenas_[arenaIndex];
+        std::lock_guard<std::mutex> lock(arena.mutex);
+        if(span->pageAddr != ptr || span->isFree || span->sizeClass != NO_SIZE_CLASS
+            || span->arena.load(std::memory_order_relaxed) != arenaIndex) return nullptr;
+        if(resizeInPlace(arena, arenaIndex, span, newPages)) return ptr;
+    }
+
+    // 使用中的span只由持有者修改, 解锁后页数不变
+    if(span->numPages * PAGE_SIZE < MREMAP_THRESHOLD) return nullptr;
+    void* newPtr = remapSpan(span, newPages);
+    moved = newPtr != nullptr;
+    return newPtr;
+}
+
+bool PageCache::resizeInPlace(Arena& arena, size_t arenaIndex, Span* span, size_t newPages) {
+    // 缩小: 尾部切下后与后面的空闲span合并, 元数据不足时保持原大小
+    if(newPages <= span->numPages) {
+        if(newPages < span->numPages) {
+            if(Span* rest = splitSpan(arenaIndex, span, newPages)) {
+                freeTrimmedSpan(arena, arenaIndex, rest);
             }
         }
-        // 找到了，进行合并
-        if(found) {
-            span->numPages += nextSpan->numPages;
-            spanMap_.erase(nextAddr);
-            delete nextSpan;
+        return true;
+    }
+
+    // 扩展: 后一个相邻span空闲、属于本arena且页数足够时吞并其开头部分
+    size_t extraPages = newPages - span->numPages;
+    size_t nextId = pageIdOf(span->pageAddr) + span->numPages;
+    Span* nextSpan = spanMap_.get(nextId);
+    if(!nextSpan || nextSpan->arena.load(std::memory_order_acquire) != arenaIndex || !nextSpan->isFree
+        || pageIdOf(nextSpan->pageAddr) != nextId || nextSpan->numPages < extraPages) return false;
+
+    removeFreeSpan(arena, nextSpan);
+    if(nextSpan->numPages > extraPages) {
+        Span* rest = splitSpan(arenaIndex, nextSpan, extraPages);
+        if(!rest) {
+            insertFreeSpan(arena, nextSpan);
+            return false;
         }
+        insertFreeSpan(arena, rest);
+    }
+    if(nextSpan->isReleased) {
+        updateHugePages(nextSpan->pageAddr, nextSpan->numPages, false);
+    }
+    span->numPages = newPages;
+    spanMap_.setRange(nextId, extraPages, span);
+    nextSpan->arena.store(NO_ARENA, std::memory_order_release);
+    spanAllocator_.deallocate(nextSpan);
+    return true;
+}
+
+void* PageCache::remapSpan(Span* span, size_t newPages) {
+    void* oldPtr = span->pageAddr;
+    size_t oldBytes = span->numPages * PAGE_SIZE;
+    void* newPtr = allocateSpan(newPages, NO_SIZE_CLASS, span->node);
+    if(!newPtr) return nullptr;
+
+    // 把已写入的页搬到新span开头, 替换掉那里的页, 不复制数据
+    // MREMAP_DONTUNMAP让原范围保持映射但不再有页, 原范围不会出现空洞, 也就不会被其他线程的mmap占用
+    // 内核不支持或原范围跨多个映射等情况下失败, 由调用方复制
+    if(mremap(oldPtr, oldBytes, oldBytes, MREMAP_MAYMOVE | MREMAP_FIXED | MREMAP_DONTUNMAP, newPtr) == MAP_FAILED) {
+        deallocateSpan(newPtr);
+        return nullptr;
+    }
+
+    // 原范围的页已被搬走, 不占物理内存, 按已归还的span交还arena
+    uint32_t arenaIndex = span->arena.load(std::memory_order_acquire);
+    if(arenaIndex >= MAX_ARENAS) return newPtr;
+    Arena& arena = arenas_[arenaIndex];
+    std::lock_guard<std::mutex> lock(arena.mutex);
+    span->isReleased = true;
+    span->isZeroed = true;
+    span->freeEpoch = arena.scavengeEpoch;
+    updateHugePages(oldPtr, span->numPages, true);
+    mergeFreeSpan(arena, arenaIndex, span);
+    return newPtr;
+}
+
+void PageCache::mergeFreeSpan(Arena& arena, size_t arenaIndex, Span* span) {
+    // 相邻span可能属于其他arena, 先确认它归本arena管理(持有本arena锁时不会改变), 再检查是否空闲和相邻
+    auto mergeable = [&](Span* neighbor) {
+        return neighbor && neighbor->arena.load(std::memory_order_acquire) == arenaIndex
+            && neighbor->isFree && neighbor->isReleased == span->isReleased;
+    };
+
+    // 尝试与前一个相邻的空闲span合并, 合并后按较早的空闲轮次计算, 避免不断增长的span永远不被回收
+    size_t pageId = pageIdOf(span->pageAddr);
+    Span* prevSpan = spanMap_.get(pageId - 1);
+    if(mergeable(prevSpan) && pageIdOf(prevSpan->pageAddr) + prevSpan->numPages == pageId) {
+        removeFreeSpan(arena, prevSpan);
+        span->pageAddr = prevSpan->pageAddr;
+        span->numPages += prevSpan->numPages;
+        span->isZeroed = span->isZeroed && prevSpan->isZeroed;
+        span->freeEpoch = std::min(span->freeEpoch, prevSpan->freeEpoch);
+        prevSpan->arena.store(NO_ARENA, std::memory_order_release);
+        spanAllocator_.deallocate(prevSpan);
+    }
+
+    // 尝试与后一个相邻的空闲span合并
+    size_t nextId = pageIdOf(span->pageAddr) + span->numPages;
+    Span* nextSpan = spanMap_.get(nextId);
+    if(mergeable(nextSpan) && pageIdOf(nextSpan->pageAddr) == nextId) {
+        removeFreeSpan(arena, nextSpan);
+        span->numPages += nextSpan->numPages;
+        span->isZeroed = span->isZeroed && nextSpan->isZeroed;
+        span->freeEpoch = std::min(span->freeEpoch, nextSpan->freeEpoch);
+        nextSpan->arena.store(NO_ARENA, std::memory_order_release);
+        spanAllocator_.deallocate(nextSpan);
     }
 
     // 将合并后的span插入到空闲链表头部
-    auto& list = freeSpans_[span->numPages];
+    insertFreeSpan(arena, span);
+}
+
+void PageCache::insertFreeSpan(Arena& arena, Span* span) {
+    span->isFree = true;
+    span->sizeClass = NO_SIZE_CLASS;
+
+    size_t pageId = pageIdOf(span->pageAddr);
+    spanMap_.set(pageId, span);
+    spanMap_.set(pageId + span->numPages - 1, span);
+
+    auto& list = freeListOf(arena, span)[span->numPages];
+    span->prev = nullptr;
     span->next = list;
+    if(list) {
+        list->prev = span;
+    }
     list = span;
+
+    addRelaxed(span->isReleased ? arena.releasedBytes : arena.freeBytes, span->numPages * PAGE_SIZE);
+}
+
+void PageCache::removeFreeSpan(Arena& arena, Span* span) {
+    if(span->prev) {
+        span->prev->next = span->next;
+    }
+    else {
+        // span是链表头
+        auto& freeList = freeListOf(arena, span);
+        auto it = freeList.find(span->numPages);
+        if(span->next) {
+            it->second = span->next;
+        }
+        else {
+            freeList.erase(it);
+        }
+    }
+    if(span->next) {
+        span->next->prev = span->prev;
+    }
+
+    span->next = nullptr;
+    span->prev = nullptr;
+    span->isFree = false;
+
+    subRelaxed(span->isReleased ? arena.releasedBytes : arena.freeBytes, span->numPages * PAGE_SIZE);
+}
+
+size_t PageCache::releaseFreeSpans(size_t maxBytes) {
+    ScavengerConfig config = getScavengerConfig();
+    size_t released = 0;
+    for(size_t i = 0; i < MAX_ARENAS && released < maxBytes; ++i) {
+        std::lock_guard<std::mutex> lock(arenas_[i].mutex);
+        released += scavenge(arenas_[i], i, config, maxBytes - released, false);
+    }
+    return released;
+}
+
+size_t PageCache::scavenge(Arena& arena, size_t arenaIndex, const ScavengerConfig& config, size_t maxBytes, bool onlyIdle) {
+    // 每轮推进一次轮次, 本轮之后释放的span要等到下一轮才算空闲
+    size_t epoch = arena.scavengeEpoch++;
+    scavengeRounds_.fetch_add(1, std::memory_order_relaxed);
+    size_t released = 0;
+
+    while(released < maxBytes && !arena.freeSpans.empty()) {
+        // 本次最多归还的字节数: 不超过本轮剩余额度, 也不让空闲页总量低于保留目标(针对所有arena)
+        size_t budget = maxBytes - released;
+        if(onlyIdle) {
+            size_t total = totalFreeBytes();
+            if(total <= config.retainedBytesTarget) break;
+            budget = std::min(budget, total - config.retainedBytesTarget);
+        }
+        size_t budgetPages = budget / PAGE_SIZE;
+        if(budgetPages == 0) break;
+
+        // 从页数最大的链表开始找, 一次madvise归还尽量多的页
+        // 优先选包含完整大页的span, 都不包含时才选其他span; 额度不足一个大页时不拆散完整的大页
+        bool hugeBudget = budgetPages >= PAGES_PER_HUGE_PAGE;
+        Span* victim = nullptr;
+        Span* fallback = nullptr;
+        for(auto it = arena.freeSpans.rbegin(); it != arena.freeSpans.rend() && !victim; ++it) {
+            for(Span* span = it->second; span; span = span->next) {
+                if(onlyIdle && span->freeEpoch >= epoch) continue;
+                size_t first = pageIdOf(span->pageAddr);
+                size_t alignedFirst = (first + PAGES_PER_HUGE_PAGE - 1) / PAGES_PER_HUGE_PAGE * PAGES_PER_HUGE_PAGE;
+                if(alignedFirst + PAGES_PER_HUGE_PAGE <= first + span->numPages) {
+                    if(!hugeBudget) continue;
+                    victim = span;
+                    break;
+                }
+                if(!fallback) {
+                    fallback = span;
+                }
+            }
+        }
+        if(!victim) {
+            victim = fallback;
+            if(!victim) break;
+            removeFreeSpan(arena, victim);
+        }
+        else {
+            // 只归还按大页对齐的部分, 首尾不足一个大页的页继续驻留, 不拆散所在的大页
+            removeFreeSpan(arena, victim);
+            size_t first = pageIdOf(victim->pageAddr);
+            size_t headPages = (PAGES_PER_HUGE_PAGE - first % PAGES_PER_HUGE_PAGE) % PAGES_PER_HUGE_PAGE;
+            if(headPages) {
+                if(Span* rest = splitSpan(arenaIndex, victim, headPages)) {
+                    insertFreeSpan(arena, victim);
+                    victim = rest;
+                }
+            }
+            size_t tailPages = (first + victim->numPages) % PAGES_PER_HUGE_PAGE;
+            if(tailPages && victim->numPages > tailPages) {
+                if(Span* tail = splitSpan(arenaIndex, victim, victim->numPages - tailPages)) {
+                    insertFreeSpan(arena, tail);
+                }
+            }
+            // 额度按大页取整, 只归还完整的大页
+            budgetPages = budgetPages / PAGES_PER_HUGE_PAGE * PAGES_PER_HUGE_PAGE;
+        }
+
+        // span超出额度时只归还开头的部分, 其余留在空闲链表
+        if(victim->numPages > budgetPages) {
+            Span* rest = splitSpan(arenaIndex, victim, budgetPages);
+            if(!rest) {
+                insertFreeSpan(arena, victim);
+                break;
+            }
+            insertFreeSpan(arena, rest);
+        }
+
+        releaseSpan(victim, config);
+        released += victim->numPages * PAGE_SIZE;
+        mergeFreeSpan(arena, arenaIndex, victim);
+    }
+
+    arena.totalReleasedBytes += released;
+    return released;
+}
+
+void PageCache::releaseSpan(Span* span, const ScavengerConfig& config) {
+    int advice = config.useMadvFree ? MADV_FREE : MADV_DONTNEED;
+    madvise(span->pageAddr, span->numPages * PAGE_SIZE, advice);
+    span->isReleased = true;
+    // MADV_DONTNEED之后再访问得到的是新的0页; MADV_FREE的页在内核回收前仍保留原内容
+    if(!config.useMadvFree) {
+        span->isZeroed = true;
+    }
+    updateHugePages(span->pageAddr, span->numPages, true);
+}
+
+size_t PageCache::totalFreeBytes() const {
+    size_t total = 0;
+    for(const Arena& arena : arenas_) {
+        total += arena.freeBytes.load(std::memory_order_relaxed);
+    }
+    return total;
+}
+
+void PageCache::setScavengerConfig(const ScavengerConfig& config) {
+    {
+        std::lock_guard<std::mutex> lock(configMutex_);
+        config_ = config;
+        releaseInterval_.store(config.releaseInterval, std::memory_order_relaxed);
+    }
+    scavengerCond_.notify_all();
 }
 
-void* PageCache::systemAlloc(size_t numPages) {
+ScavengerConfig PageCache::getScavengerConfig() {
+    std::lock_guard<std::mutex> lock(configMutex_);
+    return config_;
+}
+
+void PageCache::setNumArenas(size_t numArenas) {
+    numArenas_.store(std::clamp(numArenas, size_t(1), MAX_ARENAS), std::memory_order_relaxed);
+}
+
+void PageCache::startScavenger() {
+    std::lock_guard<std::mutex> lock(configMutex_);
+    if(scavengerRunning_) return;
+    scavengerRunning_ = true;
+    scavengerThread_ = std::thread(&PageCache::scavengerLoop, this);
+}
+
+void PageCache::stopScavenger() {
+    {
+        std::lock_guard<std::mutex> lock(configMutex_);
+        if(!scavengerRunning_) return;
+        scavengerRunning_ = false;
+    }
+    scavengerCond_.notify_all();
+    scavengerThread_.join();
+}
+
+void PageCache::scavengerLoop() {
+    std::unique_lock<std::mutex> lock(configMutex_);
+    while(scavengerRunning_) {
+        scavengerCond_.wait_for(lock, config_.backgroundPeriod);
+        if(!scavengerRunning_) break;
+
+        // 回收时不持有配置锁, 释放路径上触发回收时会在arena锁内读取配置
+        ScavengerConfig config = config_;
+        lock.unlock();
+        for(size_t i = 0; i < MAX_ARENAS; ++i) {
+            std::lock_guard<std::mutex> arenaLock(arenas_[i].mutex);
+            scavenge(arenas_[i], i, config, config.releaseBytesPerRound, true);
+        }
+        lock.lock();
+    }
+}
+
+void PageCache::prepareFork() {
+    // 与释放路径的顺序一致: arena锁内会读取配置, 也会分配span元数据
+    // 空闲链表节点的分配器只在arena锁内使用, 持有全部arena锁后不会再被占用
+    for(size_t i = 0; i < MAX_ARENAS; ++i) {
+        arenas_[i].mutex.lock();
+    }
+    configMutex_.lock();
+    spanAllocator_.lock();
+    hugePageAllocator_.lock();
+}
+
+void PageCache::afterFork(bool child) {
+    if(child && scavengerRunning_) {
+        // 回收线程没有被复制到子进程, 原线程句柄不能join也不能析构, 直接覆盖
+        // 条件变量可能仍记录着父进程中等待的线程, 一并重新构造
+        new(&scavengerThread_) std::thread();
+        new(&scavengerCond_) std::condition_variable();
+        scavengerRunning_ = false;
+    }
+    hugePageAllocator_.unlock();
+    spanAllocator_.unlock();
+    configMutex_.unlock();
+    for(size_t i = MAX_ARENAS; i-- > 0;) {
+        arenas_[i].mutex.unlock();
+    }
+}
+
+PageHeapStats PageCache::getStats() {
+    PageHeapStats stats{};
+    for(size_t i = 0; i < MAX_ARENAS; ++i) {
+        PageHeapStats arenaStats = getArenaStats(i);
+        stats.mappedBytes += arenaStats.mappedBytes;
+        stats.retainedBytes += arenaStats.retainedBytes;
+        stats.releasedBytes += arenaStats.releasedBytes;
+        stats.totalReleasedBytes += arenaStats.totalReleasedBytes;
+        stats.stolenSpans += arenaStats.stolenSpans;
+    }
+    stats.scavengeRounds = scavengeRounds_.load(std::memory_order_relaxed);
+    stats.hugePageBytes = intactHugePages_.load(std::memory_order_relaxed) * HUGE_PAGE_SIZE;
+    stats.brokenHugePages = brokenHugePages_.load(std::memory_order_relaxed);
+    return stats;
+}
+
+PageHeapStats PageCache::getArenaStats(size_t arenaIndex) {
+    Arena& arena = arenas_[arenaIndex];
+    std::lock_guard<std::mutex> lock(arena.mutex);
+    PageHeapStats stats{};
+    stats.mappedBytes = arena.mappedBytes;
+    stats.retainedBytes = arena.freeBytes.load(std::memory_order_relaxed);
+    stats.releasedBytes = arena.releasedBytes.load(std::memory_order_relaxed);
+    stats.totalReleasedBytes = arena.totalReleasedBytes;
+    stats.scavengeRounds = arena.scavengeEpoch;
+    stats.stolenSpans = arena.stolenSpans;
+    return stats;
+}
+
+void* PageCache::systemAlloc(size_t numPages, size_t node) {
     size_t size = numPages * PAGE_SIZE;
-    // 使用mmap分配内存
-    void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if(ptr == MAP_FAILED) return nullptr;
+    // 使用mmap分配内存, 多申请一个大页, 裁掉首尾后得到按大页对齐的区域
+    void* raw = mmap(nullptr, size + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(raw == MAP_FAILED) return nullptr;
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if(aligned > start) {
+        munmap(raw, aligned - start);
+    }
+    if(start + HUGE_PAGE_SIZE > aligned) {
+        munmap(reinterpret_cast<void*>(aligned + size), start + HUGE_PAGE_SIZE - aligned);
+    }
+    void* ptr = reinterpret_cast<void*>(aligned);
 
-    // 清零内存
-    memset(ptr, 0, size);
+    // 建议内核用透明大页支撑, 内核未开启透明大页时忽略失败
+    madvise(ptr, size, MADV_HUGEPAGE);
+
+    // 单节点或不支持时不绑定, 由第一次访问决定所在节点
+    NumaTopology::getInstance().bindToNode(ptr, size, node);
     return ptr;
 }
 
-}
\ No newline at end of file
+bool PageCache::registerHugePages(void* memory, size_t numPages) {
+    size_t first = hugePageIdOf(memory);
+    size_t count = numPages / PAGES_PER_HUGE_PAGE;
+    if(!hugePageMap_.ensure(first, count)) return false;
+
+    for(size_t i = 0; i < count; ++i) {
+        HugePage* hugePage = hugePageAllocator_.allocate();
+        if(!hugePage) return false;
+        hugePageMap_.set(first + i, hugePage);
+    }
+    intactHugePages_.fetch_add(count, std::memory_order_relaxed);
+    return true;
+}
+
+void PageCache::updateHugePages(const void* addr, size_t numPages, bool released) {
+    // 相邻span可能属于不同arena, 同一大页的计数可能被多个arena同时修改
+    size_t first = pageIdOf(addr);
+    size_t end = first + numPages;
+    while(first < end) {
+        size_t hugeEnd = (first / PAGES_PER_HUGE_PAGE + 1) * PAGES_PER_HUGE_PAGE;
+        size_t pages = std::min(end, hugeEnd) - first;
+        HugePage* hugePage = hugePageMap_.get(first / PAGES_PER_HUGE_PAGE);
+
+        size_t before = released ? hugePage->releasedPages.fetch_add(pages, std::memory_order_relaxed)
+                                 : hugePage->releasedPages.fetch_sub(pages, std::memory_order_relaxed);
+        size_t after = released ? before + pages : before - pages;
+
+        // 大页在完整、拆散、全部归还三种状态间转换时更新计数
+        auto isBroken = [](size_t releasedPages) {
+            return releasedPages > 0 && releasedPages < PAGES_PER_HUGE_PAGE;
+        };
+        if((before == 0) != (after == 0)) {
+            if(after == 0) {
+                intactHugePages_.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                intactHugePages_.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        if(isBroken(before) != isBroken(after)) {
+            if(isBroken(after)) {
+                brokenHugePages_.fetch_add(1, std::memory_order_relaxed);
+            }
+            else {
+                brokenHugePages_.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+        first += pages;
+    }
+}
+
+}
@@ -1,46 +1,254 @@
 #pragma once
 #include "Common.h"
+#include "PageMap.h"
+#include "FixedAllocator.h"
+#include "NumaTopology.h"
 #include <map>
+#include <new>
 #include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <chrono>
 
 namespace memoryPool {
 
 // 基本单位：page，一个或多个page组成一块内存，由span结构体进行管理，包含相同page数的span组成链表。
 // 根据span包含的page数不同，维护一个map，键为page数，值为span链表
 
+// span不属于任何小对象大小类时的sizeClass取值
+constexpr size_t NO_SIZE_CLASS = FREE_LIST_SIZE;
+
+// 页堆arena的最大个数, 以及span已被回收、不属于任何arena时的取值
+constexpr size_t MAX_ARENAS = 16;
+constexpr uint32_t NO_ARENA = UINT32_MAX;
+// 按调用线程当前所在的NUMA节点分配
+constexpr size_t CURRENT_NODE = SIZE_MAX;
+
+// 不能原地扩展时, 不小于此大小的span用mremap搬移页表项, 更小的span由调用方复制
+constexpr size_t MREMAP_THRESHOLD = 1024 * 1024;
+
+// 透明大页大小, 向系统申请的区域按大页对齐, 大小是大页的整数倍
+constexpr size_t HUGE_PAGE_SHIFT = 21;
+constexpr size_t HUGE_PAGE_SIZE = size_t(1) << HUGE_PAGE_SHIFT;
+constexpr size_t PAGES_PER_HUGE_PAGE = HUGE_PAGE_SIZE / PAGE_SIZE;
+
+// 内存块, 管理多张页
+struct Span {
+    void* pageAddr;     // 页起始地址
+    size_t numPages;    // 页数
+    Span* next;         // 链表指针
+    Span* prev;         // 空闲链表中的前驱, 用于O(1)摘除
+    size_t sizeClass;   // 切分出的对象所属大小类
+    bool isFree;        // 是否位于PageCache的空闲链表中
+    bool isReleased;    // 空闲页是否已通过madvise归还给操作系统
+    bool isZeroed;      // 空闲span的内容是否全为0: 刚从系统申请或以MADV_DONTNEED归还过, 分配出去后即失效
+    size_t freeEpoch;   // 进入空闲链表时的回收轮次, 用于判断是否空闲足够久
+    void* freeList;     // CentralCache中该span尚未分出的空闲对象
+    size_t useCount;    // 已分给ThreadCache的对象数, 归零时整个span交还PageCache
+    // 所属arena, 只在持有该arena的锁时修改, 其他arena合并前据此判断相邻span是否归自己管
+    std::atomic<uint32_t> arena;
+    uint32_t node;      // 页所在的NUMA节点, CentralCache据此把对象还给对应节点
+    std::atomic<uint32_t> sampledObjects;   // 堆分析器正在跟踪的对象数, 为0时释放不必查表
+};
+
+// 大页内已归还给系统的页数, 为0时整个大页可由透明大页支撑, 部分归还后大页被拆散
+struct HugePage {
+    std::atomic<size_t> releasedPages;
+};
+
+// 回收器配置
+struct ScavengerConfig {
+    // 页缓存最多保留的未归还空闲字节数, 超出部分才会被回收
+    size_t retainedBytesTarget = 64 * 1024 * 1024;
+    // 每轮最多归还的字节数, 配合触发频率即为归还速率
+    size_t releaseBytesPerRound = 8 * 1024 * 1024;
+    // 每释放多少次span触发一轮回收, 0表示不按次数触发
+    size_t releaseInterval = 256;
+    // 后台线程每隔多久执行一轮回收, 需调用startScavenger启动
+    std::chrono::milliseconds backgroundPeriod{1000};
+    // 使用MADV_FREE代替MADV_DONTNEED, 内核在内存压力下才真正回收
+    bool useMadvFree = false;
+};
+
+// 页缓存统计
+struct PageHeapStats {
+    size_t mappedBytes;         // 向系统申请的总字节数
+    size_t retainedBytes;       // 空闲且仍驻留的字节数
+    size_t releasedBytes;       // 空闲且已归还给系统的字节数
+    size_t totalReleasedBytes;  // 累计归还的字节数
+    size_t scavengeRounds;      // 累计回收轮数
+    size_t stolenSpans;         // arena从其他arena挪用空闲span的次数
+    size_t hugePageBytes;       // 没有页被归还、可由透明大页支撑的大页字节数, 只在整体统计中给出
+    size_t brokenHugePages;     // 部分页已归还而被拆散的大页数, 只在整体统计中给出
+};
+
 class PageCache {
 public:
-    static const size_t PAGE_SIZE = 4096;
+    static const size_t PAGE_SIZE = memoryPool::PAGE_SIZE;
+    // 实例构造在静态存储中且从不析构, 静态析构之后(其他全局对象的析构函数、atexit回调)释放内存时仍可使用
     static PageCache& getInstance() {
-        static PageCache instance;
-        return instance;
+        alignas(PageCache) static unsigned char storage[sizeof(PageCache)];
+        static PageCache* instance = new(storage) PageCache();
+        return *instance;
     }
 
-    // 分配指定页数的span
-    void* allocateSpan(size_t numPages);
+    // 在指定NUMA节点上分配指定页数的span, 并记录其切分的大小类
+    // arena按节点分组, 组内小对象span按大小类分配arena, 大对象按线程分配arena
+    // zeroed不为空时返回span的内容是否全为0, 为true时调用方无需再清零
+    void* allocateSpan(size_t numPages, size_t sizeClass = NO_SIZE_CLASS, size_t node = CURRENT_NODE,
+                       bool* zeroed = nullptr);
 
-    // 释放span
-    void deallocateSpan(void* ptr, size_t numPages);
+    // 分配起始地址对齐到alignPages页的大对象span, 多申请的首尾页交还arena
+    void* allocateAlignedSpan(size_t numPages, size_t alignPages, size_t node = CURRENT_NODE);
 
-private:
-    PageCache() = default;
+    // 释放ptr起始的span, 交还给其所属的arena; 大小由页映射查出, 不是span起始地址时忽略
+    void deallocateSpan(void* ptr);
+
+    // 把使用中的大对象span调整为newPages页: 缩小时尾部交还arena, 扩展时吞并后面相邻的空闲span
+    // 都不行时大span用mremap把页搬到新span(moved为true), 返回新地址; 失败返回nullptr, 原span不变
+    void* resizeSpan(void* ptr, size_t newPages, bool& moved);
+
+    // 无锁查询指针所在的span, 不是PageCache分配的内存返回nullptr
+    Span* getSpan(const void* ptr) const {
+        return spanMap_.get(reinterpret_cast<uintptr_t>(ptr) >> PAGE_SHIFT);
+    }
+
+    // 无锁查询指针所属的大小类
+    size_t getSizeClass(const void* ptr) const {
+        Span* span = getSpan(ptr);
+        return span ? span->sizeClass : NO_SIZE_CLASS;
+    }
+
+    // 立即归还最多maxBytes字节的空闲页, 不考虑保留目标, 返回实际归还的字节数
+    size_t releaseFreeSpans(size_t maxBytes);
+
+    // 回收器配置及后台线程
+    void setScavengerConfig(const ScavengerConfig& config);
+    ScavengerConfig getScavengerConfig();
+    void startScavenger();
+    void stopScavenger();
+
+    // 使用的arena个数, 默认等于CPU数(不超过MAX_ARENAS), 多个NUMA节点时平均分给各节点, 每个节点至少一个
+    // 修改只影响之后的分配, 已分配的span仍归原arena管理
+    void setNumArenas(size_t numArenas);
+    size_t getNumArenas() const { return numArenas_.load(std::memory_order_relaxed); }
+
+    PageHeapStats getStats();
+    // 单个arena的统计
+    PageHeapStats getArenaStats(size_t arena);
 
-    // 向系统申请内存
-    void* systemAlloc(size_t numPages);
+    // fork前按固定顺序取得全部arena锁、配置锁和元数据分配器的锁, fork后在父子进程中释放
+    // 子进程中没有后台回收线程, 线程状态重置为未启动
+    void prepareFork();
+    void afterFork(bool child);
 
 private:
-    // 内存块, 管理多张页
-    struct Span {
-        void* pageAddr;   // 页起始地址
-        size_t numPages;  // 页数
-        Span* next;       // 链表指针
+    // 按页数索引的空闲span链表, 节点不经过malloc分配
+    using SpanMap = std::map<size_t, Span*, std::less<size_t>, MetadataAllocator<std::pair<const size_t, Span*>>>;
+
+    // 独立加锁的页堆, 管理自己向系统申请的内存和挪用来的span
+    struct Arena {
+        std::mutex mutex;
+        // 按页数管理空闲span，不同页数对应不同span链表
+        SpanMap freeSpans;
+        // 已归还给系统的空闲span, 仅在freeSpans无法满足时复用
+        SpanMap releasedSpans;
+
+        size_t freesSinceScavenge = 0;
+        size_t scavengeEpoch = 0;
+        size_t mappedBytes = 0;
+        size_t totalReleasedBytes = 0;
+        size_t stolenSpans = 0;
+        // 空闲字节数, 持锁修改, 不加锁读取用于判断总量是否超出保留目标和跳过没有空闲span的arena
+        std::atomic<size_t> freeBytes{0};
+        std::atomic<size_t> releasedBytes{0};
     };
 
-    // 按页数管理空闲span，不同页数对应不同span链表
-    std::map<size_t, Span*> freeSpans_;
-    // 分配内存地址 pageAddr 到span的映射，用于回收
-    std::map<void*, Span*> spanMap_;
-    std::mutex mutex_;
+    PageCache();
+
+    // 每个NUMA节点分到的arena数, 节点node使用 [node * n, (node + 1) * n) 的arena
+    size_t arenasPerNode() const;
+    // 选择本次分配使用的arena
+    size_t arenaFor(size_t sizeClass, size_t node);
+
+    // 在arena中查找并摘下至少numPages页的空闲span, 多余部分留在该arena, 调用方需持有arena锁
+    Span* takeFreeSpan(Arena& arena, size_t arenaIndex, size_t numPages);
+    // 从同一节点的其他arena挪用空闲span, 调用方不能持有任何arena锁
+    Span* stealSpan(size_t self, size_t node, size_t numPages);
+
+    // 把span从第numPages页处一分为二, 返回后半部分, 调用方需持有arena锁
+    Span* splitSpan(size_t arenaIndex, Span* span, size_t numPages);
+
+    // 向系统申请按大页对齐的区域, 建议内核用透明大页支撑, 并在第一次访问前绑定到节点
+    // 不访问新内存: 内核提供的页本来就是0, 第一次访问时才占用物理内存
+    void* systemAlloc(size_t numPages, size_t node);
+    // 为新区域的每个大页登记状态
+    bool registerHugePages(void* memory, size_t numPages);
+    // span的页被归还或重新使用时更新所在大页的状态
+    void updateHugePages(const void* addr, size_t numPages, bool released);
+
+    // 空闲链表的插入和摘除, 插入时登记首尾页供合并时查找相邻span
+    void insertFreeSpan(Arena& arena, Span* span);
+    void removeFreeSpan(Arena& arena, Span* span);
+    // 从使用中的span上切下的页交还arena, 调用方需持有arena锁
+    void freeTrimmedSpan(Arena& arena, size_t arenaIndex, Span* span);
+    // 在arena锁内原地缩小或扩展span, 不能原地扩展时返回false
+    bool resizeInPlace(Arena& arena, size_t arenaIndex, Span* span, size_t newPages);
+    // 用mremap把span的页搬到新span, 原地址重新映射后作为已归还的span交还
+    void* remapSpan(Span* span, size_t newPages);
+
+    // 与同一arena中状态相同(是否已归还)的相邻空闲span合并后插入空闲链表
+    void mergeFreeSpan(Arena& arena, size_t arenaIndex, Span* span);
+
+    // 在一个arena上执行一轮回收, 只归还上一轮之前就已空闲的span, 调用方需持有arena锁
+    // 优先归还包含完整大页的span中按大页对齐的部分, 没有这样的span时才会拆散大页
+    size_t scavenge(Arena& arena, size_t arenaIndex, const ScavengerConfig& config, size_t maxBytes, bool onlyIdle);
+    void releaseSpan(Span* span, const ScavengerConfig& config);
+    void scavengerLoop();
+
+    // 所有arena空闲且驻留的字节数之和
+    size_t totalFreeBytes() const;
+
+    static size_t hugePageIdOf(const void* ptr) {
+        return reinterpret_cast<uintptr_t>(ptr) >> HUGE_PAGE_SHIFT;
+    }
+
+    SpanMap& freeListOf(Arena& arena, const Span* span) {
+        return span->isReleased ? arena.releasedSpans : arena.freeSpans;
+    }
+
+    static size_t pageIdOf(const void* ptr) {
+        return reinterpret_cast<uintptr_t>(ptr) >> PAGE_SHIFT;
+    }
+
+private:
+    std::array<Arena, MAX_ARENAS> arenas_;
+    std::atomic<size_t> numArenas_{1};
+    // 大对象按线程轮流分配arena
+    std::atomic<size_t> nextThreadArena_{0};
+
+    // 页号到span的映射: 使用中的span登记全部页, 空闲span只登记首尾页
+    PageMap<Span> spanMap_;
+    // span元数据, 释放后内存仍可读, 合并时读到其他arena已回收的span也是安全的
+    FixedAllocator<Span> spanAllocator_;
+
+    // 大页号到大页状态的映射, 区域从不归还系统, 状态登记后一直有效
+    PageMap<HugePage> hugePageMap_;
+    FixedAllocator<HugePage> hugePageAllocator_;
+    std::atomic<size_t> intactHugePages_{0};
+    std::atomic<size_t> brokenHugePages_{0};
+
+    // 回收器配置及后台线程状态, 受configMutex_保护
+    std::mutex configMutex_;
+    ScavengerConfig config_;
+    // 按释放次数触发回收的间隔, 释放路径上不加锁读取
+    std::atomic<size_t> releaseInterval_{ScavengerConfig().releaseInterval};
+    std::atomic<size_t> scavengeRounds_{0};
+
+    // 后台回收线程
+    std::thread scavengerThread_;
+    std::condition_variable scavengerCond_;
+    bool scavengerRunning_ = false;
 };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,109 @@
+#pragma once
+#include "Common.h"
+#include <sys/mman.h>
+
+namespace memoryPool {
+
+// 三层基数树, 记录页号到元数据(Span)的映射, 覆盖48位地址空间
+// 36位页号按 12 / 12 / 12 位拆成根、中间层和叶子三级, 每级节点32KB, 按需用mmap分配
+// ensure可并发调用; set只要求同一页的写入互斥, 由拥有该页的arena加锁保证; 读取(get)不加锁
+template <typename T>
+class PageMap {
+public:
+    static constexpr size_t ADDRESS_BITS = 48;
+    static constexpr size_t PAGE_BITS = ADDRESS_BITS - PAGE_SHIFT;
+    static constexpr size_t LEAF_BITS = 12;
+    static constexpr size_t MID_BITS = 12;
+    static constexpr size_t ROOT_BITS = PAGE_BITS - LEAF_BITS - MID_BITS;
+
+    static constexpr size_t LEAF_LENGTH = size_t(1) << LEAF_BITS;
+    static constexpr size_t MID_LENGTH = size_t(1) << MID_BITS;
+    static constexpr size_t ROOT_LENGTH = size_t(1) << ROOT_BITS;
+
+    PageMap() {
+        for(auto& node : root_) {
+            node.store(nullptr, std::memory_order_relaxed);
+        }
+    }
+
+    // 无锁查询, 未登记的页返回nullptr
+    T* get(size_t pageId) const {
+        if(pageId >> PAGE_BITS) return nullptr;
+
+        MidNode* mid = root_[pageId >> (LEAF_BITS + MID_BITS)].load(std::memory_order_acquire);
+        if(!mid) return nullptr;
+
+        LeafNode* leaf = mid->leaves[(pageId >> LEAF_BITS) & (MID_LENGTH - 1)].load(std::memory_order_acquire);
+        if(!leaf) return nullptr;
+
+        return leaf->values[pageId & (LEAF_LENGTH - 1)].load(std::memory_order_acquire);
+    }
+
+    // 确保 [start, start + numPages) 对应的节点都已分配
+    // 多个线程可以同时调用, 新节点通过CAS挂上, 竞争失败的一方归还自己的节点
+    bool ensure(size_t start, size_t numPages) {
+        size_t end = start + numPages;
+        if(numPages == 0 || (end - 1) >> PAGE_BITS) return false;
+
+        for(size_t key = start; key < end; ) {
+            auto& midSlot = root_[key >> (LEAF_BITS + MID_BITS)];
+            MidNode* mid = midSlot.load(std::memory_order_acquire);
+            if(!mid) {
+                mid = installNode(midSlot);
+                if(!mid) return false;
+            }
+
+            auto& leafSlot = mid->leaves[(key >> LEAF_BITS) & (MID_LENGTH - 1)];
+            if(!leafSlot.load(std::memory_order_acquire)) {
+                if(!installNode(leafSlot)) return false;
+            }
+
+            // 跳到下一个叶子节点覆盖的起始页
+            key = ((key >> LEAF_BITS) + 1) << LEAF_BITS;
+        }
+        return true;
+    }
+
+    // 登记单页, 调用前必须已对该页调用过ensure
+    void set(size_t pageId, T* value) {
+        MidNode* mid = root_[pageId >> (LEAF_BITS + MID_BITS)].load(std::memory_order_acquire);
+        LeafNode* leaf = mid->leaves[(pageId >> LEAF_BITS) & (MID_LENGTH - 1)].load(std::memory_order_acquire);
+        leaf->values[pageId & (LEAF_LENGTH - 1)].store(value, std::memory_order_release);
+    }
+
+    // 登记连续多页
+    void setRange(size_t start, size_t numPages, T* value) {
+        for(size_t i = 0; i < numPages; ++i) {
+            set(start + i, value);
+        }
+    }
+
+private:
+    struct LeafNode {
+        std::atomic<T*> values[LEAF_LENGTH];
+    };
+
+    struct MidNode {
+        std::atomic<LeafNode*> leaves[MID_LENGTH];
+    };
+
+    // 节点直接向系统申请, mmap返回的内存已清零, 且不会经过malloc
+    template <typename Node>
+    static Node* installNode(std::atomic<Node*>& slot) {
+        void* ptr = mmap(nullptr, sizeof(Node), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(ptr == MAP_FAILED) return nullptr;
+
+        Node* expected = nullptr;
+        Node* node = static_cast<Node*>(ptr);
+        if(!slot.compare_exchange_strong(expected, node, std::memory_order_acq_rel, std::memory_order_acquire)) {
+            munmap(ptr, sizeof(Node));
+            return expected;
+        }
+        return node;
+    }
+
+private:
+    std::atomic<MidNode*> root_[ROOT_LENGTH];
+};
+
+}
@@ -1,10 +1,24 @@
 #include "MemoryPool.h"
+#include "PageCache.h"
+#include "CentralCache.h"
+#include "CpuCache.h"
+#include "LargeCache.h"
+#include "PoolAllocator.h"
 #include <iostream>
 #include <vector>
 #include <chrono>
 #include <random>
 #include <iomanip>
 #include <thread>
+#include <map>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <unistd.h>
 
 using namespace std::chrono;
 using namespace memoryPool;
@@ -32,6 +46,32 @@ private:
         size_t totalBytes{0};
     };
 
+    // 防止基准测试中的查询结果被编译器优化掉
+    static inline volatile size_t sink_ = 0;
+
+    // 输出每百万次操作触发的中心缓存调用次数, 括号内为整批经过传输缓存的次数
+    static void printCentralCalls(const CentralCacheStats& before, size_t numOps)
+    {
+        CentralCacheStats after = CentralCache::getInstance().getStats();
+        double scale = 1000000.0 / numOps;
+        std::cout << "  central calls per 1M ops: fetchRange " << std::fixed << std::setprecision(1)
+                  << (after.fetchCount - before.fetchCount) * scale << " (transfer "
+                  << (after.transferFetchCount - before.transferFetchCount) * scale << "), returnRange "
+                  << (after.returnCount - before.returnCount) * scale << " (transfer "
+                  << (after.transferReturnCount - before.transferReturnCount) * scale << ")" << std::endl;
+    }
+
+    // 当前进程的常驻内存(RSS)字节数
+    static size_t currentRss()
+    {
+        size_t totalPages = 0, residentPages = 0;
+        FILE* file = fopen("/proc/self/statm", "r");
+        if (!file) return 0;
+        if (fscanf(file, "%zu %zu", &totalPages, &residentPages) != 2) residentPages = 0;
+        fclose(file);
+        return residentPages * sysconf(_SC_PAGESIZE);
+    }
+
 public:
     // 1. 系统预热
     static void warmup() {
@@ -64,6 +104,7 @@ public:
 
         // 测试内存池
         {
+            CentralCacheStats before = CentralCache::getInstance().getStats();
             Timer t;
             std::vector<void*> ptrs;
             ptrs.reserve(NUM_ALLOCS);
@@ -84,6 +125,7 @@ public:
 
             std::cout << "Memory Pool: " << std::fixed << std::setprecision(3)
                         << t.elapsed() << " ms" << std::endl;
+            printCentralCalls(before, NUM_ALLOCS * 2);
         }
 
         // 测试 new/delete
@@ -169,6 +211,7 @@ public:
         
         // 测试内存池
         {
+            CentralCacheStats before = CentralCache::getInstance().getStats();
             Timer t;
             std::vector<std::thread> threads;
             
@@ -184,6 +227,7 @@ public:
             
             std::cout << "Memory Pool: " << std::fixed << std::setprecision(3) 
                       << t.elapsed() << " ms" << std::endl;
+            printCentralCalls(before, NUM_THREADS * ALLOCS_PER_THREAD * 2);
         }
         
         // 测试new/delete
@@ -217,6 +261,7 @@ public:
         
         // 测试内存池
         {
+            CentralCacheStats before = CentralCache::getInstance().getStats();
             Timer t;
             std::vector<std::pair<void*, size_t>> ptrs;
             ptrs.reserve(NUM_ALLOCS);
@@ -246,6 +291,7 @@ public:
             
             std::cout << "Memory Pool: " << std::fixed << std::setprecision(3) 
                       << t.elapsed() << " ms" << std::endl;
+            printCentralCalls(before, NUM_ALLOCS * 2);
         }
         
         // 测试new/delete
@@ -280,12 +326,812 @@ public:
                       << t.elapsed() << " ms" << std::endl;
         }
     }
+
+    // 5. span映射结构测试: std::map 与基数树在span反复分配释放下的对比
+    static void testSpanMapChurn() 
+    {
+        constexpr size_t NUM_SLOTS = 4096;
+        constexpr size_t SLOT_PAGES = 64;
+        constexpr size_t NUM_OPS = 1000000;
+        constexpr size_t BASE_PAGE = 0x7f0000000;
+
+        std::cout << "\nTesting span map churn (" << NUM_OPS << " ops over " 
+                  << NUM_SLOTS << " live spans):" << std::endl;
+
+        // 每个槽位放一个span, 页数取自大小类表, 模拟CentralCache申请的span
+        std::mt19937 gen(42);
+        std::uniform_int_distribution<size_t> slotDis(0, NUM_SLOTS - 1);
+        std::uniform_int_distribution<size_t> classDis(0, FREE_LIST_SIZE - 1);
+        std::vector<Span> spans(NUM_SLOTS);
+        std::vector<size_t> slotOps(NUM_OPS), pageOps(NUM_OPS);
+        for (size_t i = 0; i < NUM_OPS; ++i) 
+        {
+            slotOps[i] = slotDis(gen);
+            pageOps[i] = SizeClass::classPages(classDis(gen));
+        }
+
+        auto slotAddr = [](size_t slot) 
+        {
+            return reinterpret_cast<void*>((BASE_PAGE + slot * SLOT_PAGES) << PAGE_SHIFT);
+        };
+        auto resetSpans = [&]() 
+        {
+            for (size_t i = 0; i < NUM_SLOTS; ++i) 
+            {
+                spans[i].pageAddr = slotAddr(i);
+                spans[i].numPages = 1;
+            }
+        };
+
+        // 旧实现: 全局锁 + std::map, 释放时查找自身和后一个相邻span
+        {
+            resetSpans();
+            std::mutex mutex;
+            std::map<void*, Span*> spanMap;
+            for (size_t i = 0; i < NUM_SLOTS; ++i) 
+            {
+                spanMap[spans[i].pageAddr] = &spans[i];
+            }
+
+            Timer t;
+            for (size_t i = 0; i < NUM_OPS; ++i) 
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                Span& span = spans[slotOps[i]];
+                auto it = spanMap.find(span.pageAddr);
+                auto nextIt = spanMap.find(static_cast<char*>(span.pageAddr) + span.numPages * PAGE_SIZE);
+                sink_ += (it != spanMap.end()) + (nextIt != spanMap.end());
+                spanMap.erase(it);
+
+                span.numPages = pageOps[i];
+                spanMap[span.pageAddr] = &span;
+            }
+            std::cout << "std::map:   " << std::fixed << std::setprecision(3) 
+                      << t.elapsed() << " ms" << std::endl;
+        }
+
+        // 新实现: 基数树, 使用中的span登记全部页, 释放后只保留首尾页
+        {
+            resetSpans();
+            std::mutex mutex;
+            static PageMap<Span> pageMap;
+            pageMap.ensure(BASE_PAGE, NUM_SLOTS * SLOT_PAGES);
+            for (size_t i = 0; i < NUM_SLOTS; ++i) 
+            {
+                pageMap.set(BASE_PAGE + i * SLOT_PAGES, &spans[i]);
+            }
+
+            Timer t;
+            for (size_t i = 0; i < NUM_OPS; ++i) 
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                Span& span = spans[slotOps[i]];
+                size_t pageId = reinterpret_cast<uintptr_t>(span.pageAddr) >> PAGE_SHIFT;
+                sink_ += (pageMap.get(pageId) != nullptr) + (pageMap.get(pageId + span.numPages) != nullptr);
+                pageMap.set(pageId, nullptr);
+                pageMap.set(pageId + span.numPages - 1, nullptr);
+
+                span.numPages = pageOps[i];
+                pageMap.setRange(pageId, span.numPages, &span);
+            }
+            std::cout << "Radix map:  " << std::fixed << std::setprecision(3) 
+                      << t.elapsed() << " ms" << std::endl;
+        }
+
+        // 真实PageCache上的span申请释放
+        {
+            std::vector<std::pair<void*, size_t>> live(NUM_SLOTS, {nullptr, 0});
+            Timer t;
+            for (size_t i = 0; i < NUM_OPS; ++i) 
+            {
+                auto& [ptr, pages] = live[slotOps[i]];
+                if (ptr) 
+                {
+                    PageCache::getInstance().deallocateSpan(ptr);
+                }
+                pages = pageOps[i];
+                ptr = PageCache::getInstance().allocateSpan(pages);
+            }
+            for (auto& [ptr, pages] : live) 
+            {
+                if (ptr) 
+                {
+                    PageCache::getInstance().deallocateSpan(ptr);
+                }
+            }
+            std::cout << "PageCache:  " << std::fixed << std::setprecision(3) 
+                      << t.elapsed() << " ms" << std::endl;
+        }
+    }
+
+    // 6. 线程数超过CPU数时两种前端缓存的对比
+    static void testOversubscribedFrontEnds() 
+    {
+        const size_t NUM_THREADS = 4 * std::max(1u, std::thread::hardware_concurrency());
+        constexpr size_t OPS_PER_THREAD = 50000;
+        constexpr size_t LIVE_OBJECTS = 256;
+
+        std::cout << "\nTesting front ends with " << NUM_THREADS << " threads (4x oversubscribed, "
+                  << OPS_PER_THREAD << " ops each):" << std::endl;
+
+        if (!CpuCache::isSupported()) 
+        {
+            std::cout << "rseq unavailable, per-CPU front end skipped" << std::endl;
+            return;
+        }
+
+        auto runFrontEnd = [&](FrontEnd frontEnd, const char* name) 
+        {
+            MemoryPool::setFrontEnd(frontEnd);
+            std::atomic<size_t> finished{0};
+            std::atomic<bool> release{false};
+
+            // 每个线程保持一定数量的存活对象并随机替换, 完成后保持存活以便统计缓存占用
+            auto threadFunc = [&](size_t id) 
+            {
+                std::mt19937 gen(static_cast<unsigned>(id));
+                std::uniform_int_distribution<size_t> sizeDis(8, 1024);
+                std::vector<std::pair<void*, size_t>> live(LIVE_OBJECTS, {nullptr, 0});
+                for (size_t i = 0; i < OPS_PER_THREAD; ++i) 
+                {
+                    auto& slot = live[gen() % LIVE_OBJECTS];
+                    if (slot.first) 
+                    {
+                        MemoryPool::deallocate(slot.first, slot.second);
+                    }
+                    slot.second = sizeDis(gen);
+                    slot.first = MemoryPool::allocate(slot.second);
+                }
+                for (auto& [ptr, size] : live) 
+                {
+                    MemoryPool::deallocate(ptr, size);
+                }
+
+                finished.fetch_add(1);
+                while (!release.load()) 
+                {
+                    std::this_thread::yield();
+                }
+            };
+
+            size_t baseCached = frontEnd == FrontEnd::PerCpu ? CpuCache::getInstance().getCachedBytes()
+                                                             : ThreadCache::getTotalCachedBytes();
+            Timer t;
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < NUM_THREADS; ++i) 
+            {
+                threads.emplace_back(threadFunc, i + 1);
+            }
+            while (finished.load() < NUM_THREADS) 
+            {
+                std::this_thread::yield();
+            }
+            double elapsed = t.elapsed();
+
+            size_t cached = frontEnd == FrontEnd::PerCpu ? CpuCache::getInstance().getCachedBytes()
+                                                         : ThreadCache::getTotalCachedBytes();
+            release = true;
+            for (auto& thread : threads) 
+            {
+                thread.join();
+            }
+
+            std::cout << name << std::fixed << std::setprecision(3) << elapsed << " ms, cached "
+                      << (cached - std::min(cached, baseCached)) / 1024 << " KB" << std::endl;
+        };
+
+        runFrontEnd(FrontEnd::PerThread, "Per-thread: ");
+        runFrontEnd(FrontEnd::PerCpu, "Per-CPU:    ");
+        MemoryPool::setFrontEnd(FrontEnd::PerThread);
+    }
+
+    // 7. 多线程争用同一大小类的中心缓存锁
+    static void testLockContention() 
+    {
+        constexpr size_t TOTAL_OPS = 128000;
+        constexpr size_t OBJECT_SIZE = 64;
+        const size_t index = SizeClass::getIndex(OBJECT_SIZE);
+        const size_t batch = SizeClass::batchNum(index);
+
+        std::cout << "\nTesting central cache lock contention (" << TOTAL_OPS
+                  << " fetch/return pairs on the " << OBJECT_SIZE << "-byte class):" << std::endl;
+
+        for (size_t numThreads : {2, 4, 8, 16, 32, 64}) 
+        {
+            const size_t opsPerThread = TOTAL_OPS / numThreads;
+            std::vector<std::vector<uint32_t>> latencies(numThreads);
+            LockStats before = CentralCache::getInstance().getLockStats(index);
+
+            // 每次从中心缓存取一批再原样归还, 记录每对操作的耗时
+            auto threadFunc = [&](size_t id) 
+            {
+                auto& samples = latencies[id];
+                samples.reserve(opsPerThread);
+                for (size_t i = 0; i < opsPerThread; ++i) 
+                {
+                    auto start = steady_clock::now();
+                    size_t count = batch;
+                    void* end = nullptr;
+                    void* head = CentralCache::getInstance().fetchRange(index, count, end);
+                    CentralCache::getInstance().returnRange(head, end, count, index);
+                    auto ns = duration_cast<nanoseconds>(steady_clock::now() - start).count();
+                    samples.push_back(static_cast<uint32_t>(std::min<int64_t>(ns, UINT32_MAX)));
+                }
+            };
+
+            Timer t;
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < numThreads; ++i) 
+            {
+                threads.emplace_back(threadFunc, i);
+            }
+            for (auto& thread : threads) 
+            {
+                thread.join();
+            }
+            double elapsed = t.elapsed();
+
+            std::vector<uint32_t> all;
+            for (auto& samples : latencies) 
+            {
+                all.insert(all.end(), samples.begin(), samples.end());
+            }
+            std::sort(all.begin(), all.end());
+            auto percentile = [&](double p) 
+            {
+                return all[std::min(all.size() - 1, static_cast<size_t>(p * all.size()))];
+            };
+
+            LockStats after = CentralCache::getInstance().getLockStats(index);
+            size_t acquisitions = after.acquisitions - before.acquisitions;
+            size_t contended = after.contended - before.contended;
+            std::cout << std::setw(2) << numThreads << " threads: " << std::fixed << std::setprecision(3)
+                      << elapsed << " ms, p50 " << percentile(0.5) << " ns, p99 " << percentile(0.99)
+                      << " ns, p99.9 " << percentile(0.999) << " ns, max " << all.back() << " ns, contended "
+                      << std::setprecision(2) << 100.0 * contended / std::max<size_t>(acquisitions, 1) << "%, wait "
+                      << (after.waitNanos - before.waitNanos) / 1000 << " us" << std::endl;
+        }
+    }
+
+    // 8. 每个线程使用不同大小类时中心缓存的扩展性
+    static void testPerClassScaling() 
+    {
+        constexpr size_t OPS_PER_THREAD = 50000;
+
+        std::cout << "\nTesting central cache scaling with one size class per thread ("
+                  << OPS_PER_THREAD << " fetch/return pairs each):" << std::endl;
+
+        double baseRate = 0;
+        for (size_t numThreads : {1, 2, 4, 8, 16}) 
+        {
+            // 线程i使用第i个小对象大小类, 各自的锁和链表互不相干
+            auto threadFunc = [](size_t index) 
+            {
+                const size_t batch = SizeClass::batchNum(index);
+                for (size_t i = 0; i < OPS_PER_THREAD; ++i) 
+                {
+                    size_t count = batch;
+                    void* end = nullptr;
+                    void* head = CentralCache::getInstance().fetchRange(index, count, end);
+                    CentralCache::getInstance().returnRange(head, end, count, index);
+                }
+            };
+
+            Timer t;
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < numThreads; ++i) 
+            {
+                threads.emplace_back(threadFunc, i + 1);
+            }
+            for (auto& thread : threads) 
+            {
+                thread.join();
+            }
+            double elapsed = t.elapsed();
+
+            // 每毫秒完成的操作对数, 以单线程为基准计算扩展倍数
+            double rate = numThreads * OPS_PER_THREAD / elapsed;
+            if (numThreads == 1) 
+            {
+                baseRate = rate;
+            }
+            std::cout << std::setw(2) << numThreads << " threads: " << std::fixed << std::setprecision(3)
+                      << elapsed << " ms, " << std::setprecision(1) << rate / 1000 << " M pairs/s, scaling "
+                      << std::setprecision(2) << rate / baseRate << "x" << std::endl;
+        }
+    }
+
+    // 9. 随机访问大量小节点, TLB缺失占主导时透明大页的效果
+    static void testRandomNodeAccess() 
+    {
+        struct Node 
+        {
+            Node* next;
+            size_t payload[7];
+        };
+        constexpr size_t NUM_NODES = 1 << 20;
+        constexpr size_t NUM_HOPS = 1 << 23;
+
+        std::cout << "\nTesting random access over " << NUM_NODES << " nodes of " << sizeof(Node)
+                  << " bytes (" << NUM_HOPS << " hops):" << std::endl;
+
+        // 按随机顺序把节点串成环, 沿环跳转时相邻两次访问几乎总落在不同的页上
+        auto chase = [](std::vector<Node*>& nodes) 
+        {
+            std::mt19937 gen(42);
+            std::shuffle(nodes.begin(), nodes.end(), gen);
+            for (size_t i = 0; i < nodes.size(); ++i) 
+            {
+                nodes[i]->next = nodes[(i + 1) % nodes.size()];
+            }
+
+            Timer t;
+            Node* node = nodes[0];
+            for (size_t i = 0; i < NUM_HOPS; ++i) 
+            {
+                node = node->next;
+            }
+            sink_ = reinterpret_cast<uintptr_t>(node);
+            return t.elapsed();
+        };
+
+        std::vector<Node*> nodes(NUM_NODES);
+        for (auto& node : nodes) 
+        {
+            node = static_cast<Node*>(MemoryPool::allocate(sizeof(Node)));
+        }
+        double poolTime = chase(nodes);
+
+        // 大页覆盖率: 完整大页占驻留页的比例
+        PageHeapStats stats = PageCache::getInstance().getStats();
+        double resident = static_cast<double>(stats.mappedBytes - stats.releasedBytes);
+        std::cout << "  huge page coverage " << std::fixed << std::setprecision(1)
+                  << stats.hugePageBytes * 100.0 / resident << "% (" << stats.hugePageBytes / 1024 / 1024
+                  << " MB intact, " << stats.brokenHugePages << " broken)" << std::endl;
+
+        for (Node* node : nodes) 
+        {
+            MemoryPool::deallocate(node, sizeof(Node));
+        }
+
+        for (auto& node : nodes) 
+        {
+            node = new Node;
+        }
+        double newTime = chase(nodes);
+        for (Node* node : nodes) 
+        {
+            delete node;
+        }
+
+        std::cout << "Memory Pool: " << std::setprecision(3) << poolTime << " ms, "
+                  << poolTime * 1000000 / NUM_HOPS << " ns/hop" << std::endl;
+        std::cout << "New/Delete:  " << newTime << " ms, " << newTime * 1000000 / NUM_HOPS << " ns/hop" << std::endl;
+    }
+
+    // 10. 1~16MB缓冲区反复申请释放, 以及倍增扩展的realloc
+    static void testLargeBufferChurn() 
+    {
+        constexpr size_t NUM_ROUNDS = 2000;
+        constexpr size_t MB = 1024 * 1024;
+
+        std::cout << "\nTesting large buffer churn (" << NUM_ROUNDS << " buffers of 1-16 MB):" << std::endl;
+
+        // 每轮申请一个随机大小的缓冲区, 写入开头一页和结尾后释放
+        std::mt19937 gen(42);
+        std::vector<size_t> sizes(NUM_ROUNDS);
+        for (auto& size : sizes) 
+        {
+            size = MB + gen() % (15 * MB);
+        }
+
+        // 先各跑一遍, 只统计稳定状态下的开销
+        auto poolChurn = [&sizes]() 
+        {
+            for (size_t size : sizes) 
+            {
+                char* ptr = static_cast<char*>(MemoryPool::allocate(size));
+                memset(ptr, 1, PAGE_SIZE);
+                ptr[size - 1] = 1;
+                MemoryPool::deallocate(ptr, size);
+            }
+        };
+        auto mallocChurn = [&sizes]() 
+        {
+            for (size_t size : sizes) 
+            {
+                char* ptr = static_cast<char*>(malloc(size));
+                memset(ptr, 1, PAGE_SIZE);
+                ptr[size - 1] = 1;
+                sink_ = reinterpret_cast<uintptr_t>(ptr);
+                free(ptr);
+            }
+        };
+        poolChurn();
+        mallocChurn();
+
+        LargeCacheStats before = LargeCache::getInstance().getStats();
+        Timer t1;
+        poolChurn();
+        double poolTime = t1.elapsed();
+        LargeCacheStats after = LargeCache::getInstance().getStats();
+
+        Timer t2;
+        mallocChurn();
+        double mallocTime = t2.elapsed();
+
+        size_t hits = after.cacheHits - before.cacheHits;
+        size_t misses = after.cacheMisses - before.cacheMisses;
+        std::cout << "Memory Pool: " << std::fixed << std::setprecision(3) << poolTime << " ms (cache hit rate "
+                  << std::setprecision(1) << hits * 100.0 / (hits + misses) << "%)" << std::endl;
+        std::cout << "Malloc/Free: " << std::setprecision(3) << mallocTime << " ms" << std::endl;
+
+        // 从1MB倍增到64MB, 每次扩展后写满新增部分
+        constexpr size_t NUM_GROWS = 20;
+        auto grow = [](auto&& reallocate) 
+        {
+            Timer t;
+            for (size_t round = 0; round < NUM_GROWS; ++round) 
+            {
+                size_t size = MB;
+                char* ptr = static_cast<char*>(reallocate(nullptr, 0, size));
+                memset(ptr, 2, size);
+                while (size < 64 * MB) 
+                {
+                    ptr = static_cast<char*>(reallocate(ptr, size, size * 2));
+                    memset(ptr + size, 2, size);
+                    size *= 2;
+                }
+                reallocate(ptr, size, 0);
+            }
+            return t.elapsed();
+        };
+
+        before = LargeCache::getInstance().getStats();
+        double poolGrow = grow([](void* ptr, size_t, size_t newSize) -> void* 
+        {
+            if (!ptr) return MemoryPool::allocate(newSize);
+            if (newSize == 0) 
+            {
+                MemoryPool::deallocate(ptr);
+                return nullptr;
+            }
+            return LargeCache::getInstance().reallocate(ptr, newSize);
+        });
+        after = LargeCache::getInstance().getStats();
+        double mallocGrow = grow([](void* ptr, size_t, size_t newSize) -> void* 
+        {
+            if (newSize == 0) 
+            {
+                free(ptr);
+                return nullptr;
+            }
+            return realloc(ptr, newSize);
+        });
+
+        std::cout << "Grow 1 MB -> 64 MB x" << NUM_GROWS << ": Memory Pool " << std::setprecision(3) << poolGrow
+                  << " ms (in place " << after.resizedInPlace - before.resizedInPlace << ", remapped "
+                  << after.remapped - before.remapped << ", copied " << after.copied - before.copied
+                  << "), realloc " << mallocGrow << " ms" << std::endl;
+    }
+
+    // 11. 类似vector的容量增长: reallocate与手动申请复制释放、系统realloc的对比
+    static void testVectorGrowth() 
+    {
+        std::cout << "\nTesting vector-like growth:" << std::endl;
+
+        // 容量从16字节按factor增长到maxBytes, 每次扩展后写满新增部分
+        auto grow = [](size_t maxBytes, double factor, size_t rounds, auto&& reallocate) 
+        {
+            Timer t;
+            for (size_t round = 0; round < rounds; ++round) 
+            {
+                size_t capacity = 16;
+                char* data = static_cast<char*>(reallocate(nullptr, 0, capacity));
+                memset(data, 1, capacity);
+                while (capacity < maxBytes) 
+                {
+                    size_t newCapacity = std::max(capacity + 16, static_cast<size_t>(capacity * factor));
+                    data = static_cast<char*>(reallocate(data, capacity, newCapacity));
+                    memset(data + capacity, 1, newCapacity - capacity);
+                    capacity = newCapacity;
+                }
+                sink_ = data[capacity - 1];
+                reallocate(data, capacity, 0);
+            }
+            return t.elapsed();
+        };
+
+        auto poolRealloc = [](void* ptr, size_t oldSize, size_t newSize) 
+        {
+            return MemoryPool::reallocate(ptr, oldSize, newSize);
+        };
+        // 没有reallocate时的做法: 总是申请新内存、复制、释放旧内存
+        auto poolCopy = [](void* ptr, size_t oldSize, size_t newSize) -> void* 
+        {
+            if (newSize == 0) 
+            {
+                MemoryPool::deallocate(ptr, oldSize);
+                return nullptr;
+            }
+            void* newPtr = MemoryPool::allocate(newSize);
+            if (ptr) 
+            {
+                memcpy(newPtr, ptr, std::min(oldSize, newSize));
+                MemoryPool::deallocate(ptr, oldSize);
+            }
+            return newPtr;
+        };
+        auto systemRealloc = [](void* ptr, size_t, size_t newSize) -> void* 
+        {
+            if (newSize == 0) 
+            {
+                free(ptr);
+                return nullptr;
+            }
+            return realloc(ptr, newSize);
+        };
+
+        struct Case 
+        {
+            size_t maxBytes;
+            double factor;
+            size_t rounds;
+        };
+        for (const Case& c : {Case{64 * 1024, 1.5, 20000}, Case{64 * 1024, 2.0, 20000}, 
+                              Case{16 * 1024 * 1024, 1.5, 20}, Case{16 * 1024 * 1024, 2.0, 20}}) 
+        {
+            std::cout << "  to " << std::setw(5) << c.maxBytes / 1024 << " KB x" << std::fixed << std::setprecision(1)
+                      << c.factor << " (" << c.rounds << " rounds): reallocate " << std::setprecision(3)
+                      << grow(c.maxBytes, c.factor, c.rounds, poolRealloc) << " ms, allocate+copy "
+                      << grow(c.maxBytes, c.factor, c.rounds, poolCopy) << " ms, realloc "
+                      << grow(c.maxBytes, c.factor, c.rounds, systemRealloc) << " ms" << std::endl;
+        }
+    }
+
+    // 12. 冷启动: 新申请的内存不再立即清零, 首次访问时才产生缺页和常驻内存
+    // 需在其他测试之前运行, 保证内存都来自新申请的区域
+    static void testColdStart() 
+    {
+        constexpr size_t NUM_BLOCKS = 32;
+        constexpr size_t BLOCK_SIZE = 4 * 1024 * 1024;
+        constexpr size_t MB = 1024 * 1024;
+
+        std::cout << "Testing cold start (" << NUM_BLOCKS << " blocks of " << BLOCK_SIZE / MB << " MB):" << std::endl;
+
+        auto report = [](const char* name, double ms, size_t rssBefore) 
+        {
+            std::cout << "  " << std::left << std::setw(28) << name << std::right << std::fixed << std::setprecision(3)
+                      << std::setw(10) << ms << " ms, RSS +" << (currentRss() - rssBefore) / MB << " MB" << std::endl;
+        };
+
+        // 延迟清零: 申请只建立映射, 之后按需访问
+        std::vector<char*> lazy(NUM_BLOCKS);
+        size_t rss = currentRss();
+        Timer t1;
+        for (auto& block : lazy) 
+        {
+            block = static_cast<char*>(MemoryPool::allocate(BLOCK_SIZE));
+        }
+        report("allocate", t1.elapsed(), rss);
+
+        Timer t2;
+        for (char* block : lazy) 
+        {
+            for (size_t i = 0; i < BLOCK_SIZE; i += PAGE_SIZE) 
+            {
+                block[i] = 1;
+            }
+        }
+        report("first touch of every page", t2.elapsed(), rss);
+
+        // 原来的做法: 申请时立即清零整个区域
+        std::vector<char*> eager(NUM_BLOCKS);
+        rss = currentRss();
+        Timer t3;
+        for (auto& block : eager) 
+        {
+            block = static_cast<char*>(MemoryPool::allocate(BLOCK_SIZE));
+            memset(block, 0, BLOCK_SIZE);
+        }
+        report("allocate + eager memset", t3.elapsed(), rss);
+
+        for (size_t i = 0; i < NUM_BLOCKS; ++i) 
+        {
+            MemoryPool::deallocate(lazy[i], BLOCK_SIZE);
+            MemoryPool::deallocate(eager[i], BLOCK_SIZE);
+        }
+        std::cout << std::endl;
+    }
+
+    // 13. 批量分配: allocateBatch/deallocateBatch与逐个分配释放的对比
+    static void testBatchAllocation() 
+    {
+        constexpr size_t SIZE = 64;
+        constexpr size_t TOTAL_OBJECTS = 4 * 1024 * 1024;
+
+        std::cout << "\nTesting batch allocation (" << TOTAL_OBJECTS << " objects of " << SIZE << " bytes):" << std::endl;
+
+        for (size_t n : {size_t(8), size_t(64), size_t(1024)}) 
+        {
+            std::vector<void*> ptrs(n);
+            size_t rounds = TOTAL_OBJECTS / n;
+
+            Timer t1;
+            for (size_t round = 0; round < rounds; ++round) 
+            {
+                for (size_t i = 0; i < n; ++i) 
+                {
+                    ptrs[i] = MemoryPool::allocate(SIZE);
+                }
+                sink_ = reinterpret_cast<uintptr_t>(ptrs[n - 1]);
+                for (size_t i = 0; i < n; ++i) 
+                {
+                    MemoryPool::deallocate(ptrs[i], SIZE);
+                }
+            }
+            double single = t1.elapsed();
+
+            Timer t2;
+            for (size_t round = 0; round < rounds; ++round) 
+            {
+                MemoryPool::allocateBatch(SIZE, n, ptrs.data());
+                sink_ = reinterpret_cast<uintptr_t>(ptrs[n - 1]);
+                MemoryPool::deallocateBatch(SIZE, n, ptrs.data());
+            }
+            double batch = t2.elapsed();
+
+            std::cout << "  n = " << std::setw(4) << n << ": single " << std::fixed << std::setprecision(2)
+                      << single * 1e6 / TOTAL_OBJECTS << " ns/object, batch " << batch * 1e6 / TOTAL_OBJECTS
+                      << " ns/object" << std::endl;
+        }
+    }
+
+    // 14. 标准容器: std::allocator、PoolAllocator与使用PoolMemoryResource的pmr容器的对比
+    static void testContainers() 
+    {
+        constexpr size_t NUM_KEYS = 100000;
+        constexpr size_t ROUNDS = 10;
+
+        std::cout << "\nTesting containers (" << NUM_KEYS << " elements x " << ROUNDS << " rounds):" << std::endl;
+
+        std::vector<int> keys(NUM_KEYS);
+        for (size_t i = 0; i < NUM_KEYS; ++i) 
+        {
+            keys[i] = static_cast<int>(i);
+        }
+        std::shuffle(keys.begin(), keys.end(), std::mt19937(42));
+
+        // 随机插入全部键, 再按另一顺序逐个删除
+        auto mapChurn = [&keys](auto makeMap) 
+        {
+            Timer t;
+            for (size_t round = 0; round < ROUNDS; ++round) 
+            {
+                auto map = makeMap();
+                for (int key : keys) 
+                {
+                    map.emplace(key, key);
+                }
+                for (size_t i = keys.size(); i-- > 0;) 
+                {
+                    map.erase(keys[i]);
+                }
+                sink_ = map.size();
+            }
+            return t.elapsed();
+        };
+
+        // 在一个链表中逐个生成节点, 分段splice到另一个链表, 最后整体销毁
+        auto listSplice = [](auto makeList) 
+        {
+            Timer t;
+            for (size_t round = 0; round < ROUNDS; ++round) 
+            {
+                auto source = makeList();
+                auto target = makeList();
+                for (size_t i = 0; i < NUM_KEYS; ++i) 
+                {
+                    source.push_back(static_cast<int>(i));
+                    if (source.size() == 64) 
+                    {
+                        target.splice(target.end(), source);
+                    }
+                }
+                target.splice(target.begin(), source);
+                sink_ = target.size();
+            }
+            return t.elapsed();
+        };
+
+        PoolMemoryResource& resource = PoolMemoryResource::getInstance();
+        using PoolPair = PoolAllocator<std::pair<const int, int>>;
+
+        auto report = [](const char* name, double stdTime, double poolTime, double pmrTime) 
+        {
+            std::cout << "  " << std::left << std::setw(25) << name << std::right << std::fixed << std::setprecision(3)
+                      << "std::allocator " << std::setw(8) << stdTime << " ms, PoolAllocator " << std::setw(8) << poolTime
+                      << " ms, pmr " << std::setw(8) << pmrTime << " ms" << std::endl;
+        };
+
+        report("map insert/erase",
+               mapChurn([] { return std::map<int, int>(); }),
+               mapChurn([] { return std::map<int, int, std::less<int>, PoolPair>(); }),
+               mapChurn([&resource] { return std::pmr::map<int, int>(&resource); }));
+        report("unordered_map ins/erase",
+               mapChurn([] { return std::unordered_map<int, int>(); }),
+               mapChurn([] { return std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, PoolPair>(); }),
+               mapChurn([&resource] { return std::pmr::unordered_map<int, int>(&resource); }));
+        report("list push/splice",
+               listSplice([] { return std::list<int>(); }),
+               listSplice([] { return std::list<int, PoolAllocator<int>>(); }),
+               listSplice([&resource] { return std::pmr::list<int>(&resource); }));
+    }
+
+    // 15. 编译期已知大小: allocate<N>()与运行期大小路径每次操作的耗时
+    static void testCompileTimeSize() 
+    {
+        std::cout << "\nTesting compile-time size classes (ns per allocate+deallocate):" << std::endl;
+        compareStaticSize<16>();
+        compareStaticSize<64>();
+        compareStaticSize<256>();
+        compareStaticSize<2048>();
+    }
+
+    template <size_t N>
+    static void compareStaticSize() 
+    {
+        constexpr size_t BATCH = 64;
+        constexpr size_t ROUNDS = 100000;
+        void* ptrs[BATCH];
+
+        // 大小从volatile读取, 编译器无法在调用处算出大小类
+        static volatile size_t runtimeSize = N;
+        size_t size = runtimeSize;
+        Timer t1;
+        for (size_t round = 0; round < ROUNDS; ++round) 
+        {
+            for (void*& ptr : ptrs) 
+            {
+                ptr = MemoryPool::allocate(size);
+            }
+            sink_ = reinterpret_cast<uintptr_t>(ptrs[BATCH - 1]);
+            for (void* ptr : ptrs) 
+            {
+                MemoryPool::deallocate(ptr, size);
+            }
+        }
+        double runtime = t1.elapsed();
+
+        Timer t2;
+        for (size_t round = 0; round < ROUNDS; ++round) 
+        {
+            for (void*& ptr : ptrs) 
+            {
+                ptr = MemoryPool::allocate<N>();
+            }
+            sink_ = reinterpret_cast<uintptr_t>(ptrs[BATCH - 1]);
+            for (void* ptr : ptrs) 
+            {
+                MemoryPool::deallocate<N>(ptr);
+            }
+        }
+        double compileTime = t2.elapsed();
+
+        constexpr double NUM_OPS = BATCH * ROUNDS;
+        std::cout << "  " << std::setw(5) << N << " bytes: runtime size " << std::fixed << std::setprecision(2)
+                  << runtime * 1e6 / NUM_OPS << " ns, allocate<N> " << compileTime * 1e6 / NUM_OPS << " ns" << std::endl;
+    }
 };
 
+
 int main() 
 {
     std::cout << "Starting performance tests..." << std::endl;
     
+    // 冷启动测试需在预热之前运行
+    PerformanceTest::testColdStart();
+
     // 预热系统
     PerformanceTest::warmup();
     
@@ -293,6 +1139,16 @@ int main()
     PerformanceTest::testSmallAllocation();
     PerformanceTest::testMultiThreaded();
     PerformanceTest::testMixedSizes();
+    PerformanceTest::testSpanMapChurn();
+    PerformanceTest::testOversubscribedFrontEnds();
+    PerformanceTest::testLockContention();
+    PerformanceTest::testPerClassScaling();
+    PerformanceTest::testRandomNodeAccess();
+    PerformanceTest::testLargeBufferChurn();
+    PerformanceTest::testVectorGrowth();
+    PerformanceTest::testBatchAllocation();
+    PerformanceTest::testContainers();
+    PerformanceTest::testCompileTimeSize();
     
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,107 @@
+#pragma once
+#include "MemoryPool.h"
+#include <limits>
+#include <memory_resource>
+#include <new>
+#include <type_traits>
+
+namespace memoryPool
+{
+
+// 满足标准分配器要求的内存池分配器, 可直接用于std::vector、std::map、std::list等容器
+// 无状态, 所有实例都相等; 容器释放时传入元素个数, 小对象按大小类直接放回线程缓存, 不查页映射
+// 超过ALIGNMENT的对齐要求(如alignas(64)的元素)走对齐分配
+template <typename T>
+class PoolAllocator
+{
+public:
+    using value_type = T;
+    using size_type = size_t;
+    using difference_type = ptrdiff_t;
+    using propagate_on_container_move_assignment = std::true_type;
+    using is_always_equal = std::true_type;
+
+    PoolAllocator() noexcept = default;
+
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U>&) noexcept
+    {
+    }
+
+    T* allocate(size_t n)
+    {
+        if (n > std::numeric_limits<size_t>::max() / sizeof(T))
+        {
+            throw std::bad_array_new_length();
+        }
+        void* ptr = alignof(T) > ALIGNMENT
+            ? MemoryPool::allocateAligned(n * sizeof(T), alignof(T))
+            : MemoryPool::allocate(n * sizeof(T));
+        if (!ptr)
+        {
+            throw std::bad_alloc();
+        }
+        return static_cast<T*>(ptr);
+    }
+
+    void deallocate(T* ptr, size_t n) noexcept
+    {
+        if constexpr (alignof(T) > ALIGNMENT)
+        {
+            MemoryPool::deallocateAligned(ptr, n * sizeof(T), alignof(T));
+        }
+        else
+        {
+            MemoryPool::deallocate(ptr, n * sizeof(T));
+        }
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const PoolAllocator<T>&, const PoolAllocator<U>&) noexcept
+{
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const PoolAllocator<T>&, const PoolAllocator<U>&) noexcept
+{
+    return false;
+}
+
+// std::pmr容器使用的内存资源, 按请求的大小和对齐从内存池分配, 释放时同样带大小
+// 无状态, 任意两个PoolMemoryResource都相等, 一个资源分配的内存可由另一个释放
+class PoolMemoryResource : public std::pmr::memory_resource
+{
+public:
+    // 构造在静态存储中且从不析构, 静态析构之后释放的pmr容器仍可使用
+    static PoolMemoryResource& getInstance()
+    {
+        alignas(PoolMemoryResource) static unsigned char storage[sizeof(PoolMemoryResource)];
+        static PoolMemoryResource* instance = new (storage) PoolMemoryResource();
+        return *instance;
+    }
+
+protected:
+    void* do_allocate(size_t bytes, size_t alignment) override
+    {
+        void* ptr = MemoryPool::allocateAligned(bytes, alignment);
+        if (!ptr)
+        {
+            throw std::bad_alloc();
+        }
+        return ptr;
+    }
+
+    void do_deallocate(void* ptr, size_t bytes, size_t alignment) override
+    {
+        MemoryPool::deallocateAligned(ptr, bytes, alignment);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    {
+        return dynamic_cast<const PoolMemoryResource*>(&other) != nullptr;
+    }
+};
+
+} // namespace memoryPool
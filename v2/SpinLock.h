@@ -0,0 +1,109 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace memoryPool {
+
+// 锁的统计
+struct LockStats {
+    size_t acquisitions;    // 获取次数
+    size_t contended;       // 第一次尝试失败的次数
+    size_t waitNanos;       // 竞争时等待的总纳秒数
+};
+
+// 自适应锁: 先带退避地自旋一小段时间, 仍拿不到再在futex上睡眠
+// 持锁线程被抢占时, 等待线程不会一直空转耗尽时间片
+// 状态: 0 未加锁, 1 已加锁且无等待者, 2 已加锁且可能有等待者
+class SpinLock {
+public:
+    void lock() {
+        uint32_t expected = 0;
+        if(!state_.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            lockSlow();
+        }
+        acquisitions_.store(acquisitions_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    bool try_lock() {
+        uint32_t expected = 0;
+        if(!state_.compare_exchange_strong(expected, 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+            return false;
+        }
+        acquisitions_.store(acquisitions_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void unlock() {
+        // 可能有线程睡在futex上时唤醒一个
+        if(state_.exchange(0, std::memory_order_release) == 2) {
+            futex(FUTEX_WAKE_PRIVATE, 1);
+        }
+    }
+
+    // 计数只在持锁时更新, 读取不加锁
+    LockStats getStats() const {
+        return LockStats{acquisitions_.load(std::memory_order_relaxed),
+                         contended_.load(std::memory_order_relaxed),
+                         waitNanos_.load(std::memory_order_relaxed)};
+    }
+
+private:
+    void lockSlow() {
+        auto start = std::chrono::steady_clock::now();
+
+        // 自旋阶段: 每轮pause次数翻倍, 只在观察到未加锁时才尝试CAS, 减少缓存行争抢
+        bool acquired = false;
+        for(uint32_t pauses = 1; pauses <= MAX_SPIN_PAUSES && !acquired; pauses <<= 1) {
+            for(uint32_t i = 0; i < pauses; ++i) {
+                cpuRelax();
+            }
+            uint32_t expected = 0;
+            acquired = state_.load(std::memory_order_relaxed) == 0
+                && state_.compare_exchange_weak(expected, 1, std::memory_order_acquire, std::memory_order_relaxed);
+        }
+
+        // 睡眠阶段: 标记有等待者后睡在futex上, 被唤醒后以2的状态抢锁, 保证释放时会继续唤醒
+        if(!acquired) {
+            while(state_.exchange(2, std::memory_order_acquire) != 0) {
+                futex(FUTEX_WAIT_PRIVATE, 2);
+            }
+        }
+
+        auto waited = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+        contended_.store(contended_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        waitNanos_.store(waitNanos_.load(std::memory_order_relaxed) + waited.count(), std::memory_order_relaxed);
+    }
+
+    void futex(int op, uint32_t value) {
+        syscall(SYS_futex, reinterpret_cast<uint32_t*>(&state_), op, value, nullptr, nullptr, 0);
+    }
+
+    static void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+        _mm_pause();
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+private:
+    // 自旋阶段最后一轮的pause次数, 1 + 2 + ... + 128 共约255次
+    static constexpr uint32_t MAX_SPIN_PAUSES = 128;
+
+    std::atomic<uint32_t> state_{0};
+    std::atomic<size_t> acquisitions_{0};
+    std::atomic<size_t> contended_{0};
+    std::atomic<size_t> waitNanos_{0};
+
+    static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex word must be 32 bits");
+};
+
+}
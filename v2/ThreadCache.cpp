@@ -1,125 +1,554 @@
 #include "ThreadCache.h"
 #include "CentralCache.h"
+#include "PageCache.h"
+#include "LargeCache.h"
+#include "HeapProfiler.h"
+#include <chrono>
+#include <new>
+#include <pthread.h>
 
 namespace memoryPool {
 
+namespace {
+
+// 每个线程的ThreadCache实例所在的存储
+alignas(ThreadCache) thread_local unsigned char threadCacheStorage[sizeof(ThreadCache)];
+
+}
+
+ThreadCache* ThreadCache::createInstance() {
+    static pthread_key_t key = [] {
+        pthread_key_t newKey;
+        pthread_key_create(&newKey, &ThreadCache::destroyInstance);
+        return newKey;
+    }();
+
+    ThreadCache* cache = new(threadCacheStorage) ThreadCache();
+    // 先记录实例再登记销毁: pthread_setspecific可能调用malloc, 此时已能使用本线程的实例
+    current_ = cache;
+    pthread_setspecific(key, cache);
+    return cache;
+}
+
+void ThreadCache::destroyInstance(void* cache) {
+    static_cast<ThreadCache*>(cache)->detach();
+}
+
+ThreadCache::ThreadCache() {
+    registerCache();
+}
+
+void ThreadCache::detach() {
+    // 线程退出时把所有缓存的对象归还中心缓存, 否则这些内存会随线程一起泄漏
+    for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        releaseList(index, freeList_[index].length);
+    }
+    retireCounts();
+    unregisterCache();
+
+    // 键析构之后glibc仍会释放线程私有的内存, 实例继续可用但容量为0, 每次释放都立即归还
+    detached_ = true;
+    maxSize_.store(0, std::memory_order_relaxed);
+}
+
 void* ThreadCache::allocate(size_t size) {
     // 处理0大小的分配请求
     if(size == 0) {
         size = ALIGNMENT;
     }
 
+    // 采样堆分析: 快速路径只有一次减法和比较, 大对象同样计入
+    if(HeapProfiler::shouldSample(size)) {
+        return allocateSampled(size);
+    }
+
     if(size > MAX_BYTES) {
-        // 大对象直接从系统分配
-        return malloc(size);
+        // 大对象直接从页缓存分配整页span, 释放时可通过页映射找回
+        return allocateLarge(size);
     }
 
-    size_t index = SizeClass::getIndex(size);
+    return popFromList(SizeClass::getIndex(size));
+}
 
-    // 检查线程本地自由链表
-    // 如果 freeList_[index] 不为空, 表示该链表中有可用的内存块
-    if(void* ptr = freeList_[index]) {
-        // 将freeList_[index] 指向内存块的下一个内存块地址
-        freeList_[index] = *reinterpret_cast<void**>(ptr);
-        freeListSize_[index]--;
-        return ptr;
+void* ThreadCache::allocateSampled(size_t size) {
+    HeapProfiler& profiler = HeapProfiler::getInstance();
+    bool sample = profiler.pickNextSample(size);
+    void* ptr = allocate(size);
+    if(sample && ptr) {
+        profiler.recordAllocation(ptr, size);
     }
+    return ptr;
+}
 
-    // 如果线程本地自由链表为空, 则从中心缓存获取一批内存
-    return fetchFromCentralCache(index);
+void ThreadCache::deallocateProfiled(void* ptr, size_t size) {
+    HeapProfiler::recordFree(ptr);
+    if(size > MAX_BYTES) {
+        deallocateLarge(ptr);
+        return;
+    }
+    deallocateToList(ptr, SizeClass::getIndex(size));
 }
 
 void ThreadCache::deallocate(void* ptr, size_t size) {
+    // 有存活的采样对象时先交给堆分析器, 否则只多读取一个计数
+    if(HeapProfiler::hasSampledObjects()) {
+        deallocateProfiled(ptr, size);
+        return;
+    }
     if(size > MAX_BYTES) {
-        free(ptr);
+        deallocateLarge(ptr);
+        return;
+    }
+    deallocateToList(ptr, SizeClass::getIndex(size));
+}
+
+void ThreadCache::deallocate(void* ptr) {
+    if(!ptr) return;
+    if(HeapProfiler::hasSampledObjects()) {
+        HeapProfiler::recordFree(ptr);
+    }
+
+    // 通过页映射找到所在span, 由span记录的大小类决定归还位置
+    Span* span = PageCache::getInstance().getSpan(ptr);
+    if(!span) return;
+
+    if(span->sizeClass == NO_SIZE_CLASS) {
+        deallocateLarge(ptr);
         return;
     }
+    deallocateToList(ptr, span->sizeClass);
+}
+
+size_t ThreadCache::allocateBatch(size_t size, size_t n, void** out) {
+    if(size == 0) {
+        size = ALIGNMENT;
+    }
+
+    // 大对象, 或这一批中有对象需要采样时逐个分配
+    if(size > MAX_BYTES || n > static_cast<size_t>(PTRDIFF_MAX) / size || !HeapProfiler::reserveUnsampled(n * size)) {
+        size_t count = 0;
+        while(count < n && (out[count] = allocate(size))) {
+            count++;
+        }
+        return count;
+    }
+
     size_t index = SizeClass::getIndex(size);
+    FreeList& list = freeList_[index];
+
+    // 先从本地链表头部取走至多n个
+    size_t fromList = std::min(n, list.length);
+    void* ptr = list.head;
+    for(size_t i = 0; i < fromList; ++i) {
+        out[i] = ptr;
+        ptr = *reinterpret_cast<void**>(ptr);
+    }
+    list.head = ptr;
+    list.length -= fromList;
+
+    // 不够的部分按批从中心缓存获取(整批时可直接取走传输缓存), 只有最后一批多出的对象放入本地链表
+    size_t count = fromList;
+    size_t surplus = 0;
+    while(count < n) {
+        size_t batchNum = SizeClass::batchNum(index);
+        void* end = nullptr;
+        void* start = CentralCache::getInstance().fetchRange(index, batchNum, end);
+        if(!start) break;
+
+        ptr = start;
+        size_t taken = std::min(batchNum, n - count);
+        for(size_t i = 0; i < taken; ++i) {
+            out[count++] = ptr;
+            ptr = *reinterpret_cast<void**>(ptr);
+        }
+        if(taken < batchNum) {
+            surplus = batchNum - taken;
+            *reinterpret_cast<void**>(end) = list.head;
+            if(list.length == 0) {
+                list.tail = end;
+            }
+            list.head = ptr;
+            list.length += surplus;
+        }
+    }
 
-    // 插入到线程本地自由链表
-    *reinterpret_cast<void**>(ptr) = freeList_[index];
-    freeList_[index] = ptr;
+    list.allocCount.store(list.allocCount.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    size_t classSize = SizeClass::classSize(index);
+    cachedBytes_.store(getCachedBytes() - fromList * classSize + surplus * classSize, std::memory_order_relaxed);
+    if(count > fromList) {
+        touch();
+        if(detached_) {
+            retireCounts();
+        }
+        if(getCachedBytes() > getMaxCachedBytes()) {
+            cacheOverLimit();
+        }
+    }
+    return count;
+}
+
+void ThreadCache::deallocateBatch(size_t size, size_t n, void** ptrs) {
+    if(n == 0) return;
+    if(HeapProfiler::hasSampledObjects()) {
+        for(size_t i = 0; i < n; ++i) {
+            HeapProfiler::recordFree(ptrs[i]);
+        }
+    }
+    if(size > MAX_BYTES) {
+        for(size_t i = 0; i < n; ++i) {
+            deallocateLarge(ptrs[i]);
+        }
+        return;
+    }
 
-    // 更新自由链表大小
-    freeListSize_[index]++;
+    // 整批串成一条链挂到本地链表头部
+    size_t index = SizeClass::getIndex(size);
+    FreeList& list = freeList_[index];
+    for(size_t i = 0; i + 1 < n; ++i) {
+        *reinterpret_cast<void**>(ptrs[i]) = ptrs[i + 1];
+    }
+    *reinterpret_cast<void**>(ptrs[n - 1]) = list.head;
+    if(list.length == 0) {
+        list.tail = ptrs[n - 1];
+    }
+    list.head = ptrs[0];
+    list.length += n;
+    list.freeCount.store(list.freeCount.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    cachedBytes_.store(getCachedBytes() + n * SizeClass::classSize(index), std::memory_order_relaxed);
 
-    // 判断是否需要将部分内存回收给中心缓存
-    if(shouldReturnToCentralCache(index)) {
-        returnToCentralCache(freeList_[index], size);
+    // 超过动态上限的部分按批归还, 不调整上限: 一次释放大量对象不代表之后持续溢出
+    if(list.length > list.maxLength) {
+        size_t batch = SizeClass::batchNum(index);
+        while(list.length > list.maxLength) {
+            releaseList(index, batch);
+        }
+        touch();
     }
+    if(getCachedBytes() > getMaxCachedBytes()) {
+        cacheOverLimit();
+    }
+}
+
+void* ThreadCache::allocateLarge(size_t size) {
+    return LargeCache::getInstance().allocate(size);
 }
 
-// 判断是否需要将内存回收给中心缓存
-bool ThreadCache::shouldReturnToCentralCache(size_t index) {
-    // 设定阈值
-    size_t threshold = 64;
-    return (freeListSize_[index] > threshold);
+void ThreadCache::deallocateLarge(void* ptr) {
+    LargeCache::getInstance().deallocate(ptr);
 }
 
 void* ThreadCache::fetchFromCentralCache(size_t index) {
-    size_t size = (index + 1) * ALIGNMENT;
-    // 根据对象内存大小计算批量获取的数量
-    size_t batchNum = getBatchNum(size);
-    // 从中心缓存批量获取内存
-    void* start = CentralCache::getInstance().fetchRange(index, batchNum);
+    FreeList& list = freeList_[index];
+    size_t batch = SizeClass::batchNum(index);
+
+    // 一次获取的数量受动态上限约束, 刚开始使用的大小类只取少量
+    size_t batchNum = std::min(list.maxLength, batch);
+    void* end = nullptr;
+    void* start = CentralCache::getInstance().fetchRange(index, batchNum, end);
     if(!start) return nullptr;
 
-    freeListSize_[index] += batchNum - 1;
+    // 慢启动: 上限先翻倍增长到一批, 之后每次增加一批, 保持为批量数的整数倍
+    if(list.maxLength < batch) {
+        list.maxLength = std::min(list.maxLength * 2, batch);
+    }
+    else {
+        size_t maxLength = std::min(list.maxLength + batch, maxListLength(index));
+        list.maxLength = std::max(maxLength - maxLength % batch, batch);
+    }
 
+    // 第一个对象返回给调用方, 其余放入本地链表, 只在链表为空时才会获取
     if(batchNum > 1) {
-        freeList_[index] = *reinterpret_cast<void**>(start);
+        list.head = *reinterpret_cast<void**>(start);
+        list.tail = end;
     }
     *reinterpret_cast<void**>(start) = nullptr;
+
+    list.length += batchNum - 1;
+    cachedBytes_.store(getCachedBytes() + (batchNum - 1) * SizeClass::classSize(index), std::memory_order_relaxed);
+    touch();
+    if(detached_) {
+        retireCounts();
+    }
+    if(getCachedBytes() > getMaxCachedBytes()) {
+        cacheOverLimit();
+    }
     return start;
+}
 
+void ThreadCache::releaseExcess(size_t index) {
+    // 超过动态上限时归还一批给中心缓存
+    if(freeList_[index].length > freeList_[index].maxLength) {
+        listTooLong(index);
+    }
+    // 超过本线程容量上限时扩容或整体收缩
+    if(getCachedBytes() > getMaxCachedBytes()) {
+        cacheOverLimit();
+    }
 }
 
-void ThreadCache::returnToCentralCache(void* start, size_t size) {
-    size_t index = SizeClass::getIndex(size);
-    size_t alignedSize = SizeClass::roundUp(size);
+void ThreadCache::listTooLong(size_t index) {
+    FreeList& list = freeList_[index];
+    size_t batch = SizeClass::batchNum(index);
+
+    // 归还一批
+    releaseList(index, batch);
+    touch();
+
+    if(list.maxLength < batch) {
+        // 慢启动阶段继续增长, 避免刚好卡在上限时来回搬运
+        list.maxLength++;
+    }
+    else if(list.maxLength > batch) {
+        // 持续溢出说明上限过大, 收缩一批, 避免内存一直滞留在本线程
+        if(++list.overages > MAX_OVERAGES) {
+            list.maxLength -= batch;
+            list.overages = 0;
+        }
+    }
+}
+
+size_t ThreadCache::maxListLength(size_t index) {
+    size_t bytesLimit = MAX_LIST_BYTES / SizeClass::classSize(index);
+    return std::max(SizeClass::batchNum(index), std::min(MAX_LIST_LENGTH, bytesLimit));
+}
+
+void ThreadCache::releaseList(size_t index, size_t returnNum) {
+    FreeList& list = freeList_[index];
+    returnNum = std::min(returnNum, list.length);
+    if(returnNum == 0) return;
+
+    // 从链表头部切下returnNum个对象, 整条归还时直接用记录的链表尾, 否则最多遍历一批
+    void* returnStart = list.head;
+    void* returnEnd = list.tail;
+    if(returnNum == list.length) {
+        list.head = nullptr;
+    }
+    else {
+        returnEnd = list.head;
+        for(size_t i = 0; i < returnNum - 1; ++i) {
+            returnEnd = *reinterpret_cast<void**>(returnEnd);
+        }
+        list.head = *reinterpret_cast<void**>(returnEnd);
+        *reinterpret_cast<void**>(returnEnd) = nullptr;
+    }
+
+    list.length -= returnNum;
+    cachedBytes_.store(getCachedBytes() - returnNum * SizeClass::classSize(index), std::memory_order_relaxed);
+    CentralCache::getInstance().returnRange(returnStart, returnEnd, returnNum, index);
+}
 
-    size_t batchNum = freeListSize_[index];
-    if(batchNum <= 1) return;
+void ThreadCache::cacheOverLimit() {
+    if(detached_) {
+        retireCounts();
+    }
+    // 容量刚被其他线程挪走, 把多出的字节还给中心缓存, 各线程缓存的字节之和才不超过预算
+    if(shrinkRequested_.exchange(false, std::memory_order_relaxed)) {
+        scavenge();
+        return;
+    }
+    // 热线程优先扩容保持命中率, 预算用尽且无处挪用时才收缩
+    while(getCachedBytes() > getMaxCachedBytes()) {
+        if(!increaseCacheLimit()) {
+            scavenge();
+            return;
+        }
+    }
+}
 
-    size_t keepNum = std::max(batchNum / 4, size_t(1));
-    size_t returnNum = batchNum - keepNum;
+bool ThreadCache::increaseCacheLimit() {
+    if(detached_) return false;
+    std::lock_guard<std::mutex> lock(registryMutex_);
 
-    void* splitNode = start;
+    // 预算还有剩余时直接领取
+    if(unclaimedCachedBytes_ >= static_cast<ptrdiff_t>(STEAL_BYTES)) {
+        unclaimedCachedBytes_ -= STEAL_BYTES;
+        maxSize_.store(getMaxCachedBytes() + STEAL_BYTES, std::memory_order_relaxed);
+        return true;
+    }
 
-    for(size_t i = 0; i < keepNum - 1; ++i) {
-        splitNode = *reinterpret_cast<void**>(splitNode);
+    // 预算用尽, 从最久未活跃的线程挪用, 且只挪用比自己更久未活跃的线程, 避免两个忙线程来回抢
+    ThreadCache* victim = leastRecentlyActive(this);
+    if(!victim || victim->lastActive_.load(std::memory_order_relaxed) >= lastActive_.load(std::memory_order_relaxed)) {
+        return false;
     }
-    if(splitNode != nullptr) {
-        void* nextNode = *reinterpret_cast<void**>(splitNode);
-        *reinterpret_cast<void**>(splitNode) = nullptr;
 
-        freeListSize_[index] = keepNum;
-        if(returnNum > 0 && nextNode != nullptr) {
-            CentralCache::getInstance().returnRange(nextNode, returnNum * alignedSize, index);
+    // 自由链表只由所属线程访问, 不能在这里替它归还; 标记后它下次释放或取批时发现超出上限即收缩
+    // 完全空闲的线程在此之前仍持有原来的字节
+    victim->maxSize_.store(victim->getMaxCachedBytes() - STEAL_BYTES, std::memory_order_relaxed);
+    victim->shrinkRequested_.store(true, std::memory_order_relaxed);
+    maxSize_.store(getMaxCachedBytes() + STEAL_BYTES, std::memory_order_relaxed);
+    return true;
+}
+
+ThreadCache* ThreadCache::leastRecentlyActive(const ThreadCache* exclude) {
+    ThreadCache* victim = nullptr;
+    uint64_t oldest = UINT64_MAX;
+    for(ThreadCache* cache = registryHead_; cache; cache = cache->registryNext_) {
+        // 容量不能被挪到下限以下
+        if(cache == exclude || cache->getMaxCachedBytes() < MIN_CACHE_BYTES + STEAL_BYTES) continue;
+        uint64_t lastActive = cache->lastActive_.load(std::memory_order_relaxed);
+        if(lastActive < oldest) {
+            oldest = lastActive;
+            victim = cache;
         }
     }
+    return victim;
 }
 
+void ThreadCache::touch() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    lastActive_.store(std::chrono::duration_cast<std::chrono::nanoseconds>(now).count(), std::memory_order_relaxed);
+}
 
-// 计算批量获取内存的数量
-size_t ThreadCache::getBatchNum(size_t size) {
-    // 基准：每次批量获取不超过4KB内存
-    constexpr size_t MAX_BATCH_SIZE = 4 * 1024;
-    // 根据对象大小设置合理的基准批量数
-    size_t baseNum;
-    if(size <= 32) baseNum = 64;
-    else if(size <= 64) baseNum = 32;
-    else if (size <= 128) baseNum = 16; // 16 * 128 = 2KB
-    else if (size <= 256) baseNum = 8;  // 8 * 256 = 2KB
-    else if (size <= 512) baseNum = 4;  // 4 * 512 = 2KB
-    else if (size <= 1024) baseNum = 2; // 2 * 1024 = 2KB
-    else baseNum = 1;
+void ThreadCache::scavenge() {
+    // 每轮把每个链表归还一半, 直到回到本线程容量上限以内
+    while(getCachedBytes() > getMaxCachedBytes()) {
+        for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+            FreeList& list = freeList_[index];
+            releaseList(index, list.length - list.length / 2);
 
-    // 最大批量数
-    size_t maxNum = std::max(size_t(1), MAX_BATCH_SIZE / size);
+            // 同时收缩动态上限, 下次溢出前少缓存一批
+            size_t batch = SizeClass::batchNum(index);
+            if(list.maxLength > batch) {
+                list.maxLength = std::max(list.maxLength - batch, batch);
+            }
+        }
+    }
+}
 
-    // 取最小值，但确保至少返回1
-    return std::max(size_t(1), std::min(maxNum, baseNum));
+void ThreadCache::registerCache() {
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    registryNext_ = registryHead_;
+    if(registryHead_) {
+        registryHead_->registryPrev_ = this;
+    }
+    registryHead_ = this;
+    registryCount_++;
+
+    // 新线程以最小容量起步, 预算不足时允许透支, 之后由挪用逐步平衡
+    unclaimedCachedBytes_ -= MIN_CACHE_BYTES;
+    touch();
 }
 
-}
\ No newline at end of file
+void ThreadCache::unregisterCache() {
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    if(registryPrev_) {
+        registryPrev_->registryNext_ = registryNext_;
+    }
+    else {
+        registryHead_ = registryNext_;
+    }
+    if(registryNext_) {
+        registryNext_->registryPrev_ = registryPrev_;
+    }
+    registryCount_--;
+
+    // 退出线程的容量还回预算
+    unclaimedCachedBytes_ += getMaxCachedBytes();
+}
+
+size_t ThreadCache::getTotalCachedBytes() {
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    size_t total = 0;
+    for(ThreadCache* cache = registryHead_; cache; cache = cache->registryNext_) {
+        total += cache->getCachedBytes();
+    }
+    return total;
+}
+
+size_t ThreadCache::listCachedBytes(size_t* out, size_t maxCount) {
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    size_t count = 0;
+    for(ThreadCache* cache = registryHead_; cache; cache = cache->registryNext_) {
+        if(count < maxCount) {
+            out[count] = cache->getCachedBytes();
+        }
+        count++;
+    }
+    return count;
+}
+
+void ThreadCache::setMaxTotalCachedBytes(size_t bytes) {
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    bytes = std::min(bytes, static_cast<size_t>(PTRDIFF_MAX));
+    unclaimedCachedBytes_ += static_cast<ptrdiff_t>(bytes) - static_cast<ptrdiff_t>(maxTotalCachedBytes_);
+    maxTotalCachedBytes_ = bytes;
+
+    // 预算调小后从最久未活跃的线程开始收回容量, 各线程下次释放时自行收缩
+    while(unclaimedCachedBytes_ < 0) {
+        ThreadCache* victim = leastRecentlyActive(nullptr);
+        if(!victim) break;
+        size_t reclaim = std::min(victim->getMaxCachedBytes() - MIN_CACHE_BYTES, static_cast<size_t>(-unclaimedCachedBytes_));
+        victim->maxSize_.store(victim->getMaxCachedBytes() - reclaim, std::memory_order_relaxed);
+        victim->shrinkRequested_.store(true, std::memory_order_relaxed);
+        unclaimedCachedBytes_ += reclaim;
+    }
+}
+
+size_t ThreadCache::getMaxTotalCachedBytes() {
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    return maxTotalCachedBytes_;
+}
+
+ptrdiff_t ThreadCache::getUnclaimedCachedBytes() {
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    return unclaimedCachedBytes_;
+}
+
+size_t ThreadCache::getNumCaches() {
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    return registryCount_;
+}
+
+void ThreadCache::retireCounts() {
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        FreeList& list = freeList_[index];
+        retiredAllocs_[index] += list.allocCount.load(std::memory_order_relaxed);
+        retiredFrees_[index] += list.freeCount.load(std::memory_order_relaxed);
+        list.allocCount.store(0, std::memory_order_relaxed);
+        list.freeCount.store(0, std::memory_order_relaxed);
+    }
+}
+
+void ThreadCache::afterFork(bool child) {
+    if(child) {
+        // 其他线程没有被复制到子进程, 它们的线程本地存储可能分给子进程的新线程, 实例重新登记时注册表会成环
+        // 计数并入已退出线程, 容量还回预算, 缓存的对象不再归还
+        ThreadCache* self = current_ && !current_->detached_ ? current_ : nullptr;
+        for(ThreadCache* cache = registryHead_; cache; cache = cache->registryNext_) {
+            if(cache == self) continue;
+            for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+                const FreeList& list = cache->freeList_[index];
+                retiredAllocs_[index] += list.allocCount.load(std::memory_order_relaxed);
+                retiredFrees_[index] += list.freeCount.load(std::memory_order_relaxed);
+            }
+            unclaimedCachedBytes_ += cache->getMaxCachedBytes();
+        }
+        registryHead_ = self;
+        registryCount_ = self ? 1 : 0;
+        if(self) {
+            self->registryNext_ = nullptr;
+            self->registryPrev_ = nullptr;
+        }
+    }
+    registryMutex_.unlock();
+}
+
+void ThreadCache::getClassCounts(size_t* allocs, size_t* frees) {
+    std::lock_guard<std::mutex> lock(registryMutex_);
+    for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        allocs[index] = retiredAllocs_[index];
+        frees[index] = retiredFrees_[index];
+    }
+    // 其他线程的计数不加锁读取, 快照中同一对象的分配和释放可能只看到其一
+    for(ThreadCache* cache = registryHead_; cache; cache = cache->registryNext_) {
+        for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+            const FreeList& list = cache->freeList_[index];
+            allocs[index] += list.allocCount.load(std::memory_order_relaxed);
+            frees[index] += list.freeCount.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+}
@@ -1,37 +1,217 @@
 #pragma once
 #include "Common.h"
+#include "HeapProfiler.h"
+#include <mutex>
+#include <cstdint>
 
 namespace memoryPool {
 
+// 单个大小类的线程本地自由链表
+struct FreeList {
+    void* head = nullptr;
+    void* tail = nullptr;   // 链表尾, length为0时无意义, 整条归还时无需遍历
+    size_t length = 0;      // 链表中的对象数
+    size_t maxLength = 1;   // 动态上限, 慢启动增长, 频繁溢出时收缩
+    size_t overages = 0;    // 连续超过上限的次数
+    // 分配和释放次数, 只由所属线程写入, 统计时由其他线程读取
+    std::atomic<size_t> allocCount{0};
+    std::atomic<size_t> freeCount{0};
+};
+
 class ThreadCache {
 public:
     // 单例模式, 每个线程一个实例
+    // 实例放在不带析构函数的线程本地存储中, 线程退出时由pthread键的析构函数清理
+    // 带析构函数的thread_local在初始化时会让glibc调用malloc登记析构函数, 替换malloc后会递归创建实例
     static ThreadCache* getInstance() {
-        static thread_local ThreadCache instance;
-        return &instance;
+        if(ThreadCache* cache = current_) return cache;
+        return createInstance();
     }
 
     void* allocate(size_t size);
     void deallocate(void* ptr, size_t size);
+    // 不带大小的释放, 通过页映射查出大小类
+    void deallocate(void* ptr);
+
+    // 大小类已知的分配和释放, 定义在本头文件中内联到调用处, 只有取批、归还和采样是函数调用
+    // size不超过MAX_BYTES且属于大小类index, 用于堆分析的采样
+    void* allocateSmall(size_t size, size_t index);
+    void deallocateSmall(void* ptr, size_t index);
+
+    // 分配n个size字节的对象写入out, 返回成功分配的个数
+    // 大小类只计算一次, 先整段取走本地链表, 不够时直接向中心缓存整批获取
+    size_t allocateBatch(size_t size, size_t n, void** out);
+    // 释放n个size字节的对象, 整批串成一条链挂到本地链表, 超出动态上限的部分按批归还
+    void deallocateBatch(size_t size, size_t n, void** ptrs);
+
+    // 本线程缓存中的空闲字节数
+    size_t getCachedBytes() const { return cachedBytes_.load(std::memory_order_relaxed); }
+
+    // 本线程缓存当前的容量上限, 可能被其他线程调低
+    size_t getMaxCachedBytes() const { return maxSize_.load(std::memory_order_relaxed); }
+
+    // 所有存活线程缓存的空闲字节总数
+    static size_t getTotalCachedBytes();
+    // 列出各存活线程缓存的空闲字节数, 最多写入maxCount个, 返回存活线程数
+    static size_t listCachedBytes(size_t* out, size_t maxCount);
+    // 所有线程缓存容量之和的预算, 各线程从中按需领取, 用完后从最久未活跃的线程挪用
+    static void setMaxTotalCachedBytes(size_t bytes);
+    static size_t getMaxTotalCachedBytes();
+    // 预算中尚未被任何线程领取的字节数, 线程数很多时可能为负
+    static ptrdiff_t getUnclaimedCachedBytes();
+    // 存活的线程缓存数
+    static size_t getNumCaches();
+    // 各大小类的累计分配和释放次数, 各写入FREE_LIST_SIZE个, 包括已退出线程的次数
+    static void getClassCounts(size_t* allocs, size_t* frees);
+
+    // fork前取得注册表锁, fork后在父子进程中释放
+    // 子进程中只保留调用fork的线程的缓存, 其他线程的缓存从注册表摘除, 其中的对象不再使用
+    static void prepareFork() { registryMutex_.lock(); }
+    static void afterFork(bool child);
 
 private:
-    ThreadCache() {
-        freeList_.fill(nullptr);
-        freeListSize_.fill(0);
-    };
+    ThreadCache();
+
+    // 在本线程的存储中构造实例并登记线程退出时的清理
+    static ThreadCache* createInstance();
+    static void destroyInstance(void* cache);
+    // 线程退出: 归还所有缓存的对象并从注册表移除, 之后实例不再缓存任何对象
+    void detach();
+    // 把本线程的分配释放次数转入全局累计值, 退出的线程之后的次数也由此计入
+    void retireCounts();
+
+    // 线程缓存注册表, 记录所有存活的线程缓存
+    void registerCache();
+    void unregisterCache();
+    // 超过本线程容量上限: 先尝试扩容, 扩容后仍超出再收缩; 容量刚被挪用时直接收缩
+    void cacheOverLimit();
+    // 从未领取的预算或最久未活跃的线程处挪用STEAL_BYTES容量, 返回是否成功
+    bool increaseCacheLimit();
+    // 除exclude外最久未活跃且容量可被挪用的线程缓存, 调用方需持有registryMutex_
+    static ThreadCache* leastRecentlyActive(const ThreadCache* exclude);
+    // 堆分析器决定采样时的分配路径, 不内联, 分配快速路径不必为这次调用保存寄存器
+    __attribute__((noinline)) void* allocateSampled(size_t size);
+    // 有存活的采样对象时的带大小释放路径, 同样不内联
+    __attribute__((noinline)) void deallocateProfiled(void* ptr, size_t size);
     // 从中心缓存获取内存
     void* fetchFromCentralCache(size_t index);
-    // 归还内存到中心缓存
-    void returnToCentralCache(void* start, size_t size);
+    // 从指定大小类的线程本地自由链表弹出, 为空时从中心缓存取一批
+    void* popFromList(size_t index);
+    // 放回指定大小类的线程本地自由链表
+    void deallocateToList(void* ptr, size_t index);
+
+    // 超过MAX_BYTES的大对象直接走页缓存
+    void* allocateLarge(size_t size);
+    void deallocateLarge(void* ptr);
+
+    // 链表过长时归还一批并调整上限
+    void listTooLong(size_t index);
+    // 释放后链表过长或超过本线程容量上限时的处理, 内联的释放路径尾调用它, 不必保存寄存器
+    void releaseExcess(size_t index);
+    // 大小类动态上限的最大值
+    static size_t maxListLength(size_t index);
 
-    size_t getBatchNum(size_t size);
+    // 从链表头部归还returnNum个对象给中心缓存
+    void releaseList(size_t index, size_t returnNum);
+    // 超过本线程容量上限时把每个链表归还一半
+    void scavenge();
 
-    bool shouldReturnToCentralCache(size_t index);
+    // 记录本线程最近一次走慢路径的时间, 供挑选挪用对象
+    void touch();
 
 private:
     // 每个线程的空闲链表数组
-    std::array<void*, FREE_LIST_SIZE> freeList_;
-    std::array<size_t, FREE_LIST_SIZE> freeListSize_;  // 空闲链表大小统计
+    std::array<FreeList, FREE_LIST_SIZE> freeList_;
+    // 缓存的空闲字节数, 只由所属线程写入, 注册表遍历时由其他线程读取
+    std::atomic<size_t> cachedBytes_{0};
+    // 本线程缓存的容量上限, 其他线程挪用容量时会调低, 受registryMutex_保护写入
+    std::atomic<size_t> maxSize_{MIN_CACHE_BYTES};
+    // 最近一次活跃的时间戳(纳秒), 只在慢路径更新
+    std::atomic<uint64_t> lastActive_{0};
+    // 容量被其他线程挪用或预算调小后置位, 下次超出上限时直接收缩到新上限, 不再挪用回来
+    std::atomic<bool> shrinkRequested_{false};
+
+    // 注册表链表指针
+    ThreadCache* registryNext_ = nullptr;
+    ThreadCache* registryPrev_ = nullptr;
+
+    // 连续溢出多少次后收缩上限
+    static constexpr size_t MAX_OVERAGES = 3;
+    // 动态上限的最大值: 对象数不超过MAX_LIST_LENGTH, 且总字节数不超过MAX_LIST_BYTES(至少一批)
+    static constexpr size_t MAX_LIST_LENGTH = 8192;
+    static constexpr size_t MAX_LIST_BYTES = 1024 * 1024;
+    // 新线程的初始容量, 也是被挪用后的容量下限
+    static constexpr size_t MIN_CACHE_BYTES = 256 * 1024;
+    // 每次扩容挪用的字节数
+    static constexpr size_t STEAL_BYTES = 64 * 1024;
+    // 默认的总预算
+    static constexpr size_t DEFAULT_MAX_TOTAL_CACHED_BYTES = 32 * 1024 * 1024;
+
+    // 线程已退出, 此后的释放立即归还中心缓存
+    bool detached_ = false;
+
+    // 本线程的实例, 未创建时为空
+    static inline thread_local ThreadCache* current_ = nullptr;
+
+    static inline std::mutex registryMutex_;
+    static inline ThreadCache* registryHead_ = nullptr;
+    static inline size_t registryCount_ = 0;
+    static inline size_t maxTotalCachedBytes_ = DEFAULT_MAX_TOTAL_CACHED_BYTES;
+    // 总预算减去各线程容量之和
+    static inline ptrdiff_t unclaimedCachedBytes_ = DEFAULT_MAX_TOTAL_CACHED_BYTES;
+    // 已退出线程的累计分配和释放次数, 受registryMutex_保护
+    static inline size_t retiredAllocs_[FREE_LIST_SIZE] = {};
+    static inline size_t retiredFrees_[FREE_LIST_SIZE] = {};
 };
 
+inline void* ThreadCache::allocateSmall(size_t size, size_t index) {
+    if(HeapProfiler::shouldSample(size)) {
+        return allocateSampled(size);
+    }
+    return popFromList(index);
+}
+
+inline void ThreadCache::deallocateSmall(void* ptr, size_t index) {
+    if(HeapProfiler::hasSampledObjects()) {
+        deallocateProfiled(ptr, SizeClass::classSize(index));
+        return;
+    }
+    deallocateToList(ptr, index);
+}
+
+inline void* ThreadCache::popFromList(size_t index) {
+    // 检查线程本地自由链表
+    // 如果 freeList_[index] 不为空, 表示该链表中有可用的内存块
+    FreeList& list = freeList_[index];
+    list.allocCount.store(list.allocCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    if(void* ptr = list.head) {
+        // 将链表头指向内存块的下一个内存块地址
+        list.head = *reinterpret_cast<void**>(ptr);
+        list.length--;
+        cachedBytes_.store(getCachedBytes() - SizeClass::classSize(index), std::memory_order_relaxed);
+        return ptr;
+    }
+
+    // 如果线程本地自由链表为空, 则从中心缓存获取一批内存
+    return fetchFromCentralCache(index);
+}
+
+inline void ThreadCache::deallocateToList(void* ptr, size_t index) {
+    // 插入到线程本地自由链表
+    FreeList& list = freeList_[index];
+    list.freeCount.store(list.freeCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    *reinterpret_cast<void**>(ptr) = list.head;
+    list.head = ptr;
+
+    // 更新自由链表大小, 空链表插入的第一个对象即是链表尾
+    if(list.length++ == 0) {
+        list.tail = ptr;
+    }
+    cachedBytes_.store(getCachedBytes() + SizeClass::classSize(index), std::memory_order_relaxed);
+
+    if(__builtin_expect(list.length > list.maxLength || getCachedBytes() > getMaxCachedBytes(), 0)) {
+        releaseExcess(index);
+    }
+}
+
 }
\ No newline at end of file
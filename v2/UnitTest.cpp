@@ -1,4 +1,13 @@
 #include "MemoryPool.h"
+#include "PageCache.h"
+#include "CentralCache.h"
+#include "ThreadCache.h"
+#include "CpuCache.h"
+#include "LargeCache.h"
+#include "SpinLock.h"
+#include "NumaTopology.h"
+#include "HeapProfiler.h"
+#include "PoolAllocator.h"
 #include <iostream>
 #include <vector>
 #include <thread>
@@ -6,8 +15,20 @@
 #include <random>
 #include <algorithm>
 #include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <list>
+#include <map>
+#include <unordered_map>
+#include <string>
+#include <stdexcept>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <malloc.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
 
 using namespace memoryPool;
 
@@ -168,29 +189,1865 @@ void testStress() {
     std::cout << "Stress test passed!" << std::endl;
 }
 
+// 大小类表测试
+void testSizeClassTable() {
+    std::cout << "Running size class table test..." << std::endl;
 
+    assert(FREE_LIST_SIZE >= 80 && FREE_LIST_SIZE <= 100);
+    assert(SizeClass::classSize(FREE_LIST_SIZE - 1) == MAX_BYTES);
 
-// int main() 
-// {
-//     try 
-//     {
-//         std::cout << "Starting memory pool tests..." << std::endl;
+    for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        size_t size = SizeClass::classSize(index);
+        size_t spanBytes = SizeClass::classPages(index) * PAGE_SIZE;
+        // 大小递增且8字节对齐
+        assert(size % ALIGNMENT == 0);
+        assert(index == 0 || size > SizeClass::classSize(index - 1));
+        // 每个span至少能切出一个对象, 尾部浪费不超过12.5%
+        assert(spanBytes >= size);
+        assert(spanBytes % size <= spanBytes / 8);
+        assert(SizeClass::batchNum(index) >= 1);
+    }
+
+    // 每个请求大小都映射到能容纳它的最小大小类
+    for(size_t bytes = 1; bytes <= MAX_BYTES; ++bytes) {
+        size_t index = SizeClass::getIndex(bytes);
+        assert(SizeClass::classSize(index) >= bytes);
+        assert(index == 0 || SizeClass::classSize(index - 1) < bytes);
+    }
+    assert(SizeClass::getIndex(0) == 0);
+
+    // 分配出的内存可以完整写满所属大小类
+    for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        size_t size = SizeClass::classSize(index);
+        void* ptr = MemoryPool::allocate(size);
+        assert(ptr != nullptr);
+        memset(ptr, 0xab, size);
+        MemoryPool::deallocate(ptr, size);
+    }
+
+    std::cout << "Size class table test passed!" << std::endl;
+}
+
+// 基数树页映射测试
+void testPageMapLookup() {
+    std::cout << "Running page map lookup test..." << std::endl;
+
+    PageCache& pageCache = PageCache::getInstance();
+
+    // 小对象及其内部指针都能查到所属大小类
+    for(size_t size : {8, 100, 1024, 5000, 65536}) {
+        char* ptr = static_cast<char*>(MemoryPool::allocate(size));
+        assert(pageCache.getSizeClass(ptr) == SizeClass::getIndex(size));
+        assert(pageCache.getSizeClass(ptr + size - 1) == SizeClass::getIndex(size));
+        MemoryPool::deallocate(ptr, size);
+    }
+
+    // 非内存池分配的指针查不到
+    int onStack = 0;
+    assert(pageCache.getSpan(&onStack) == nullptr);
+    assert(pageCache.getSizeClass(&onStack) == NO_SIZE_CLASS);
+
+    // 分割后的相邻span释放时与前后邻居合并
+    // 区域按大页申请, 多出的页留在空闲链表中, 每段取得比大页的零头更大, 保证从base所在的span分割
+    constexpr size_t TOTAL = 1800, PART = 600;
+    char* base = static_cast<char*>(pageCache.allocateSpan(TOTAL));
+    assert(base != nullptr);
+    pageCache.deallocateSpan(base);
+
+    char* p1 = static_cast<char*>(pageCache.allocateSpan(PART));
+    char* p2 = static_cast<char*>(pageCache.allocateSpan(PART));
+    char* p3 = static_cast<char*>(pageCache.allocateSpan(PART));
+    assert(p1 == base && p2 == p1 + PART * PAGE_SIZE && p3 == p2 + PART * PAGE_SIZE);
+    assert(pageCache.getSpan(p2 + 10 * PAGE_SIZE)->pageAddr == p2);
+
+    // 前后邻居都在使用中, 不发生合并
+    pageCache.deallocateSpan(p2);
+    Span* freed = pageCache.getSpan(p2);
+    assert(freed->isFree && freed->pageAddr == p2 && freed->numPages == PART);
+
+    // 与后一个空闲span合并(前面区间外的空闲span也可能被合并进来), 尾页仍是p3之前的一页
+    pageCache.deallocateSpan(p1);
+    Span* merged = pageCache.getSpan(p3 - PAGE_SIZE);
+    assert(merged->isFree && merged->pageAddr <= p1);
+    assert(static_cast<char*>(merged->pageAddr) + merged->numPages * PAGE_SIZE == p3);
+
+    pageCache.deallocateSpan(p3);
+
+    std::cout << "Page map lookup test passed!" << std::endl;
+}
+
+// 不带大小的释放测试
+void testUnsizedDeallocate() {
+    std::cout << "Running unsized deallocate test..." << std::endl;
+
+    // 小对象: 释放后同一大小类的下一次分配拿回同一块内存
+    for(size_t size : {size_t(1), size_t(24), size_t(300), size_t(4000), size_t(100000), MAX_BYTES}) {
+        void* ptr = MemoryPool::allocate(size);
+        assert(ptr != nullptr);
+        memset(ptr, 0x5a, size);
+        MemoryPool::deallocate(ptr);
+        void* again = MemoryPool::allocate(size);
+        assert(again == ptr);
+        MemoryPool::deallocate(again);
+    }
+
+    // 大对象: 释放后span进入大对象缓存或回到页缓存的空闲链表
+    auto freePageBytes = []() {
+        PageHeapStats stats = PageCache::getInstance().getStats();
+        return stats.retainedBytes + stats.releasedBytes + LargeCache::getInstance().getStats().cachedBytes;
+    };
+    constexpr size_t LARGE = 3 * 1024 * 1024 + 5;
+    char* large = static_cast<char*>(MemoryPool::allocate(LARGE));
+    assert(large != nullptr);
+    large[0] = 1;
+    large[LARGE - 1] = 1;
+    Span* span = PageCache::getInstance().getSpan(large + LARGE - 1);
+    assert(span && span->sizeClass == NO_SIZE_CLASS && !span->isFree);
+    size_t freeBytes = freePageBytes();
+    MemoryPool::deallocate(large);
+    assert(freePageBytes() - freeBytes >= LARGE);
+
+    // 带大小释放的大对象同样回到页缓存
+    void* sized = MemoryPool::allocate(MAX_BYTES + 1);
+    freeBytes = freePageBytes();
+    MemoryPool::deallocate(sized, MAX_BYTES + 1);
+    assert(freePageBytes() - freeBytes >= MAX_BYTES + 1);
+
+    // 空指针和非内存池指针直接忽略
+    MemoryPool::deallocate(nullptr);
+    int onStack = 0;
+    MemoryPool::deallocate(&onStack);
+
+    std::cout << "Unsized deallocate test passed!" << std::endl;
+}
+
+// 读取当前进程的常驻内存(RSS)字节数
+static size_t currentRss() {
+    size_t totalPages = 0, residentPages = 0;
+    FILE* file = fopen("/proc/self/statm", "r");
+    if(!file) return 0;
+    if(fscanf(file, "%zu %zu", &totalPages, &residentPages) != 2) residentPages = 0;
+    fclose(file);
+    return residentPages * sysconf(_SC_PAGESIZE);
+}
+
+// 用mincore统计一组块中仍驻留在物理内存中的字节数, 只看这些地址, 不受进程其他内存的影响
+static size_t residentBytes(const std::vector<void*>& blocks, size_t blockSize) {
+    size_t systemPage = sysconf(_SC_PAGESIZE);
+    std::vector<unsigned char> vec(blockSize / systemPage);
+    size_t resident = 0;
+    for(void* ptr : blocks) {
+        assert(reinterpret_cast<uintptr_t>(ptr) % systemPage == 0);
+        assert(mincore(ptr, blockSize, vec.data()) == 0);
+        for(unsigned char page : vec) {
+            if(page & 1) resident += systemPage;
+        }
+    }
+    return resident;
+}
+
+// 突发分配释放后空闲页归还给系统的测试
+void testScavengeAfterBurst() {
+    std::cout << "Running scavenge after burst test..." << std::endl;
+
+    PageCache& pageCache = PageCache::getInstance();
+    ScavengerConfig oldConfig = pageCache.getScavengerConfig();
+    // 大对象缓存中的span不经过回收器, 测试期间关闭
+    size_t oldLargeCache = LargeCache::getInstance().getMaxCachedBytes();
+    LargeCache::getInstance().setMaxCachedBytes(0);
+
+    constexpr size_t NUM_BLOCKS = 64;
+    constexpr size_t BLOCK_SIZE = 1024 * 1024;
+    constexpr size_t BURST_BYTES = NUM_BLOCKS * BLOCK_SIZE;
+
+    // 分配并写满全部块, 返回块都存活时的RSS, 然后全部释放; 块地址留在blocks中供释放后检查
+    std::vector<void*> blocks;
+    auto burst = [&]() {
+        blocks.clear();
+        for(size_t i = 0; i < NUM_BLOCKS; ++i) {
+            void* ptr = MemoryPool::allocate(BLOCK_SIZE);
+            assert(ptr != nullptr);
+            memset(ptr, 0x11, BLOCK_SIZE);
+            blocks.push_back(ptr);
+        }
+        size_t peak = currentRss();
+        assert(residentBytes(blocks, BLOCK_SIZE) == BURST_BYTES);
+        for(void* ptr : blocks) {
+            MemoryPool::deallocate(ptr, BLOCK_SIZE);
+        }
+        return peak;
+    };
+
+    // 1. 按释放次数触发: 不保留空闲页, 每次释放都执行一轮回收
+    ScavengerConfig config;
+    config.retainedBytesTarget = 0;
+    config.releaseBytesPerRound = BURST_BYTES;
+    config.releaseInterval = 1;
+    pageCache.setScavengerConfig(config);
+
+    // RSS在块存活时达到峰值, 释放后至少下降一半; 释放的块本身用mincore确认已不再驻留
+    size_t released = pageCache.getStats().totalReleasedBytes;
+    size_t peak = burst();
+    size_t after = currentRss();
+    PageHeapStats stats = pageCache.getStats();
+    std::cout << "  interval trigger: RSS " << peak / 1024 << " KB -> " << after / 1024 << " KB, released "
+              << (stats.totalReleasedBytes - released) / 1024 << " KB" << std::endl;
+    assert(peak > after && peak - after >= BURST_BYTES / 2);
+    assert(residentBytes(blocks, BLOCK_SIZE) <= BURST_BYTES / 2);
+    assert(stats.totalReleasedBytes - released >= BURST_BYTES / 2);
+
+    // 2. 后台线程: 关闭按次数触发, 由后台线程按周期归还
+    config.releaseInterval = 0;
+    config.backgroundPeriod = std::chrono::milliseconds(10);
+    pageCache.setScavengerConfig(config);
+    pageCache.startScavenger();
+
+    released = pageCache.getStats().totalReleasedBytes;
+    peak = burst();
+    for(int i = 0; i < 200 && pageCache.getStats().retainedBytes > 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    pageCache.stopScavenger();
+    after = currentRss();
+    stats = pageCache.getStats();
+    std::cout << "  background thread: RSS " << peak / 1024 << " KB -> " << after / 1024 << " KB, released "
+              << (stats.totalReleasedBytes - released) / 1024 << " KB" << std::endl;
+    assert(peak > after && peak - after >= BURST_BYTES / 2);
+    assert(residentBytes(blocks, BLOCK_SIZE) <= BURST_BYTES / 2);
+    assert(stats.retainedBytes == 0);
+    assert(stats.releasedBytes >= BURST_BYTES);
+    assert(stats.totalReleasedBytes - released >= BURST_BYTES / 2);
+
+    // 3. 保留目标: 低于目标的空闲页不会被回收
+    config.retainedBytesTarget = BURST_BYTES * 4;
+    config.releaseInterval = 1;
+    pageCache.setScavengerConfig(config);
+    released = pageCache.getStats().totalReleasedBytes;
+    burst();
+    assert(pageCache.getStats().totalReleasedBytes == released);
+    assert(residentBytes(blocks, BLOCK_SIZE) == BURST_BYTES);
+
+    // 手动归还不受保留目标限制
+    peak = currentRss();
+    assert(pageCache.releaseFreeSpans(SIZE_MAX) > 0);
+    after = currentRss();
+    assert(pageCache.getStats().retainedBytes == 0);
+    assert(peak > after && peak - after >= BURST_BYTES / 2);
+    assert(residentBytes(blocks, BLOCK_SIZE) == 0);
+
+    // 4. 两个限制都按页精确成立: span大于剩余额度时只归还一部分
+    constexpr size_t PER_ROUND = 3 * 1024 * 1024 + 5 * PAGE_SIZE;
+    constexpr size_t TARGET = BURST_BYTES / 2 + 3 * PAGE_SIZE;
+    config.retainedBytesTarget = TARGET;
+    config.releaseBytesPerRound = PER_ROUND;
+    pageCache.setScavengerConfig(config);
+    stats = pageCache.getStats();
+    released = stats.totalReleasedBytes;
+    size_t rounds = stats.scavengeRounds;
+    burst();
+    stats = pageCache.getStats();
+    assert(stats.totalReleasedBytes > released);
+    assert(stats.totalReleasedBytes - released <= (stats.scavengeRounds - rounds) * PER_ROUND);
+    assert(stats.retainedBytes >= TARGET);
+
+    // 手动归还同样不超过给定的字节数
+    size_t manual = pageCache.releaseFreeSpans(PER_ROUND);
+    assert(manual > 0 && manual <= PER_ROUND);
+    pageCache.releaseFreeSpans(SIZE_MAX);
+
+    pageCache.setScavengerConfig(oldConfig);
+    LargeCache::getInstance().setMaxCachedBytes(oldLargeCache);
+    std::cout << "Scavenge after burst test passed!" << std::endl;
+}
+
+// 透明大页测试: 向系统申请的区域按大页计, 回收时优先归还完整的大页
+void testHugePageRegions() {
+    std::cout << "Running huge page regions test..." << std::endl;
+
+    PageCache& pageCache = PageCache::getInstance();
+    PageHeapStats stats = pageCache.getStats();
+    assert(stats.mappedBytes % HUGE_PAGE_SIZE == 0);
+    assert(stats.hugePageBytes + stats.brokenHugePages * HUGE_PAGE_SIZE <= stats.mappedBytes);
+
+    // 先归还全部空闲页, 之后唯一驻留的空闲span是下面释放的span
+    pageCache.releaseFreeSpans(SIZE_MAX);
+    assert(pageCache.getStats().retainedBytes == 0);
+
+    constexpr size_t NUM_PAGES = 4 * PAGES_PER_HUGE_PAGE;
+    void* ptr = pageCache.allocateSpan(NUM_PAGES);
+    assert(ptr != nullptr);
+    memset(ptr, 0x15, NUM_PAGES * PAGE_SIZE);
+    pageCache.deallocateSpan(ptr);
+    PageHeapStats before = pageCache.getStats();
+    assert(before.retainedBytes == NUM_PAGES * PAGE_SIZE);
+
+    // 只归还span中按大页对齐的部分, 没有大页被拆散, 首尾不足一个大页的页继续驻留
+    // span至少包含3个完整的大页, 额度恰好3个大页时全部用完且不超出
+    size_t released = pageCache.releaseFreeSpans(3 * HUGE_PAGE_SIZE);
+    PageHeapStats after = pageCache.getStats();
+    assert(released == 3 * HUGE_PAGE_SIZE);
+    assert(before.hugePageBytes - after.hugePageBytes == released);
+    assert(after.brokenHugePages <= before.brokenHugePages);
+    assert(after.retainedBytes == NUM_PAGES * PAGE_SIZE - released);
+
+    // 没有包含完整大页的span时才拆散大页
+    released = pageCache.releaseFreeSpans(SIZE_MAX);
+    assert(released == after.retainedBytes);
+    assert(pageCache.getStats().retainedBytes == 0);
+
+    std::cout << "  huge page bytes " << after.hugePageBytes / 1024 << " KB of "
+              << after.mappedBytes / 1024 << " KB mapped, " << after.brokenHugePages << " broken" << std::endl;
+    std::cout << "Huge page regions test passed!" << std::endl;
+}
+
+// 大对象缓存测试: 释放的大span被同样大小的申请复用, 调整大小时尽量不复制
+void testLargeCache() {
+    std::cout << "Running large cache test..." << std::endl;
+
+    LargeCache& largeCache = LargeCache::getInstance();
+    constexpr size_t MB = 1024 * 1024;
+
+    // 释放后再申请大小相近的对象拿回同一个span, 相差超过1/4时不复用
+    char* ptr = static_cast<char*>(MemoryPool::allocate(4 * MB));
+    memset(ptr, 0x41, 4 * MB);
+    MemoryPool::deallocate(ptr, 4 * MB);
+    LargeCacheStats before = largeCache.getStats();
+    assert(before.cachedBytes >= 4 * MB);
+    char* again = static_cast<char*>(MemoryPool::allocate(4 * MB - 100));
+    assert(again == ptr);
+    void* small = MemoryPool::allocate(MB);
+    assert(small != ptr);
+    LargeCacheStats after = largeCache.getStats();
+    assert(after.cacheHits == before.cacheHits + 1);
+    assert(after.cacheMisses >= before.cacheMisses + 1);
+    MemoryPool::deallocate(small);
+
+    // 缩小后再扩展回原大小, 刚切下的尾部仍在后面, 两次都在原地完成
+    before = after;
+    assert(largeCache.reallocate(again, 2 * MB) == again);
+    assert(largeCache.reallocate(again, 4 * MB) == again);
+    after = largeCache.getStats();
+    assert(after.resizedInPlace == before.resizedInPlace + 2);
+    assert(again[0] == 0x41 && again[2 * MB - 1] == 0x41);
+
+    // 扩展到更大时原地扩展或用mremap搬移, 都不复制数据
+    memset(again, 0x42, 4 * MB);
+    before = after;
+    char* grown = static_cast<char*>(largeCache.reallocate(again, 32 * MB));
+    assert(grown != nullptr);
+    after = largeCache.getStats();
+    assert(after.resizedInPlace + after.remapped == before.resizedInPlace + before.remapped + 1);
+    assert(after.copied == before.copied);
+    for(size_t i = 0; i < 4 * MB; i += PAGE_SIZE) {
+        assert(grown[i] == 0x42);
+    }
+    grown[32 * MB - 1] = 1;
+
+    // 缩小到接近MAX_BYTES同样原地完成, 尾部交还页缓存
+    char* shrunk = static_cast<char*>(largeCache.reallocate(grown, 300 * 1024));
+    assert(shrunk == grown && shrunk[300 * 1024 - 1] == 0x42);
+    assert(largeCache.getStats().resizedInPlace == after.resizedInPlace + 1);
+    MemoryPool::deallocate(shrunk);
+
+    // 缓存的span数和字节数不超过上限, 调小上限时立即交还
+    size_t oldMax = largeCache.getMaxCachedBytes();
+    largeCache.setMaxCachedBytes(8 * MB);
+    std::vector<void*> ptrs;
+    for(size_t i = 0; i < 2 * LargeCache::MAX_ENTRIES; ++i) {
+        ptrs.push_back(MemoryPool::allocate(MB + i * PAGE_SIZE));
+    }
+    for(void* p : ptrs) {
+        MemoryPool::deallocate(p);
+        LargeCacheStats stats = largeCache.getStats();
+        assert(stats.cachedBytes <= 8 * MB && stats.cachedSpans <= LargeCache::MAX_ENTRIES);
+    }
+    largeCache.setMaxCachedBytes(MB);
+    assert(largeCache.getStats().cachedBytes <= MB);
+    largeCache.flush();
+    assert(largeCache.getStats().cachedSpans == 0);
+    largeCache.setMaxCachedBytes(oldMax);
+
+    std::cout << "  in place " << after.resizedInPlace << ", remapped " << after.remapped
+              << ", copied " << after.copied << std::endl;
+    std::cout << "Large cache test passed!" << std::endl;
+}
+
+// realloc/calloc风格接口测试
+void testReallocate() {
+    std::cout << "Running reallocate test..." << std::endl;
+
+    auto pattern = [](size_t i) { return static_cast<char>(i % 251); };
+
+    // 同一大小类内调整大小返回原指针
+    char* ptr = static_cast<char*>(MemoryPool::reallocate(nullptr, 0, 20));
+    for(size_t i = 0; i < 20; ++i) {
+        ptr[i] = pattern(i);
+    }
+    assert(MemoryPool::reallocate(ptr, 20, SizeClass::roundUp(20)) == ptr);
+    assert(MemoryPool::reallocate(ptr, 20, 17) == ptr);
+
+    // 逐步扩展跨过大小类和MAX_BYTES, 内容保持不变
+    size_t size = 20;
+    for(size_t newSize = 40; newSize <= 4 * MAX_BYTES; newSize = newSize * 3 / 2) {
+        ptr = static_cast<char*>(MemoryPool::reallocate(ptr, size, newSize));
+        assert(ptr != nullptr);
+        for(size_t i = 0; i < size; ++i) {
+            assert(ptr[i] == pattern(i));
+        }
+        for(size_t i = size; i < newSize; ++i) {
+            ptr[i] = pattern(i);
+        }
+        size = newSize;
+    }
+
+    // 大对象之间由大对象缓存调整, 缩回小对象时保留开头部分
+    LargeCacheStats before = LargeCache::getInstance().getStats();
+    ptr = static_cast<char*>(MemoryPool::reallocate(ptr, size, size * 2));
+    LargeCacheStats after = LargeCache::getInstance().getStats();
+    assert(after.resizedInPlace + after.remapped + after.copied == before.resizedInPlace + before.remapped + before.copied + 1);
+    ptr = static_cast<char*>(MemoryPool::reallocate(ptr, size * 2, 100));
+    for(size_t i = 0; i < 100; ++i) {
+        assert(ptr[i] == pattern(i));
+    }
+    assert(MemoryPool::reallocate(ptr, 100, 0) == nullptr);
+
+    // callocate返回的内存全为0, 即使拿到的是刚写过的对象
+    for(size_t bytes : {size_t(24), size_t(4000), MAX_BYTES, 3 * MAX_BYTES}) {
+        void* dirty = MemoryPool::allocate(bytes);
+        memset(dirty, 0xff, bytes);
+        MemoryPool::deallocate(dirty, bytes);
+        unsigned char* zero = static_cast<unsigned char*>(MemoryPool::callocate(1, bytes));
+        assert(std::all_of(zero, zero + bytes, [](unsigned char c) { return c == 0; }));
+        MemoryPool::deallocate(zero, bytes);
+    }
+
+    // 总大小溢出时失败
+    assert(MemoryPool::callocate(SIZE_MAX / 2, 3) == nullptr);
+    void* empty = MemoryPool::callocate(0, 16);
+    assert(empty != nullptr);
+    MemoryPool::deallocate(empty, 0);
+
+    std::cout << "Reallocate test passed!" << std::endl;
+}
+
+// 延迟清零测试: 新申请的区域不被访问, 已知全为0的span在分配时不再清零
+void testLazyZeroing() {
+    std::cout << "Running lazy zeroing test..." << std::endl;
+
+    PageCache& pageCache = PageCache::getInstance();
+    ScavengerConfig oldConfig = pageCache.getScavengerConfig();
+
+    // 比所有空闲span都大的申请必然来自新区域, 申请本身不增加常驻内存
+    constexpr size_t NUM_PAGES = 256 * 1024 * 1024 / PAGE_SIZE;
+    size_t rss = currentRss();
+    bool zeroed = false;
+    char* ptr = static_cast<char*>(pageCache.allocateSpan(NUM_PAGES, NO_SIZE_CLASS, CURRENT_NODE, &zeroed));
+    assert(ptr != nullptr && zeroed);
+    assert(currentRss() - rss < 16 * 1024 * 1024);
+    assert(ptr[0] == 0 && ptr[NUM_PAGES * PAGE_SIZE - 1] == 0);
+
+    // 写过的span释放后不再是0, 切分出的两部分都继承该状态
+    ptr[0] = 1;
+    ptr[NUM_PAGES * PAGE_SIZE - 1] = 1;
+    pageCache.deallocateSpan(ptr);
+    char* half = static_cast<char*>(pageCache.allocateSpan(NUM_PAGES / 2, NO_SIZE_CLASS, CURRENT_NODE, &zeroed));
+    assert(half == ptr && !zeroed);
+    pageCache.deallocateSpan(half);
+
+    // 以MADV_DONTNEED归还后重新变为0
+    ScavengerConfig config = oldConfig;
+    config.useMadvFree = false;
+    pageCache.setScavengerConfig(config);
+    pageCache.releaseFreeSpans(SIZE_MAX);
+    half = static_cast<char*>(pageCache.allocateSpan(NUM_PAGES / 2, NO_SIZE_CLASS, CURRENT_NODE, &zeroed));
+    assert(zeroed && half[0] == 0);
+    half[0] = 1;
+    pageCache.deallocateSpan(half);
+
+    // 以MADV_FREE归还的页可能保留原内容
+    config.useMadvFree = true;
+    pageCache.setScavengerConfig(config);
+    pageCache.releaseFreeSpans(SIZE_MAX);
+    half = static_cast<char*>(pageCache.allocateSpan(NUM_PAGES / 2, NO_SIZE_CLASS, CURRENT_NODE, &zeroed));
+    assert(!zeroed);
+    pageCache.deallocateSpan(half);
+    pageCache.setScavengerConfig(oldConfig);
+
+    // callocate在任何情况下都返回全0的内存
+    for(int i = 0; i < 3; ++i) {
+        unsigned char* zero = static_cast<unsigned char*>(MemoryPool::callocate(4, MAX_BYTES));
+        assert(std::all_of(zero, zero + 4 * MAX_BYTES, [](unsigned char c) { return c == 0; }));
+        memset(zero, 0xee, 4 * MAX_BYTES);
+        MemoryPool::deallocate(zero, 4 * MAX_BYTES);
+    }
+
+    std::cout << "Lazy zeroing test passed!" << std::endl;
+}
+
+// 对齐分配测试
+struct alignas(64) CacheLineCounter : PoolObject {
+    std::atomic<size_t> value{0};
+    char padding[40];
+};
+
+struct alignas(8192) PageAlignedBuffer : PoolObject {
+    char data[100];
+};
+
+void testAlignedAllocation() {
+    std::cout << "Running aligned allocation test..." << std::endl;
+
+    // 各种大小和对齐组合, 地址对齐且可写满
+    for(size_t alignment = 1; alignment <= 4 * 1024 * 1024; alignment <<= 1) {
+        for(size_t size : {size_t(1), size_t(24), size_t(64), size_t(100), size_t(3000), size_t(5000), MAX_BYTES, MAX_BYTES + 1, 3 * MAX_BYTES}) {
+            void* ptr = MemoryPool::allocateAligned(size, alignment);
+            assert(ptr != nullptr);
+            assert(reinterpret_cast<uintptr_t>(ptr) % alignment == 0);
+            memset(ptr, 0x19, size);
+            MemoryPool::deallocateAligned(ptr, size, alignment);
+        }
+    }
+    assert(MemoryPool::allocateAligned(64, 48) == nullptr);
+
+    // 对象大小本身是对齐倍数时直接使用该大小类, 不浪费空间
+    for(size_t alignment : {size_t(16), size_t(64), size_t(4096)}) {
+        size_t index = SizeClass::getAlignedIndex(alignment, alignment);
+        assert(SizeClass::classSize(index) == alignment);
+    }
+    size_t index = SizeClass::getAlignedIndex(65, 64);
+    assert(SizeClass::classSize(index) % 64 == 0 && SizeClass::classSize(index) >= 65);
+
+    // 超过一页的对齐从span中切出, 首尾多余的页交还页缓存
+    PageHeapStats before = PageCache::getInstance().getStats();
+    void* huge = MemoryPool::allocateAligned(MAX_BYTES * 2, HUGE_PAGE_SIZE);
+    assert(reinterpret_cast<uintptr_t>(huge) % HUGE_PAGE_SIZE == 0);
+    Span* span = PageCache::getInstance().getSpan(huge);
+    assert(span->pageAddr == huge && span->numPages == MAX_BYTES * 2 / PAGE_SIZE);
+    MemoryPool::deallocateAligned(huge, MAX_BYTES * 2, HUGE_PAGE_SIZE);
+    assert(PageCache::getInstance().getStats().mappedBytes - before.mappedBytes <= 2 * HUGE_PAGE_SIZE);
+
+    // 继承PoolObject的类型按alignas对齐分配
+    std::vector<CacheLineCounter*> counters;
+    for(int i = 0; i < 100; ++i) {
+        counters.push_back(new CacheLineCounter);
+        assert(reinterpret_cast<uintptr_t>(counters.back()) % 64 == 0);
+    }
+    for(CacheLineCounter* counter : counters) {
+        delete counter;
+    }
+    CacheLineCounter* array = new CacheLineCounter[10];
+    assert(reinterpret_cast<uintptr_t>(array) % 64 == 0);
+    delete[] array;
+    PageAlignedBuffer* buffer = new PageAlignedBuffer;
+    assert(reinterpret_cast<uintptr_t>(buffer) % 8192 == 0);
+    delete buffer;
+
+    std::cout << "Aligned allocation test passed!" << std::endl;
+}
+
+// 在其他线程持续分配释放时反复fork, 子进程中各条分配路径和新线程都能正常使用
+template <typename Alloc, typename Free>
+void checkForkChildren(Alloc alloc, Free release) {
+    for(int i = 0; i < 20; ++i) {
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if(pid == 0) {
+            // 子进程继承了未释放的锁时会死锁, 由SIGALRM结束
+            alarm(10);
+            auto churn = [&] {
+                for(size_t size : {size_t(8), size_t(1000), MAX_BYTES, 3 * MAX_BYTES}) {
+                    std::vector<void*> ptrs;
+                    for(int j = 0; j < 64; ++j) {
+                        void* ptr = alloc(size);
+                        assert(ptr != nullptr);
+                        memset(ptr, j, size);
+                        ptrs.push_back(ptr);
+                    }
+                    for(void* ptr : ptrs) {
+                        release(ptr, size);
+                    }
+                }
+            };
+            churn();
+            std::thread(churn).join();
+            _exit(0);
+        }
+        int status = 0;
+        assert(waitpid(pid, &status, 0) == pid);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    }
+}
+
+// LD_PRELOAD子进程: 多线程混合使用malloc系列函数和new/delete, 检查都由libmemorypool.so处理
+int runPreloadChild() {
+    // 可用大小等于大小类大小, 说明malloc已被替换
+    void* probe = malloc(1000);
+    assert(malloc_usable_size(probe) == SizeClass::classSize(SizeClass::getIndex(1000)));
+    free(probe);
+    probe = malloc(MAX_BYTES + 1);
+    assert(malloc_usable_size(probe) == MAX_BYTES + PAGE_SIZE);
+    free(probe);
+
+    // 大对齐的小块是单独的整页span, realloc不能按可用大小把它当作小对象释放到某个大小类
+    unsigned char* aligned = static_cast<unsigned char*>(memalign(8192, 100));
+    memset(aligned, 0x3c, 100);
+    unsigned char* moved = static_cast<unsigned char*>(realloc(aligned, 200));
+    assert(moved != nullptr && moved[0] == 0x3c && moved[99] == 0x3c);
+    void* sameClass = malloc(PAGE_SIZE - 96);
+    assert(sameClass != aligned);
+    assert(malloc_usable_size(sameClass) == SizeClass::classSize(SizeClass::getIndex(PAGE_SIZE - 96)));
+    free(sameClass);
+    free(moved);
+    // 增长到大对象时原地调整或搬移整个span
+    aligned = static_cast<unsigned char*>(memalign(8192, 100));
+    memset(aligned, 0x3c, 100);
+    moved = static_cast<unsigned char*>(realloc(aligned, 2 * MAX_BYTES));
+    assert(moved != nullptr && moved[0] == 0x3c && moved[99] == 0x3c);
+    assert(malloc_usable_size(moved) >= 2 * MAX_BYTES);
+    free(moved);
+
+    // 对齐数必须是sizeof(void*)的2的幂倍
+    void* rejected = nullptr;
+    assert(posix_memalign(&rejected, 0, 64) == EINVAL);
+    assert(posix_memalign(&rejected, sizeof(void*) * 3, 64) == EINVAL);
+    assert(posix_memalign(&rejected, sizeof(void*) / 2, 64) == EINVAL);
+    assert(rejected == nullptr);
+
+    constexpr int NUM_THREADS = 8;
+    constexpr int ITERATIONS = 20000;
+    // 线程之间交换的对象, 由另一个线程检查内容并释放
+    std::mutex exchangeMutex;
+    std::vector<std::pair<unsigned char*, size_t>> exchange;
+
+    auto threadFunc = [&](int id) {
+        std::mt19937 gen(id);
+        std::vector<std::pair<unsigned char*, size_t>> local;
+        for(int i = 0; i < ITERATIONS; ++i) {
+            size_t size = gen() % 3 == 0 ? gen() % (2 * MAX_BYTES) + 1 : gen() % 2048 + 1;
+            unsigned char* ptr = nullptr;
+            switch(gen() % 5) {
+                case 0:
+                    ptr = static_cast<unsigned char*>(malloc(size));
+                    break;
+                case 1: {
+                    ptr = static_cast<unsigned char*>(calloc(1, size));
+                    assert(ptr[0] == 0 && ptr[size - 1] == 0);
+                    break;
+                }
+                case 2: {
+                    // 逐步增长的realloc保留原内容
+                    ptr = static_cast<unsigned char*>(malloc(16));
+                    memset(ptr, 0x5a, 16);
+                    ptr = static_cast<unsigned char*>(realloc(ptr, size));
+                    assert(ptr[std::min(size, size_t(16)) - 1] == 0x5a);
+                    break;
+                }
+                case 3: {
+                    size_t alignment = size_t(16) << (gen() % 10);
+                    void* aligned = nullptr;
+                    assert(posix_memalign(&aligned, alignment, size) == 0);
+                    assert(reinterpret_cast<uintptr_t>(aligned) % alignment == 0);
+                    ptr = static_cast<unsigned char*>(aligned);
+                    break;
+                }
+                default:
+                    ptr = static_cast<unsigned char*>(aligned_alloc(64, size));
+                    assert(reinterpret_cast<uintptr_t>(ptr) % 64 == 0);
+                    break;
+            }
+            assert(ptr != nullptr && malloc_usable_size(ptr) >= size);
+            memset(ptr, id, size);
+            local.emplace_back(ptr, size);
+
+            if(local.size() >= 64) {
+                std::lock_guard<std::mutex> lock(exchangeMutex);
+                for(auto& [other, otherSize] : exchange) {
+                    assert(other[0] == other[otherSize - 1]);
+                    free(other);
+                }
+                exchange.swap(local);
+                local.clear();
+            }
+
+            // 标准库容器和字符串走全局new/delete
+            std::vector<std::string> strings(gen() % 16, std::string(gen() % 200, 'x'));
+            std::string joined;
+            for(const std::string& str : strings) {
+                joined += str;
+            }
+        }
+        for(auto& [ptr, size] : local) {
+            free(ptr);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(int i = 0; i < NUM_THREADS; ++i) {
+        threads.emplace_back(threadFunc, i + 1);
+    }
+    // 其他线程仍在分配释放时fork
+    checkForkChildren([](size_t size) { return malloc(size); }, [](void* ptr, size_t) { free(ptr); });
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    for(auto& [ptr, size] : exchange) {
+        free(ptr);
+    }
+    return 0;
+}
+
+// LD_PRELOAD替换malloc测试: 在libmemorypool.so下运行sort和本程序的多线程子进程
+void testPreloadLibrary() {
+    std::cout << "Running preload library test..." << std::endl;
+
+    // 动态库与测试程序在同一目录
+    char exePath[4096];
+    ssize_t len = readlink("/proc/self/exe", exePath, sizeof(exePath) - 1);
+    assert(len > 0);
+    exePath[len] = '\0';
+    std::string dir(exePath, strrchr(exePath, '/'));
+    std::string preload = "LD_PRELOAD=" + dir + "/libmemorypool.so ";
+    assert(access((dir + "/libmemorypool.so").c_str(), R_OK) == 0);
+
+    // sort: 多线程排序, 结果与std::sort一致
+    char inputPath[] = "/tmp/memorypool_sortXXXXXX";
+    int fd = mkstemp(inputPath);
+    assert(fd >= 0);
+    std::mt19937 gen(20);
+    std::vector<unsigned> numbers(200000);
+    std::string input;
+    for(unsigned& number : numbers) {
+        number = gen();
+        input += std::to_string(number) + "\n";
+    }
+    assert(write(fd, input.data(), input.size()) == static_cast<ssize_t>(input.size()));
+    close(fd);
+    std::sort(numbers.begin(), numbers.end());
+
+    FILE* pipe = popen((preload + "sort -n --parallel=4 " + inputPath).c_str(), "r");
+    assert(pipe != nullptr);
+    size_t count = 0;
+    unsigned value = 0;
+    while(fscanf(pipe, "%u", &value) == 1) {
+        assert(count < numbers.size() && value == numbers[count]);
+        count++;
+    }
+    int status = pclose(pipe);
+    unlink(inputPath);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(count == numbers.size());
+
+    // 本程序的多线程子进程
+    status = system((preload + exePath + " --preload-child").c_str());
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    std::cout << "Preload library test passed!" << std::endl;
+}
+
+// 统计快照测试
+void testPoolStats() {
+    std::cout << "Running pool stats test..." << std::endl;
+
+    constexpr size_t SMALL_SIZE = 100;
+    constexpr size_t NUM_SMALL = 5000;
+    constexpr size_t LARGE_SIZE = 3 * MAX_BYTES;
+    constexpr size_t NUM_LARGE = 8;
+    size_t index = SizeClass::getIndex(SMALL_SIZE);
+    size_t classSize = SizeClass::classSize(index);
+    size_t largeBytes = (LARGE_SIZE + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
 
-//         testBasicAllocation();
-//         testMemoryWriting();
-//         testMultiThreading();
-//         testEdgeCases();
-//         testStress();
+    MemoryPoolStats before = MemoryPool::getStats();
+    std::vector<void*> small;
+    std::vector<void*> large;
+    for(size_t i = 0; i < NUM_SMALL; ++i) {
+        small.push_back(MemoryPool::allocate(SMALL_SIZE));
+    }
+    for(size_t i = 0; i < NUM_LARGE; ++i) {
+        large.push_back(MemoryPool::allocate(LARGE_SIZE));
+    }
+
+    // 分配次数和持有字节数按大小类及大对象分别计入
+    MemoryPoolStats during = MemoryPool::getStats();
+    const SizeClassStats& cls = during.classes[index];
+    assert(cls.size == classSize);
+    assert(cls.allocations - before.classes[index].allocations == NUM_SMALL);
+    assert(cls.deallocations == before.classes[index].deallocations);
+    assert(cls.inUseBytes - before.classes[index].inUseBytes == NUM_SMALL * classSize);
+    assert(cls.spans > 0 && cls.inUseBytes + cls.centralFreeBytes <= cls.spanBytes);
+    assert(cls.refills > before.classes[index].refills);
+    assert(during.large.allocations - before.large.allocations == NUM_LARGE);
+    assert(during.largeInUseBytes - before.largeInUseBytes == NUM_LARGE * largeBytes);
+
+    // 各层之和不超过驻留内存, 碎片率在0到1之间
+    size_t accounted = during.inUseBytes + during.threadCacheBytes + during.cpuCacheBytes + during.centralCacheBytes
+                     + during.largeCacheBytes + during.pageHeapFreeBytes;
+    assert(accounted <= during.residentBytes);
+    assert(during.residentBytes + during.pageHeapReleasedBytes == during.mappedBytes);
+    assert(during.fragmentation >= 0.0 && during.fragmentation < 1.0);
+
+    for(void* ptr : small) {
+        MemoryPool::deallocate(ptr, SMALL_SIZE);
+    }
+    for(void* ptr : large) {
+        MemoryPool::deallocate(ptr);
+    }
+    MemoryPoolStats after = MemoryPool::getStats();
+    assert(after.classes[index].deallocations - before.classes[index].deallocations == NUM_SMALL);
+    assert(after.classes[index].inUseBytes == before.classes[index].inUseBytes);
+    assert(after.large.deallocations - before.large.deallocations == NUM_LARGE);
+    assert(after.largeInUseBytes == before.largeInUseBytes);
+
+    // 线程退出后它的次数仍计入; 在其他线程释放的对象同样平衡
+    std::vector<void*> fromThread;
+    std::thread worker([&fromThread]() {
+        for(size_t i = 0; i < NUM_SMALL; ++i) {
+            fromThread.push_back(MemoryPool::allocate(SMALL_SIZE));
+        }
+    });
+    worker.join();
+    MemoryPoolStats exited = MemoryPool::getStats();
+    assert(exited.classes[index].allocations - after.classes[index].allocations == NUM_SMALL);
+    for(void* ptr : fromThread) {
+        MemoryPool::deallocate(ptr);
+    }
+    assert(MemoryPool::getStats().classes[index].inUseBytes == before.classes[index].inUseBytes);
+
+    // 可读输出包含汇总和用过的大小类
+    FILE* out = tmpfile();
+    assert(out != nullptr);
+    MemoryPool::printStats(out);
+    rewind(out);
+    char line[256];
+    bool hasSummary = false;
+    bool hasClass = false;
+    while(fgets(line, sizeof(line), out)) {
+        hasSummary = hasSummary || strstr(line, "MB in use") != nullptr;
+        size_t lineIndex = 0;
+        size_t lineSize = 0;
+        if(sscanf(line, "%zu %zu", &lineIndex, &lineSize) == 2 && lineIndex == index) {
+            hasClass = lineSize == classSize;
+        }
+    }
+    fclose(out);
+    assert(hasSummary && hasClass);
+
+    std::cout << "Pool stats test passed!" << std::endl;
+}
+
+// 由堆分析测试调用, 采样的调用栈中应出现本函数
+__attribute__((noinline)) void profiledAllocations(std::vector<void*>& ptrs, size_t count, size_t size) {
+    for(size_t i = 0; i < count; ++i) {
+        ptrs.push_back(MemoryPool::allocate(size));
+    }
+}
+
+// 采样堆分析测试
+void testHeapProfiler() {
+    std::cout << "Running heap profiler test..." << std::endl;
+
+    constexpr size_t INTERVAL = 4096;
+    constexpr size_t SIZE = 256;
+    constexpr size_t COUNT = 20000;
+    HeapProfiler& profiler = HeapProfiler::getInstance();
+    HeapProfileStats before = profiler.getStats();
+    profiler.setSamplingInterval(INTERVAL);
+
+    // 期望采样约COUNT * SIZE / INTERVAL = 1250次
+    std::vector<void*> ptrs;
+    ptrs.reserve(COUNT);
+    profiledAllocations(ptrs, COUNT, SIZE);
+    HeapProfileStats during = profiler.getStats();
+    size_t sampled = during.sampledAllocations - before.sampledAllocations;
+    assert(sampled > 800 && sampled < 1800);
+    assert(during.liveObjects - before.liveObjects == sampled);
+    assert(during.liveBytes - before.liveBytes == sampled * SIZE);
+    assert(during.stacks > before.stacks);
+
+    // profile头部的存活数与统计一致, 某个调用栈经过profiledAllocations
+    FILE* out = tmpfile();
+    assert(out != nullptr);
+    profiler.writeProfile(out);
+    rewind(out);
+    size_t liveObjects = 0, liveBytes = 0, allocs = 0, allocBytes = 0, interval = 0;
+    assert(fscanf(out, "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+                  &liveObjects, &liveBytes, &allocs, &allocBytes, &interval) == 5);
+    assert(liveObjects == during.liveObjects && liveBytes == during.liveBytes && interval == INTERVAL);
+    uintptr_t function = reinterpret_cast<uintptr_t>(&profiledAllocations);
+    bool foundCaller = false;
+    bool foundMaps = false;
+    char line[4096];
+    while(fgets(line, sizeof(line), out)) {
+        foundMaps = foundMaps || strncmp(line, "MAPPED_LIBRARIES:", 17) == 0;
+        for(char* p = strstr(line, " 0x"); p; p = strstr(p + 1, " 0x")) {
+            uintptr_t address = strtoull(p + 1, nullptr, 16);
+            foundCaller = foundCaller || (address > function && address < function + 512);
+        }
+    }
+    fclose(out);
+    assert(foundCaller && foundMaps);
+
+    // 在其他线程释放, 采样对象同样不再存活
+    std::thread worker([&ptrs]() {
+        for(void* ptr : ptrs) {
+            MemoryPool::deallocate(ptr, SIZE);
+        }
+    });
+    worker.join();
+    HeapProfileStats after = profiler.getStats();
+    assert(after.liveObjects == before.liveObjects && after.liveBytes == before.liveBytes);
+    assert(after.sampledAllocations == during.sampledAllocations);
+
+    // 远大于采样间隔的大对象必然被采样
+    void* large = MemoryPool::allocate(MAX_BYTES * 4);
+    assert(profiler.getStats().sampledAllocations == after.sampledAllocations + 1);
+    MemoryPool::deallocate(large);
+    assert(profiler.getStats().liveObjects == before.liveObjects);
+
+    // 大块清零分配和大对齐分配不经过前端缓存, 同样必然被采样
+    void* zeroed = MemoryPool::callocate(4, MAX_BYTES);
+    assert(profiler.getStats().sampledAllocations == after.sampledAllocations + 2);
+    void* aligned = MemoryPool::allocateAligned(MAX_BYTES * 4, 4 * PAGE_SIZE);
+    assert(profiler.getStats().sampledAllocations == after.sampledAllocations + 3);
+    assert(profiler.getStats().liveObjects == before.liveObjects + 2);
+    MemoryPool::deallocate(zeroed);
+    MemoryPool::deallocateAligned(aligned, MAX_BYTES * 4, 4 * PAGE_SIZE);
+    assert(profiler.getStats().liveObjects == before.liveObjects);
+
+    // 大对象原地调整、mremap搬移或复制后仍跟踪到释放, 存活字节数按调整后的大小计
+    HeapProfileStats beforeResize = profiler.getStats();
+    size_t growingSize = MAX_BYTES * 4;
+    void* growing = MemoryPool::allocate(growingSize);
+    for(size_t newSize : {MAX_BYTES * 8, size_t(4) << 20, size_t(16) << 20, MAX_BYTES * 2}) {
+        growing = MemoryPool::reallocate(growing, growingSize, newSize);
+        assert(growing != nullptr);
+        growingSize = newSize;
+        HeapProfileStats resized = profiler.getStats();
+        assert(resized.liveObjects == beforeResize.liveObjects + 1);
+        assert(resized.liveBytes == beforeResize.liveBytes + newSize);
+        assert(resized.sampledAllocations == beforeResize.sampledAllocations + 1);
+    }
+    // 调整失败时原对象不变, 仍被跟踪
+    assert(MemoryPool::reallocate(growing, growingSize, size_t(1) << 50) == nullptr);
+    assert(profiler.getStats().liveObjects == beforeResize.liveObjects + 1);
+    assert(profiler.getStats().liveBytes == beforeResize.liveBytes + growingSize);
+    MemoryPool::deallocate(growing, growingSize);
+    assert(profiler.getStats().liveObjects == beforeResize.liveObjects);
+    assert(profiler.getStats().liveBytes == beforeResize.liveBytes);
+
+    // 每CPU前端同样采样
+    if(MemoryPool::setFrontEnd(FrontEnd::PerCpu)) {
+        ptrs.clear();
+        profiledAllocations(ptrs, COUNT, SIZE);
+        assert(profiler.getStats().sampledAllocations > after.sampledAllocations + 800);
+        for(void* ptr : ptrs) {
+            MemoryPool::deallocate(ptr);
+        }
+        assert(profiler.getStats().liveObjects == before.liveObjects);
+        MemoryPool::setFrontEnd(FrontEnd::PerThread);
+    }
+
+    // 关闭后不再采样
+    profiler.setSamplingInterval(0);
+    size_t total = profiler.getStats().sampledAllocations;
+    ptrs.clear();
+    profiledAllocations(ptrs, COUNT, SIZE);
+    for(void* ptr : ptrs) {
+        MemoryPool::deallocate(ptr, SIZE);
+    }
+    assert(profiler.getStats().sampledAllocations == total);
+
+    std::cout << "Heap profiler test passed!" << std::endl;
+}
+
+// 批量分配测试
+void testBatchAllocation() {
+    std::cout << "Running batch allocation test..." << std::endl;
+
+    constexpr size_t SIZE = 64;
+    size_t index = SizeClass::getIndex(SIZE);
+    for(size_t n : {size_t(1), size_t(8), size_t(64), size_t(1024), size_t(5000)}) {
+        std::vector<void*> ptrs(n);
+        MemoryPoolStats before = MemoryPool::getStats();
+        assert(MemoryPool::allocateBatch(SIZE, n, ptrs.data()) == n);
+        MemoryPoolStats during = MemoryPool::getStats();
+        assert(during.classes[index].allocations - before.classes[index].allocations == n);
+
+        // 对象互不重叠且可写
+        std::vector<void*> sorted(ptrs);
+        std::sort(sorted.begin(), sorted.end());
+        for(size_t i = 0; i < n; ++i) {
+            assert(sorted[i] != nullptr);
+            assert(i == 0 || static_cast<char*>(sorted[i]) - static_cast<char*>(sorted[i - 1]) >= static_cast<ptrdiff_t>(SIZE));
+            memset(ptrs[i], static_cast<int>(i), SIZE);
+        }
+        for(size_t i = 0; i < n; ++i) {
+            assert(static_cast<unsigned char*>(ptrs[i])[SIZE - 1] == static_cast<unsigned char>(i));
+        }
+
+        MemoryPool::deallocateBatch(SIZE, n, ptrs.data());
+        MemoryPoolStats after = MemoryPool::getStats();
+        assert(after.classes[index].deallocations - before.classes[index].deallocations == n);
+        assert(after.classes[index].inUseBytes == before.classes[index].inUseBytes);
+        // 一次归还大量对象后线程缓存不超过容量上限
+        assert(ThreadCache::getInstance()->getCachedBytes() <= ThreadCache::getInstance()->getMaxCachedBytes());
+    }
+
+    // 批量分配的对象可逐个释放, 逐个分配的对象可批量释放
+    std::vector<void*> ptrs(300);
+    assert(MemoryPool::allocateBatch(SIZE, ptrs.size(), ptrs.data()) == ptrs.size());
+    for(void* ptr : ptrs) {
+        MemoryPool::deallocate(ptr, SIZE);
+    }
+    for(void*& ptr : ptrs) {
+        ptr = MemoryPool::allocate(SIZE);
+    }
+    MemoryPool::deallocateBatch(SIZE, ptrs.size(), ptrs.data());
+
+    // 大对象和0大小
+    void* large[4];
+    assert(MemoryPool::allocateBatch(MAX_BYTES + 1, 4, large) == 4);
+    for(void* ptr : large) {
+        assert(PageCache::getInstance().getSpan(ptr)->sizeClass == NO_SIZE_CLASS);
+    }
+    MemoryPool::deallocateBatch(MAX_BYTES + 1, 4, large);
+    void* empty[16];
+    assert(MemoryPool::allocateBatch(0, 16, empty) == 16);
+    MemoryPool::deallocateBatch(0, 16, empty);
+
+    // 开启采样时批量分配同样被采样, 批量释放后不再存活
+    HeapProfiler& profiler = HeapProfiler::getInstance();
+    HeapProfileStats before = profiler.getStats();
+    profiler.setSamplingInterval(4096);
+    std::vector<void*> sampled(1000);
+    assert(MemoryPool::allocateBatch(256, sampled.size(), sampled.data()) == sampled.size());
+    assert(profiler.getStats().sampledAllocations > before.sampledAllocations);
+    MemoryPool::deallocateBatch(256, sampled.size(), sampled.data());
+    profiler.setSamplingInterval(0);
+    assert(profiler.getStats().liveObjects == before.liveObjects);
+
+    std::cout << "Batch allocation test passed!" << std::endl;
+}
+
+// 标准容器分配器测试
+void testPoolAllocator() {
+    std::cout << "Running pool allocator test..." << std::endl;
+
+    // 各种容器的节点都来自内存池, 释放全部走带大小的路径
+    MemoryPoolStats before = MemoryPool::getStats();
+    {
+        std::vector<int, PoolAllocator<int>> vec;
+        for(int i = 0; i < 10000; ++i) {
+            vec.push_back(i);
+        }
+        std::map<int, int, std::less<int>, PoolAllocator<std::pair<const int, int>>> map;
+        std::list<int, PoolAllocator<int>> list;
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, PoolAllocator<std::pair<const int, int>>> hash;
+        for(int i = 0; i < 1000; ++i) {
+            map[i] = i;
+            list.push_back(i);
+            hash[i] = i;
+        }
+        for(int i = 0; i < 1000; i += 2) {
+            map.erase(i);
+            hash.erase(i);
+        }
+        assert(map.size() == 500 && hash.size() == 500 && list.size() == 1000);
+        assert(vec[9999] == 9999 && map[999] == 999 && hash[1] == 1);
+        assert(PageCache::getInstance().getSpan(vec.data()) != nullptr);
+        assert(PageCache::getInstance().getSpan(&*map.begin()) != nullptr);
+        assert(PageCache::getInstance().getSpan(&list.front()) != nullptr);
+
+        // 两个链表的节点来自同一个无状态分配器, splice只搬移节点
+        std::list<int, PoolAllocator<int>> other(list.get_allocator());
+        other.splice(other.end(), list, list.begin(), std::next(list.begin(), 500));
+        assert(list.size() == 500 && other.size() == 500 && other.front() == 0);
+    }
+    MemoryPoolStats after = MemoryPool::getStats();
+    size_t allocs = 0;
+    size_t frees = 0;
+    for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        allocs += after.classes[index].allocations - before.classes[index].allocations;
+        frees += after.classes[index].deallocations - before.classes[index].deallocations;
+    }
+    assert(allocs >= 3000 && allocs == frees);
+
+    // 分配器的相等性和rebind
+    PoolAllocator<int> intAlloc;
+    PoolAllocator<double> doubleAlloc(intAlloc);
+    assert(intAlloc == doubleAlloc && !(intAlloc != doubleAlloc));
+    static_assert(std::allocator_traits<PoolAllocator<int>>::is_always_equal::value, "stateless allocator");
+
+    // 过度对齐的元素按其对齐分配
+    struct alignas(64) Line {
+        char bytes[64];
+    };
+    std::vector<Line, PoolAllocator<Line>> lines(37);
+    assert(reinterpret_cast<uintptr_t>(lines.data()) % 64 == 0);
+    std::list<Line, PoolAllocator<Line>> lineList(5);
+    for(const Line& line : lineList) {
+        assert(reinterpret_cast<uintptr_t>(&line) % 64 == 0);
+    }
+
+    // pmr资源: 按请求的对齐分配, 各实例相等
+    PoolMemoryResource& resource = PoolMemoryResource::getInstance();
+    for(size_t alignment : {size_t(8), size_t(16), size_t(256), size_t(4096), size_t(64 * 1024)}) {
+        void* ptr = resource.allocate(1000, alignment);
+        assert(reinterpret_cast<uintptr_t>(ptr) % alignment == 0);
+        memset(ptr, 0xab, 1000);
+        resource.deallocate(ptr, 1000, alignment);
+    }
+    PoolMemoryResource another;
+    assert(resource.is_equal(another) && !resource.is_equal(*std::pmr::new_delete_resource()));
+    {
+        std::pmr::vector<std::pmr::string> strings(&resource);
+        for(int i = 0; i < 1000; ++i) {
+            strings.emplace_back(std::to_string(i) + " is a string long enough to need its own allocation");
+        }
+        assert(strings.get_allocator().resource() == &resource);
+        assert(PageCache::getInstance().getSpan(strings[999].data()) != nullptr);
+        std::pmr::map<int, std::pmr::string> map(&another);
+        for(int i = 0; i < 1000; ++i) {
+            map.emplace(i, strings[i]);
+        }
+        assert(map[500] == strings[500]);
+    }
+
+    std::cout << "Pool allocator test passed!" << std::endl;
+}
+
+// newObject/deleteObject测试使用的对象, 记录存活个数, 参数为负时构造失败
+struct Tracked {
+    static inline int live = 0;
+    int value;
+    std::string name;
+    Tracked(int v, std::string n) : value(v), name(std::move(n)) {
+        if(v < 0) throw std::invalid_argument("negative");
+        live++;
+    }
+    ~Tracked() { live--; }
+};
+
+// 编译期大小类测试
+void testCompileTimeAllocation() {
+    std::cout << "Running compile-time allocation test..." << std::endl;
+
+    static_assert(SizeClass::getIndex(100) == SizeClass::getIndex(SizeClass::roundUp(100)), "constexpr size class");
+    static_assert(SizeClass::classSize(SizeClass::getAlignedIndex(48, 64)) % 64 == 0, "constexpr aligned class");
+
+    // 与运行期路径选用同一个大小类, 两种路径分配和释放可以混用
+    auto check = [](void* ptr, size_t size) {
+        assert(ptr != nullptr);
+        Span* span = PageCache::getInstance().getSpan(ptr);
+        assert(span != nullptr);
+        if(size <= MAX_BYTES) {
+            assert(span->sizeClass == SizeClass::getIndex(size == 0 ? ALIGNMENT : size));
+        }
+        else {
+            assert(span->sizeClass == NO_SIZE_CLASS);
+        }
+        memset(ptr, 0x5a, size);
+    };
+    void* p0 = MemoryPool::allocate<0>();
+    check(p0, 0);
+    MemoryPool::deallocate<0>(p0);
+    void* p24 = MemoryPool::allocate<24>();
+    check(p24, 24);
+    MemoryPool::deallocate(p24, 24);
+    void* p1000 = MemoryPool::allocate(1000);
+    check(p1000, 1000);
+    MemoryPool::deallocate<1000>(p1000);
+    void* pMax = MemoryPool::allocate<MAX_BYTES>();
+    check(pMax, MAX_BYTES);
+    MemoryPool::deallocate<MAX_BYTES>(pMax);
+    void* pLarge = MemoryPool::allocate<MAX_BYTES + 1>();
+    check(pLarge, MAX_BYTES + 1);
+    MemoryPool::deallocate<MAX_BYTES + 1>(pLarge);
+
+    // 分配释放次数照常计入统计
+    constexpr size_t COUNT = 1000;
+    size_t index = SizeClass::getIndex(64);
+    MemoryPoolStats before = MemoryPool::getStats();
+    std::vector<void*> ptrs;
+    for(size_t i = 0; i < COUNT; ++i) {
+        ptrs.push_back(MemoryPool::allocate<64>());
+    }
+    for(void* ptr : ptrs) {
+        MemoryPool::deallocate<64>(ptr);
+    }
+    MemoryPoolStats after = MemoryPool::getStats();
+    assert(after.classes[index].allocations - before.classes[index].allocations == COUNT);
+    assert(after.classes[index].deallocations - before.classes[index].deallocations == COUNT);
+
+    // 对齐: 与allocateAligned一致, 可用deallocateAligned释放
+    void* aligned = MemoryPool::allocate<48, 64>();
+    assert(reinterpret_cast<uintptr_t>(aligned) % 64 == 0);
+    MemoryPool::deallocateAligned(aligned, 48, 64);
+    aligned = MemoryPool::allocateAligned(48, 64);
+    MemoryPool::deallocate<48, 64>(aligned);
+    void* pageAligned = MemoryPool::allocate<100, 4 * PAGE_SIZE>();
+    assert(reinterpret_cast<uintptr_t>(pageAligned) % (4 * PAGE_SIZE) == 0);
+    MemoryPool::deallocate<100, 4 * PAGE_SIZE>(pageAligned);
+
+    // newObject/deleteObject: 构造析构各一次, 构造函数抛出异常时内存已释放
+    Tracked* obj = MemoryPool::newObject<Tracked>(7, "seven");
+    assert(obj->value == 7 && obj->name == "seven" && Tracked::live == 1);
+    MemoryPool::deleteObject(obj);
+    assert(Tracked::live == 0);
+    MemoryPool::deleteObject<Tracked>(nullptr);
+
+    size_t trackedIndex = SizeClass::getIndex(sizeof(Tracked));
+    MemoryPoolStats beforeThrow = MemoryPool::getStats();
+    bool threw = false;
+    try {
+        MemoryPool::newObject<Tracked>(-1, "bad");
+    }
+    catch(const std::invalid_argument&) {
+        threw = true;
+    }
+    MemoryPoolStats afterThrow = MemoryPool::getStats();
+    assert(threw && Tracked::live == 0);
+    assert(afterThrow.classes[trackedIndex].deallocations - beforeThrow.classes[trackedIndex].deallocations == 1);
+
+    struct alignas(128) Wide {
+        char bytes[40];
+    };
+    std::vector<Wide*> wides;
+    for(int i = 0; i < 100; ++i) {
+        wides.push_back(MemoryPool::newObject<Wide>());
+        assert(reinterpret_cast<uintptr_t>(wides.back()) % 128 == 0);
+    }
+    for(Wide* wide : wides) {
+        MemoryPool::deleteObject(wide);
+    }
+
+    // 编译期路径同样参与堆分析采样
+    HeapProfiler& profiler = HeapProfiler::getInstance();
+    HeapProfileStats profileBefore = profiler.getStats();
+    profiler.setSamplingInterval(4096);
+    ptrs.clear();
+    for(size_t i = 0; i < 10000; ++i) {
+        ptrs.push_back(MemoryPool::allocate<256>());
+    }
+    assert(profiler.getStats().sampledAllocations > profileBefore.sampledAllocations);
+    for(void* ptr : ptrs) {
+        MemoryPool::deallocate<256>(ptr);
+    }
+    profiler.setSamplingInterval(0);
+    assert(profiler.getStats().liveObjects == profileBefore.liveObjects);
+
+    // 每CPU前端
+    if(MemoryPool::setFrontEnd(FrontEnd::PerCpu)) {
+        void* ptr = MemoryPool::allocate<64>();
+        check(ptr, 64);
+        MemoryPool::deallocate<64>(ptr);
+        Tracked* cpuObj = MemoryPool::newObject<Tracked>(1, "cpu");
+        MemoryPool::deleteObject(cpuObj);
+        MemoryPool::setFrontEnd(FrontEnd::PerThread);
+    }
+
+    std::cout << "Compile-time allocation test passed!" << std::endl;
+}
+
+// 大小类之间的内存复用测试: 一个大小类完全释放的span可被其他大小类使用
+void testTransferCache() {
+    std::cout << "Running transfer cache test..." << std::endl;
+
+    CentralCache& central = CentralCache::getInstance();
+    size_t index = SizeClass::getIndex(48);
+    size_t batch = SizeClass::batchNum(index);
+    size_t capacity = detail::transferCapacity(index);
+
+    // 先取走足够多的整批, 保证该类的传输缓存已空
+    struct Batch {
+        void* head;
+        void* tail;
+        size_t count;
+    };
+    std::vector<Batch> batches;
+    for(size_t i = 0; i < capacity + 1; ++i) {
+        Batch b{nullptr, nullptr, batch};
+        b.head = central.fetchRange(index, b.count, b.tail);
+        assert(b.head && b.count == batch);
+
+        // 返回的链表尾确实是第count个对象
+        void* node = b.head;
+        for(size_t j = 1; j < b.count; ++j) {
+            node = *reinterpret_cast<void**>(node);
+        }
+        assert(node == b.tail && *reinterpret_cast<void**>(node) == nullptr);
+        batches.push_back(b);
+    }
+
+    // 整批归还后原样取回, 不经过span
+    CentralCacheStats before = central.getStats();
+    central.returnRange(batches[0].head, batches[0].tail, batch, index);
+    size_t count = batch;
+    void* tail = nullptr;
+    void* head = central.fetchRange(index, count, tail);
+    CentralCacheStats after = central.getStats();
+    assert(head == batches[0].head && tail == batches[0].tail && count == batch);
+    assert(after.transferReturnCount == before.transferReturnCount + 1);
+    assert(after.transferFetchCount == before.transferFetchCount + 1);
+
+    // 不足一批的归还和获取仍走span
+    before = central.getStats();
+    void* single = batches[1].head;
+    batches[1].head = *reinterpret_cast<void**>(single);
+    batches[1].count--;
+    *reinterpret_cast<void**>(single) = nullptr;
+    central.returnRange(single, single, 1, index);
+    count = 1;
+    head = central.fetchRange(index, count, tail);
+    after = central.getStats();
+    assert(head && head == tail && count == 1);
+    assert(after.transferReturnCount == before.transferReturnCount);
+    assert(after.transferFetchCount == before.transferFetchCount);
+    central.returnRange(head, tail, 1, index);
+
+    for(auto& b : batches) {
+        central.returnRange(b.head, b.tail, b.count, index);
+    }
+
+    std::cout << "Transfer cache test passed!" << std::endl;
+}
+
+void testSpinLock() {
+    std::cout << "Running spin lock test..." << std::endl;
+
+    constexpr int NUM_THREADS = 8;
+    constexpr int ITERATIONS = 2000;
+
+    SpinLock lock;
+    size_t counter = 0;
+    std::vector<std::thread> threads;
+    for(int i = 0; i < NUM_THREADS; ++i) {
+        threads.emplace_back([&]() {
+            for(int j = 0; j < ITERATIONS; ++j) {
+                std::lock_guard<SpinLock> guard(lock);
+                size_t value = counter;
+                // 持锁时让出CPU, 制造持锁线程被抢占的竞争
+                if(j % 64 == 0) {
+                    std::this_thread::yield();
+                }
+                counter = value + 1;
+            }
+        });
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+
+    LockStats stats = lock.getStats();
+    std::cout << "  acquisitions " << stats.acquisitions << ", contended " << stats.contended
+              << ", wait " << stats.waitNanos / 1000 << " us" << std::endl;
+    assert(counter == size_t(NUM_THREADS) * ITERATIONS);
+    assert(stats.acquisitions == counter);
+    assert(stats.contended <= stats.acquisitions);
+    assert(stats.contended == 0 || stats.waitNanos > 0);
+
+    assert(lock.try_lock());
+    assert(!lock.try_lock());
+    lock.unlock();
+    assert(lock.getStats().acquisitions == counter + 1);
+
+    std::cout << "Spin lock test passed!" << std::endl;
+}
+
+void testPageArenas() {
+    std::cout << "Running page arena test..." << std::endl;
+
+    PageCache& pageCache = PageCache::getInstance();
+    size_t oldArenas = pageCache.getNumArenas();
+    pageCache.setNumArenas(4);
+
+    // 小对象span按大小类分配arena, 释放后回到原arena
+    void* span1 = pageCache.allocateSpan(512, 1);
+    assert(pageCache.getSpan(span1)->arena == 1);
+    pageCache.deallocateSpan(span1);
+    assert(pageCache.getArenaStats(1).retainedBytes >= 512 * PAGE_SIZE);
+
+    // 空的arena先从其他arena挪用空闲span, 不向系统申请
+    PageHeapStats before = pageCache.getStats();
+    size_t retained3 = pageCache.getArenaStats(3).retainedBytes;
+    void* span3 = pageCache.allocateSpan(300, 3);
+    PageHeapStats after = pageCache.getStats();
+    assert(after.stolenSpans == before.stolenSpans + (retained3 < 300 * PAGE_SIZE ? 1 : 0));
+    assert(after.mappedBytes == before.mappedBytes);
+    assert(pageCache.getSpan(span3)->arena == 3);
+    memset(span3, 0x33, 300 * PAGE_SIZE);
+
+    // 挪用来的span归新的arena管理
+    pageCache.deallocateSpan(span3);
+    assert(pageCache.getArenaStats(3).retainedBytes >= 300 * PAGE_SIZE);
+
+    // 多线程在多个arena上分配释放大小对象
+    constexpr int NUM_THREADS = 8;
+    std::atomic<bool> hasError{false};
+    auto threadFunc = [&](int id) {
+        std::mt19937 gen(id);
+        std::vector<std::pair<unsigned char*, size_t>> ptrs;
+        for(int i = 0; i < 2000; ++i) {
+            size_t size = i % 50 == 0 ? MAX_BYTES + (gen() % 64) * PAGE_SIZE : (gen() % 4096) + 1;
+            unsigned char* ptr = static_cast<unsigned char*>(MemoryPool::allocate(size));
+            ptr[0] = ptr[size - 1] = static_cast<unsigned char>(id);
+            ptrs.emplace_back(ptr, size);
+            if(gen() % 2) {
+                auto [victim, victimSize] = ptrs[gen() % ptrs.size()];
+                if(victim[0] != id || victim[victimSize - 1] != id) {
+                    hasError = true;
+                }
+            }
+        }
+        for(auto& [ptr, size] : ptrs) {
+            MemoryPool::deallocate(ptr, size);
+        }
+    };
+    std::vector<std::thread> threads;
+    for(int i = 0; i < NUM_THREADS; ++i) {
+        threads.emplace_back(threadFunc, i + 1);
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    assert(!hasError);
+
+    pageCache.setNumArenas(oldArenas);
+    std::cout << "Page arena test passed!" << std::endl;
+}
+
+void testNumaNodes() {
+    std::cout << "Running NUMA node test..." << std::endl;
+
+    // 在单节点机器上伪造两个节点, 线程固定视为某个节点
+    NumaTopology& numa = NumaTopology::getInstance();
+    NumaConfig oldConfig = numa.getConfig();
+    NumaConfig config;
+    config.fakeNodes = 2;
+    numa.configure(config);
+    assert(numa.numNodes() == 2);
+
+    PageCache& pageCache = PageCache::getInstance();
+    size_t oldArenas = pageCache.getNumArenas();
+    pageCache.setNumArenas(4);
+    // 之前缓存的大对象span属于修改配置前的arena
+    LargeCache::getInstance().flush();
+
+    // 每个线程分配的小对象和大对象都来自本节点的页
+    constexpr size_t NUM_PTRS = 2000;
+    std::vector<void*> ptrs[2];
+    std::atomic<bool> hasError{false};
+    auto allocFunc = [&](int node) {
+        NumaTopology::setThreadNode(node);
+        for(size_t i = 0; i < NUM_PTRS; ++i) {
+            size_t size = i % 100 == 0 ? MAX_BYTES + PAGE_SIZE : (i % 512) + 1;
+            void* ptr = MemoryPool::allocate(size);
+            memset(ptr, node + 1, size);
+            Span* span = pageCache.getSpan(ptr);
+            if(span->node != static_cast<uint32_t>(node) || span->arena.load() / 2 != static_cast<uint32_t>(node)) {
+                hasError = true;
+            }
+            ptrs[node].push_back(ptr);
+        }
+    };
+    std::thread t0(allocFunc, 0);
+    std::thread t1(allocFunc, 1);
+    t0.join();
+    t1.join();
+    assert(!hasError);
+
+    // 交叉释放: 对象经过另一节点的线程缓存, 最终还回所属节点的中心缓存
+    auto freeFunc = [&](int node) {
+        NumaTopology::setThreadNode(node);
+        for(void* ptr : ptrs[1 - node]) {
+            MemoryPool::deallocate(ptr);
+        }
+    };
+    std::thread f0(freeFunc, 0);
+    std::thread f1(freeFunc, 1);
+    f0.join();
+    f1.join();
+
+    // 再次分配时两个节点的对象不会混在一起
+    std::thread r0(allocFunc, 0);
+    std::thread r1(allocFunc, 1);
+    r0.join();
+    r1.join();
+    assert(!hasError);
+    for(int node = 0; node < 2; ++node) {
+        for(size_t i = NUM_PTRS; i < ptrs[node].size(); ++i) {
+            MemoryPool::deallocate(ptrs[node][i]);
+        }
+    }
+
+    pageCache.setNumArenas(oldArenas);
+    numa.configure(oldConfig);
+    std::cout << "NUMA node test passed!" << std::endl;
+}
+
+void testSpanReuseAcrossClasses() {
+    std::cout << "Running span reuse across classes test..." << std::endl;
+
+    constexpr size_t TOTAL_BYTES = 32 * 1024 * 1024;
+    PageCache& pageCache = PageCache::getInstance();
+
+    auto churn = [](size_t size) {
+        std::vector<void*> ptrs;
+        for(size_t i = 0; i < TOTAL_BYTES / size; ++i) {
+            ptrs.push_back(MemoryPool::allocate(size));
+        }
+        for(void* ptr : ptrs) {
+            MemoryPool::deallocate(ptr, size);
+        }
+    };
+
+    // 先用小对象占满32MB, 全部释放后再换成另一种大小
+    churn(48);
+    size_t mapped = pageCache.getStats().mappedBytes;
+    churn(3072);
+    churn(640);
+    size_t grown = pageCache.getStats().mappedBytes - mapped;
+    std::cout << "  mapped bytes grown after size shift: " << grown / 1024 << " KB" << std::endl;
+    assert(grown < TOTAL_BYTES / 4);
+
+    std::cout << "Span reuse across classes test passed!" << std::endl;
+}
+
+// 线程反复创建退出的压力测试: 线程缓存在退出时归还, 内存不随线程数增长
+void testThreadExitFlush() {
+    std::cout << "Running thread exit flush test..." << std::endl;
+
+    constexpr int NUM_ROUNDS = 200;
+    constexpr int THREADS_PER_ROUND = 4;
+    constexpr int ALLOCS_PER_THREAD = 2000;
+
+    auto threadFunc = []() {
+        std::vector<std::pair<void*, size_t>> ptrs;
+        for(int i = 0; i < ALLOCS_PER_THREAD; ++i) {
+            size_t size = (rand() % 512 + 1) * 8;
+            ptrs.emplace_back(MemoryPool::allocate(size), size);
+        }
+        // 全部释放后对象都留在本线程缓存中
+        for(auto& [ptr, size] : ptrs) {
+            MemoryPool::deallocate(ptr, size);
+        }
+        assert(ThreadCache::getInstance()->getCachedBytes() > 0);
+    };
+
+    auto runRound = [&]() {
+        std::vector<std::thread> threads;
+        for(int i = 0; i < THREADS_PER_ROUND; ++i) {
+            threads.emplace_back(threadFunc);
+        }
+        for(auto& thread : threads) {
+            thread.join();
+        }
+    };
+
+    // 预热后记录基线
+    size_t baseCached = ThreadCache::getTotalCachedBytes();
+    for(int i = 0; i < 5; ++i) {
+        runRound();
+    }
+    size_t baseMapped = PageCache::getInstance().getStats().mappedBytes;
+
+    for(int i = 0; i < NUM_ROUNDS; ++i) {
+        runRound();
+    }
+
+    size_t mapped = PageCache::getInstance().getStats().mappedBytes;
+    std::cout << "  mapped bytes after " << NUM_ROUNDS * THREADS_PER_ROUND << " threads: "
+              << baseMapped / 1024 << " KB -> " << mapped / 1024 << " KB" << std::endl;
+    assert(mapped - baseMapped <= baseMapped / 10);
+    assert(ThreadCache::getTotalCachedBytes() == baseCached);
+
+    size_t cached[16];
+    assert(ThreadCache::listCachedBytes(cached, 16) == 1);
+    assert(cached[0] == baseCached);
+
+    // 总预算调小后, 唯一存活线程的缓存不超过预算
+    constexpr size_t MAX_CACHED = 1024 * 1024;
+    size_t oldBudget = ThreadCache::getMaxTotalCachedBytes();
+    ThreadCache::setMaxTotalCachedBytes(MAX_CACHED);
+    std::vector<std::pair<void*, size_t>> ptrs;
+    for(int i = 0; i < ALLOCS_PER_THREAD; ++i) {
+        size_t size = (rand() % 512 + 1) * 8;
+        ptrs.emplace_back(MemoryPool::allocate(size), size);
+    }
+    for(auto& [ptr, size] : ptrs) {
+        MemoryPool::deallocate(ptr, size);
+        assert(ThreadCache::getInstance()->getCachedBytes() <= MAX_CACHED);
+    }
+    ThreadCache::setMaxTotalCachedBytes(oldBudget);
+
+    std::cout << "Thread exit flush test passed!" << std::endl;
+}
+
+void testCacheBudgetStealing() {
+    std::cout << "Running cache budget stealing test..." << std::endl;
+
+    constexpr size_t BUDGET = 4 * 1024 * 1024;
+    constexpr int NUM_ALLOCS = 20000;
+    size_t oldBudget = ThreadCache::getMaxTotalCachedBytes();
+    ThreadCache::setMaxTotalCachedBytes(BUDGET);
+
+    // 分配一批不同大小的对象后全部释放, 让本线程缓存尽量增长
+    auto churn = []() {
+        std::vector<std::pair<void*, size_t>> ptrs;
+        for(int i = 0; i < NUM_ALLOCS; ++i) {
+            size_t size = (rand() % 256 + 1) * 16;
+            ptrs.emplace_back(MemoryPool::allocate(size), size);
+        }
+        for(auto& [ptr, size] : ptrs) {
+            MemoryPool::deallocate(ptr, size);
+        }
+    };
+
+    std::mutex mutex;
+    std::condition_variable cond;
+    int phase = 0;
+    auto advance = [&](int next) {
+        std::lock_guard<std::mutex> lock(mutex);
+        phase = next;
+        cond.notify_all();
+    };
+    auto waitFor = [&](int target) {
+        std::unique_lock<std::mutex> lock(mutex);
+        cond.wait(lock, [&]() { return phase >= target; });
+    };
+    // 分配churn没用过的大小类, 从中心缓存取批并更新活跃时间, 再释放, 走一次慢路径上的容量检查
+    auto touchCache = []() {
+        constexpr size_t TOUCH_SIZE = 128 * 1024;
+        MemoryPool::deallocate(MemoryPool::allocate(TOUCH_SIZE), TOUCH_SIZE);
+    };
+
+    size_t idleMaxBefore = 0;
+    size_t idleMaxAfter = 0;
+    size_t idleCachedBefore = 0;
+    size_t idleCachedAfter = 0;
+
+    // 先变忙领走大部分预算, 然后空闲等待
+    std::thread idle([&]() {
+        for(int i = 0; i < 3; ++i) {
+            churn();
+        }
+        idleMaxBefore = ThreadCache::getInstance()->getMaxCachedBytes();
+        advance(1);
+
+        // 容量被挪用后走一次慢路径, 此时本线程比忙线程更近活跃, 应收缩到新上限而不是挪用回来
+        waitFor(3);
+        idleCachedBefore = ThreadCache::getInstance()->getCachedBytes();
+        touchCache();
+        idleCachedAfter = ThreadCache::getInstance()->getCachedBytes();
+        idleMaxAfter = ThreadCache::getInstance()->getMaxCachedBytes();
+        advance(4);
+        waitFor(5);
+    });
+    waitFor(1);
+
+    // 预算用尽后忙线程从空闲线程挪用容量
+    size_t hotMax = 0;
+    std::thread hot([&]() {
+        for(int i = 0; i < 3; ++i) {
+            churn();
+        }
+        hotMax = ThreadCache::getInstance()->getMaxCachedBytes();
+        assert(ThreadCache::getInstance()->getCachedBytes() <= hotMax);
+        advance(2);
+        waitFor(5);
+    });
+    waitFor(2);
+    advance(3);
+    waitFor(4);
+
+    // 三个线程都存活时, 各自走过一次释放路径后缓存的字节之和不超过预算
+    touchCache();
+    size_t totalCached = ThreadCache::getTotalCachedBytes();
+    advance(5);
+    hot.join();
+    idle.join();
+
+    std::cout << "  idle thread capacity: " << idleMaxBefore / 1024 << " KB -> " << idleMaxAfter / 1024
+              << " KB, cached: " << idleCachedBefore / 1024 << " KB -> " << idleCachedAfter / 1024
+              << " KB, hot thread capacity: " << hotMax / 1024 << " KB, total cached: " << totalCached / 1024
+              << " KB" << std::endl;
+    assert(idleMaxBefore > BUDGET / 2);
+    assert(idleMaxAfter < idleMaxBefore);
+    assert(idleCachedAfter <= idleMaxAfter);
+    assert(idleCachedAfter < idleCachedBefore);
+    assert(hotMax > BUDGET / 4);
+    assert(totalCached <= BUDGET);
+
+    // 线程退出后容量还回预算
+    ThreadCache::setMaxTotalCachedBytes(oldBudget);
+    assert(ThreadCache::getUnclaimedCachedBytes()
+           == static_cast<ptrdiff_t>(oldBudget - ThreadCache::getInstance()->getMaxCachedBytes()));
+
+    std::cout << "Cache budget stealing test passed!" << std::endl;
+}
+
+
+void testPerCpuCache() {
+    std::cout << "Running per-CPU cache test..." << std::endl;
+
+    if(!CpuCache::isSupported()) {
+        assert(!MemoryPool::setFrontEnd(FrontEnd::PerCpu));
+        assert(MemoryPool::getFrontEnd() == FrontEnd::PerThread);
+        std::cout << "  rseq unavailable, per-thread front end kept" << std::endl;
+        std::cout << "Per-CPU cache test passed!" << std::endl;
+        return;
+    }
+
+    // 切换前由线程缓存分配的对象, 切换后仍能释放
+    void* before = MemoryPool::allocate(64);
+    assert(MemoryPool::setFrontEnd(FrontEnd::PerCpu));
+    assert(MemoryPool::getFrontEnd() == FrontEnd::PerCpu);
+    MemoryPool::deallocate(before, 64);
+
+    constexpr int NUM_THREADS = 8;
+    constexpr int ALLOCS_PER_THREAD = 5000;
+    std::atomic<bool> hasError{false};
+
+    auto threadFunc = [&](int id) {
+        std::mt19937 gen(id);
+        std::vector<std::pair<unsigned char*, size_t>> ptrs;
+        for(int round = 0; round < 4; ++round) {
+            for(int i = 0; i < ALLOCS_PER_THREAD; ++i) {
+                size_t size = (gen() % 512 + 1) * 8;
+                unsigned char* ptr = static_cast<unsigned char*>(MemoryPool::allocate(size));
+                memset(ptr, id, size);
+                ptrs.emplace_back(ptr, size);
+            }
+            for(auto& [ptr, size] : ptrs) {
+                if(ptr[0] != id || ptr[size - 1] != id) {
+                    hasError = true;
+                }
+                // 交替使用带大小和不带大小的释放
+                if(size % 16) {
+                    MemoryPool::deallocate(ptr, size);
+                }
+                else {
+                    MemoryPool::deallocate(ptr);
+                }
+            }
+            ptrs.clear();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for(int i = 0; i < NUM_THREADS; ++i) {
+        threads.emplace_back(threadFunc, i + 1);
+    }
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    assert(!hasError);
+
+    // 缓存大小只与CPU数有关: 每个CPU每个大小类最多两批
+    size_t perCpuLimit = 0;
+    for(size_t index = 0; index < FREE_LIST_SIZE; ++index) {
+        perCpuLimit += 2 * SizeClass::batchNum(index) * SizeClass::classSize(index);
+    }
+    size_t cached = CpuCache::getInstance().getCachedBytes();
+    std::cout << "  " << CpuCache::getInstance().getNumCpus() << " CPUs, cached " << cached / 1024 << " KB" << std::endl;
+    assert(cached > 0);
+    assert(cached <= CpuCache::getInstance().getNumCpus() * perCpuLimit);
+
+    // 大对象同样可用
+    void* large = MemoryPool::allocate(MAX_BYTES + 1);
+    memset(large, 0xAB, MAX_BYTES + 1);
+    MemoryPool::deallocate(large);
+
+    // slab覆盖possible列表中的每个CPU编号, 不少于配置的CPU数
+    assert(CpuCache::getInstance().getNumCpus() == NumaTopology::possibleCpus());
+    assert(CpuCache::getInstance().getNumCpus() >= static_cast<size_t>(sysconf(_SC_NPROCESSORS_CONF)));
+
+    // 切回线程缓存后释放每CPU缓存分配的对象, 各CPU slab中的对象已还给中心缓存
+    void* after = MemoryPool::allocate(128);
+    assert(MemoryPool::setFrontEnd(FrontEnd::PerThread));
+    assert(CpuCache::getInstance().getCachedBytes() == 0);
+    MemoryPool::deallocate(after, 128);
+
+    std::cout << "Per-CPU cache test passed!" << std::endl;
+}
+
+// fork测试: 其他线程持有内存池的锁时fork, 子进程不会死锁, 后台回收线程在子进程中可重新启动
+void testForkSafety() {
+    std::cout << "Running fork safety test..." << std::endl;
+
+    PageCache& pageCache = PageCache::getInstance();
+    ScavengerConfig oldConfig = pageCache.getScavengerConfig();
+    ScavengerConfig config = oldConfig;
+    config.backgroundPeriod = std::chrono::milliseconds(1);
+    pageCache.setScavengerConfig(config);
+    pageCache.startScavenger();
+    HeapProfiler& profiler = HeapProfiler::getInstance();
+    profiler.setSamplingInterval(4096);
+
+    // 覆盖线程缓存、堆分析器、大对象缓存、中心缓存和页缓存的加锁路径
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t] {
+            std::mt19937 gen(t);
+            while(!stop.load(std::memory_order_relaxed)) {
+                size_t size = gen() % 4 == 0 ? gen() % (4 * MAX_BYTES) + 1 : gen() % 4096 + 1;
+                void* ptr = MemoryPool::allocate(size);
+                MemoryPool::deallocate(ptr, size);
+                void* aligned = MemoryPool::allocateAligned(size, PAGE_SIZE);
+                MemoryPool::deallocateAligned(aligned, size, PAGE_SIZE);
+                if(gen() % 64 == 0) {
+                    MemoryPool::getStats();
+                }
+            }
+        });
+    }
+
+    checkForkChildren([](size_t size) { return MemoryPool::allocate(size); },
+                      [](void* ptr, size_t size) { MemoryPool::deallocate(ptr, size); });
+
+    // 子进程中重新启动和停止后台回收线程
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if(pid == 0) {
+        alarm(10);
+        PageCache::getInstance().startScavenger();
+        PageCache::getInstance().stopScavenger();
+        _exit(0);
+    }
+    int status = 0;
+    assert(waitpid(pid, &status, 0) == pid);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    stop = true;
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    profiler.setSamplingInterval(0);
+    pageCache.stopScavenger();
+    pageCache.setScavengerConfig(oldConfig);
+
+    std::cout << "Fork safety test passed!" << std::endl;
+}
+
+// 进程退出时才释放的对象, 由main在第一次使用内存池之前登记的atexit回调释放
+// 回调在全部静态析构之后运行, 单例从不析构, 此时仍可使用
+static void* exitSmall;
+static void* exitLarge;
+static void* exitResource;
+
+static void freeAtExit() {
+    MemoryPool::deallocate(exitSmall, 64);
+    MemoryPool::deallocate(exitLarge, 2 * MAX_BYTES);
+    PoolMemoryResource::getInstance().deallocate(exitResource, 256, 64);
+}
+
+void allocateForExit() {
+    exitSmall = MemoryPool::allocate(64);
+    exitLarge = MemoryPool::allocate(2 * MAX_BYTES);
+    exitResource = PoolMemoryResource::getInstance().allocate(256, 64);
+    assert(exitSmall && exitLarge && exitResource);
+}
 
-//         std::cout << "All tests passed successfully!" << std::endl;
-//         return 0;
-//     }
-//     catch (const std::exception& e) 
-//     {
-//         std::cerr << "Test failed with exception: " << e.what() << std::endl;
-//         return 1;
-//     }
-// }
 
 // 只记录最近一次分配的内存块
 static struct {
@@ -225,7 +2082,10 @@ void debug_free(void* ptr, size_t size) {
     memset(&last_block, 0, sizeof(last_block)); // 清空记录
 }
 
-int main() {
+// 调试输出测试
+void testDebugDump() {
+    std::cout << "Running debug dump test..." << std::endl;
+
     // 分配32字节内存
     void* p = debug_alloc(32);
     
@@ -237,5 +2097,63 @@ int main() {
     
     // 释放
     debug_free(p, 32);
-    return 0;
+
+    std::cout << "Debug dump test passed!" << std::endl;
+}
+
+int main(int argc, char* argv[]) 
+{
+    // 在LD_PRELOAD下运行时由testPreloadLibrary启动
+    if (argc > 1 && strcmp(argv[1], "--preload-child") == 0)
+    {
+        return runPreloadChild();
+    }
+
+    // 先于内存池的任何静态对象登记, 退出时最后运行
+    std::atexit(freeAtExit);
+
+    try 
+    {
+        std::cout << "Starting memory pool tests..." << std::endl;
+
+        testBasicAllocation();
+        testMemoryWriting();
+        testMultiThreading();
+        testEdgeCases();
+        testStress();
+        testSizeClassTable();
+        testPageMapLookup();
+        testUnsizedDeallocate();
+        testScavengeAfterBurst();
+        testHugePageRegions();
+        testLargeCache();
+        testReallocate();
+        testLazyZeroing();
+        testAlignedAllocation();
+        testPreloadLibrary();
+        testPoolStats();
+        testHeapProfiler();
+        testBatchAllocation();
+        testPoolAllocator();
+        testCompileTimeAllocation();
+        testSpanReuseAcrossClasses();
+        testTransferCache();
+        testSpinLock();
+        testPageArenas();
+        testNumaNodes();
+        testThreadExitFlush();
+        testCacheBudgetStealing();
+        testPerCpuCache();
+        testForkSafety();
+        allocateForExit();
+        testDebugDump();
+
+        std::cout << "All tests passed successfully!" << std::endl;
+        return 0;
+    }
+    catch (const std::exception& e) 
+    {
+        std::cerr << "Test failed with exception: " << e.what() << std::endl;
+        return 1;
+    }
 }
\ No newline at end of file